@@ -0,0 +1,473 @@
+/*
+ *  Text analysis program
+ * 
+ *  File: approx.c
+ *  Approximate counting of the most frequent words in fixed memory. Words
+ *  are counted by Space-Saving: a word without a counter takes over the
+ *  counter with the lowest count, adds one to it and remembers the old count
+ *  as it's error. Counts are never lower than true ones and at most
+ *  total / capacity higher, every word more frequent than that has a
+ *  counter. Optional Count-Min sketch gives another upper bound of each
+ *  word's count, the lower one of both is used. Word taking over a counter
+ *  then starts from it's estimate, counts are over by at most e * total /
+ *  width of sketch with high probability.
+ * 
+ *  Keys of counters are allocated in their exact size and take at most
+ *  APPROX_KEY_AVG bytes per counter together, so the budget holds for any
+ *  lengths of words. Word whose key doesn't fit isn't given a counter, it's
+ *  counted only by the sketch. Only when keys are longer than APPROX_KEY_AVG
+ *  on average, counts can then be lower than true ones.
+ * 
+ *  Letters and the longest word are counted exactly by the parser and
+ *  add_word_hashed, number of distinct words isn't known.
+ * 
+ *  Author: Martin Kucera, 2012
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "approx.h"
+#include "stat.h"
+#include "sort.h"
+#include "file.h"
+#include "err.h"
+#include "global.h"
+
+/**
+ *  approx_t *approx_create(unsigned long budget, int countmin)
+ * 
+ *  Allocates counters fitting into budget bytes together with their keys,
+ *  which get APPROX_KEY_AVG bytes per counter. With countmin, half of budget
+ *  is taken by Count-Min sketch.
+ */
+approx_t *approx_create(unsigned long budget, int countmin) {
+    approx_t *a;
+    unsigned long per_counter;
+    unsigned long i;
+    
+    if((a = (approx_t *) malloc(sizeof(approx_t))) == NULL) {
+        raise_error("Out of memory.");
+    }
+    
+    a->sketch = NULL;
+    a->width = 0;
+    
+    if(countmin) {
+        /* widest power of two rows fitting into half of budget */
+        a->width = 1;
+        while(a->width * 2 * APPROX_CM_DEPTH * sizeof(unsigned long) <= budget / 2) {
+            a->width *= 2;
+        }
+        
+        budget -= a->width * APPROX_CM_DEPTH * sizeof(unsigned long);
+        
+        a->sketch = (unsigned long *) calloc(a->width * APPROX_CM_DEPTH, sizeof(unsigned long));
+    }
+    
+    /* counter, it's heap entry, two index slots and a key */
+    per_counter = sizeof(approx_counter_t) + 3 * sizeof(unsigned long) + APPROX_KEY_AVG;
+    a->capacity = budget / per_counter;
+    
+    if(a->capacity == 0) {
+        raise_error("Memory budget of --approx is too small.");
+    }
+    
+    a->index_size = 1;
+    while(a->index_size < 2 * a->capacity) {
+        a->index_size *= 2;
+    }
+    
+    a->counters = (approx_counter_t *) malloc(sizeof(approx_counter_t) * a->capacity);
+    a->heap = (unsigned long *) malloc(sizeof(unsigned long) * a->capacity);
+    a->index = (unsigned long *) malloc(sizeof(unsigned long) * a->index_size);
+    
+    if(!a->counters || !a->heap || !a->index || (countmin && !a->sketch)) {
+        raise_error("Out of memory.");
+    }
+    
+    for(i = 0; i < a->index_size; i++) {
+        a->index[i] = APPROX_EMPTY;
+    }
+    
+    a->num = 0;
+    a->total = 0;
+    a->key_bytes = 0;
+    a->key_budget = a->capacity * APPROX_KEY_AVG;
+    
+    return a;
+}
+
+/**
+ *  void approx_sift(approx_t *a, unsigned long pos)
+ * 
+ *  Moves counter at pos of heap down after it's count was raised.
+ */
+void approx_sift(approx_t *a, unsigned long pos) {
+    unsigned long c = a->heap[pos];
+    unsigned long child;
+    
+    while((child = 2 * pos + 1) < a->num) {
+        if(child + 1 < a->num
+                && a->counters[a->heap[child + 1]].count < a->counters[a->heap[child]].count)
+            child++;
+        
+        if(a->counters[a->heap[child]].count >= a->counters[c].count)
+            break;
+        
+        a->heap[pos] = a->heap[child];
+        a->counters[a->heap[pos]].pos = pos;
+        pos = child;
+    }
+    
+    a->heap[pos] = c;
+    a->counters[c].pos = pos;
+}
+
+/**
+ *  void approx_sift_up(approx_t *a, unsigned long pos)
+ * 
+ *  Moves new counter at pos of heap up above counters with higher count.
+ */
+void approx_sift_up(approx_t *a, unsigned long pos) {
+    unsigned long c = a->heap[pos];
+    unsigned long parent;
+    
+    while(pos > 0) {
+        parent = (pos - 1) / 2;
+        
+        if(a->counters[a->heap[parent]].count <= a->counters[c].count)
+            break;
+        
+        a->heap[pos] = a->heap[parent];
+        a->counters[a->heap[pos]].pos = pos;
+        pos = parent;
+    }
+    
+    a->heap[pos] = c;
+    a->counters[c].pos = pos;
+}
+
+/**
+ *  unsigned long approx_find(approx_t *a, char *key, unsigned length, unsigned long hash)
+ * 
+ *  Returns slot of index with counter of key, or the empty slot ending it's
+ *  probe run.
+ */
+unsigned long approx_find(approx_t *a, char *key, unsigned length, unsigned long hash) {
+    unsigned long mask = a->index_size - 1;
+    unsigned long slot = HASH_SPREAD(hash) & mask;
+    approx_counter_t *c;
+    
+    while(a->index[slot] != APPROX_EMPTY) {
+        c = &a->counters[a->index[slot]];
+        
+        if(c->hash == hash && c->keylen == length && memcmp(c->key, key, length) == 0)
+            break;
+        
+        slot = (slot + 1) & mask;
+    }
+    
+    return slot;
+}
+
+/**
+ *  void approx_unindex(approx_t *a, unsigned long slot)
+ * 
+ *  Empties slot of index, following items of the probe run are shifted back
+ *  so no lookup stops at the hole.
+ */
+void approx_unindex(approx_t *a, unsigned long slot) {
+    unsigned long mask = a->index_size - 1;
+    unsigned long next = slot;
+    unsigned long home;
+    
+    for(;;) {
+        a->index[slot] = APPROX_EMPTY;
+        
+        do {
+            next = (next + 1) & mask;
+            
+            if(a->index[next] == APPROX_EMPTY)
+                return;
+            
+            home = HASH_SPREAD(a->counters[a->index[next]].hash) & mask;
+            /* item can move to slot if slot lies between it's home and it */
+        } while(((next - home) & mask) < ((next - slot) & mask));
+        
+        a->index[slot] = a->index[next];
+        slot = next;
+    }
+}
+
+/**
+ *  unsigned long approx_cell(approx_t *a, unsigned long hash, unsigned row)
+ * 
+ *  Returns index of sketch cell of word with hash in row. Hash is mixed
+ *  differently for each row, so words sharing a cell in one row rarely share
+ *  it in others.
+ */
+unsigned long approx_cell(approx_t *a, unsigned long hash, unsigned row) {
+    unsigned long x = hash ^ (row * 0x9e3779b9UL);
+    
+    x ^= x >> 16;
+    x *= 0x85ebca6bUL;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35UL;
+    x ^= x >> 16;
+    
+    return row * a->width + (x & (a->width - 1));
+}
+
+/**
+ *  unsigned long approx_sketch_add(approx_t *a, unsigned long hash)
+ * 
+ *  Adds one occurrence of word with hash into Count-Min sketch, returns
+ *  it's new estimated count.
+ */
+unsigned long approx_sketch_add(approx_t *a, unsigned long hash) {
+    unsigned long min = 0;
+    unsigned long *cell;
+    unsigned i;
+    
+    for(i = 0; i < APPROX_CM_DEPTH; i++) {
+        cell = &a->sketch[approx_cell(a, hash, i)];
+        (*cell)++;
+        
+        if(i == 0 || *cell < min)
+            min = *cell;
+    }
+    
+    return min;
+}
+
+/**
+ *  unsigned long approx_query(approx_t *a, approx_counter_t *c)
+ * 
+ *  Returns upper bound of count of counter's word, the lower one of it's
+ *  count and Count-Min estimate.
+ */
+unsigned long approx_query(approx_t *a, approx_counter_t *c) {
+    unsigned long min = c->count;
+    unsigned long cell;
+    unsigned i;
+    
+    if(a->sketch == NULL)
+        return min;
+    
+    for(i = 0; i < APPROX_CM_DEPTH; i++) {
+        cell = a->sketch[approx_cell(a, c->hash, i)];
+        
+        if(cell < min)
+            min = cell;
+    }
+    
+    return min;
+}
+
+/**
+ *  void approx_add_word(stats_t *st, char *key, unsigned length, unsigned long hash)
+ * 
+ *  Counts word in approximate counters of st, called by add_word_hashed.
+ *  When all counters are taken, or keys take all their bytes, the one with
+ *  the lowest count is given to the word. Word isn't given any counter if
+ *  it's key doesn't fit even then.
+ */
+void approx_add_word(stats_t *st, char *key, unsigned length, unsigned long hash) {
+    approx_t *a = st->approx;
+    approx_counter_t *c;
+    unsigned long slot, i, estimate = 0;
+    
+    if(length > st->w_length_max)
+        st->w_length_max = length;
+    
+    a->total++;
+    
+    if(a->sketch) {
+        estimate = approx_sketch_add(a, hash);
+    }
+    
+    slot = approx_find(a, key, length, hash);
+    
+    if(a->index[slot] != APPROX_EMPTY) {
+        c = &a->counters[a->index[slot]];
+        c->count++;
+        approx_sift(a, c->pos);
+        
+        return;
+    }
+    
+    if(a->num < a->capacity && a->key_bytes + length + 1 <= a->key_budget) {
+        /* no counter was taken yet, so the word is new */
+        i = a->num++;
+        c = &a->counters[i];
+        c->count = 1;
+        c->error = 0;
+        c->size = 0;
+        c->key = NULL;
+        c->pos = i;
+        a->heap[i] = i;
+    }
+    else {
+        if(a->num == 0)
+            return;
+        
+        /* least frequent word loses it's counter, unless the key doesn't
+         * fit even in place of it's key */
+        i = a->heap[0];
+        c = &a->counters[i];
+        
+        if(a->key_bytes - c->size + length + 1 > a->key_budget)
+            return;
+        
+        approx_unindex(a, approx_find(a, c->key, c->keylen, c->hash));
+        slot = approx_find(a, key, length, hash);
+        
+        if(a->sketch) {
+            /* counters lowered to estimates may be below counts of
+             * untracked words, only the sketch bounds count of the word */
+            c->count = estimate;
+            c->error = estimate - 1;
+        }
+        else {
+            c->error = c->count;
+            c->count++;
+        }
+    }
+    
+    /* keys take exactly their bytes of budget */
+    if(c->size != length + 1) {
+        a->key_bytes = a->key_bytes - c->size + length + 1;
+        c->size = length + 1;
+        
+        if((c->key = (char *) realloc(c->key, c->size)) == NULL) {
+            raise_error("Out of memory.");
+        }
+    }
+    
+    memcpy(c->key, key, length + 1);
+    c->keylen = length;
+    c->hash = hash;
+    
+    a->index[slot] = i;
+    
+    /* new counter is a leaf, taken one is the root */
+    if(c->pos > 0) {
+        approx_sift_up(a, c->pos);
+    }
+    else {
+        approx_sift(a, 0);
+    }
+}
+
+/**
+ *  int cmp_approx_counter(const void *a, const void *b)
+ * 
+ *  Compares two counters by count descending, then by key.
+ */
+int cmp_approx_counter(const void *a, const void *b) {
+    approx_counter_t *ca = *(approx_counter_t **) a;
+    approx_counter_t *cb = *(approx_counter_t **) b;
+    
+    if(ca->count != cb->count)
+        return (ca->count < cb->count) ? 1 : -1;
+    
+    return strcmp(ca->key, cb->key);
+}
+
+/**
+ *  approx_counter_t **approx_sorted(approx_t *a)
+ * 
+ *  Returns array of all used counters sorted by count descending, counts
+ *  are lowered to Count-Min estimates first. Array is freed by caller.
+ */
+approx_counter_t **approx_sorted(approx_t *a) {
+    approx_counter_t **sorted;
+    unsigned long i, count;
+    
+    if((sorted = (approx_counter_t **) malloc(sizeof(approx_counter_t *) * (a->num + 1))) == NULL) {
+        raise_error("Out of memory.");
+    }
+    
+    for(i = 0; i < a->num; i++) {
+        sorted[i] = &a->counters[i];
+        
+        count = approx_query(a, sorted[i]);
+        sorted[i]->error -= (sorted[i]->count - count < sorted[i]->error)
+                ? sorted[i]->count - count : sorted[i]->error;
+        sorted[i]->count = count;
+    }
+    
+    qsort(sorted, a->num, sizeof(approx_counter_t *), cmp_approx_counter);
+    
+    return sorted;
+}
+
+/**
+ *  void approx_write_stats(stats_t *st, FILE *output_file)
+ * 
+ *  Writes approximate stats to output_file, called by write_stats. Instead
+ *  of number of distinct words, total number of words and number of
+ *  counters with the bound of their error are written. Each word is
+ *  followed by it's count and how much the count can be higher than the
+ *  true one. With sort_set_top only the given number of words is written.
+ */
+void approx_write_stats(stats_t *st, FILE *output_file) {
+    approx_t *a = st->approx;
+    approx_counter_t **sorted;
+    char buff[OBUFFSIZE + KEY_MAX_LEN];
+    unsigned long i, num;
+    
+    if(a->total == 0) {
+        write_line(output_file, "There were no words in input file.");
+        return;
+    }
+    
+    sprintf(buff, "#tokens %lu", a->total);
+    write_line(output_file, buff);
+    
+    sprintf(buff, "#maxlen %u", st->w_length_max);
+    write_line(output_file, buff);
+    
+    /* no count is over by more than total / capacity, with sketch by more
+     * than e * total / width with probability 1 - e^-APPROX_CM_DEPTH */
+    sprintf(buff, "#approx %lu %lu", a->capacity, (a->sketch) 
+            ? (unsigned long) (APPROX_E * a->total / a->width) : a->total / a->capacity);
+    write_line(output_file, buff);
+    
+    write_line(output_file, "%%%");
+    
+    sorted = approx_sorted(a);
+    
+    num = (sort_top_count > 0 && sort_top_count < a->num) ? sort_top_count : a->num;
+    for(i = 0; i < num; i++) {
+        sprintf(buff, "%s %lu %lu", sorted[i]->key, sorted[i]->count, sorted[i]->error);
+        write_line(output_file, buff);
+    }
+    
+    free(sorted);
+    
+    write_line(output_file, "%%%");
+    
+    write_letters(st, output_file);
+}
+
+/**
+ *  void approx_free(approx_t *a)
+ * 
+ *  Frees counters, their keys and sketch.
+ */
+void approx_free(approx_t *a) {
+    unsigned long i;
+    
+    for(i = 0; i < a->num; i++) {
+        free(a->counters[i].key);
+    }
+    
+    free(a->counters);
+    free(a->heap);
+    free(a->index);
+    free(a->sketch);
+    free(a);
+}
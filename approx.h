@@ -0,0 +1,75 @@
+/*
+ *  Text analysis program
+ * 
+ *  File: approx.h
+ * 
+ *  Author: Martin Kucera, 2012
+ */
+
+#ifndef APPROX_H
+#define	APPROX_H
+
+#include <stdio.h>
+#include "stat.h"
+
+/* Average size of a key, used to turn memory budget into number of
+ * counters. Keys of all counters take at most this many bytes each. */
+#define APPROX_KEY_AVG 16
+/* Number of rows of Count-Min sketch, probability of any row giving error
+ * above the bound is e^-depth */
+#define APPROX_CM_DEPTH 4
+/* Base of natural logarithm, for error bound of Count-Min sketch */
+#define APPROX_E 2.718281828
+/* Empty slot of counter index */
+#define APPROX_EMPTY ((unsigned long) -1)
+
+/* Structures */
+
+typedef struct {
+    /* upper bound of word's count and how much it can be over */
+    unsigned long count;
+    unsigned long error;
+    
+    unsigned long hash;
+    unsigned keylen;
+    /* allocated size of key, keylen + 1 */
+    unsigned size;
+    char *key;
+    
+    /* position of counter in heap */
+    unsigned long pos;
+} approx_counter_t;
+
+struct approx {
+    /* Space-Saving counters and min-heap of their indexes by count */
+    approx_counter_t *counters;
+    unsigned long *heap;
+    unsigned long capacity;
+    unsigned long num;
+    
+    /* counters by hash, open addressing with linear probing */
+    unsigned long *index;
+    unsigned long index_size;
+    
+    /* bytes allocated by keys of counters and most they can take */
+    unsigned long key_bytes;
+    unsigned long key_budget;
+    
+    /* Count-Min sketch of APPROX_CM_DEPTH rows, NULL if not used */
+    unsigned long *sketch;
+    unsigned long width;
+    
+    /* number of all words added */
+    unsigned long total;
+};
+
+/* Function prototypes */
+
+approx_t *approx_create(unsigned long budget, int countmin);
+void approx_add_word(stats_t *st, char *key, unsigned length, unsigned long hash);
+unsigned long approx_query(approx_t *a, approx_counter_t *c);
+approx_counter_t **approx_sorted(approx_t *a);
+void approx_write_stats(stats_t *st, FILE *output_file);
+void approx_free(approx_t *a);
+
+#endif	/* APPROX_H */
@@ -0,0 +1,197 @@
+/*
+ *  Text analysis program
+ * 
+ *  File: arena.c
+ *  Bump allocator for words. Memory is taken from slabs of ASLABSIZE bytes by
+ *  moving a pointer, nothing is freed separately. All slabs are freed at
+ *  once when the words aren't needed anymore, so there's no per word cost of
+ *  malloc and free and words are packed next to each other.
+ * 
+ *  Author: Martin Kucera, 2012
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "global.h"
+#include "err.h"
+#include "arena.h"
+
+/* alignment of allocations, enough for any structure */
+typedef union {
+    long l;
+    double d;
+    void *p;
+} arena_align_t;
+
+#define ARENA_ALIGN(size) (((size) + sizeof(arena_align_t) - 1) / sizeof(arena_align_t) * sizeof(arena_align_t))
+
+/**
+ *  void arena_init(arena_t *arena)
+ * 
+ *  Initializes empty arena, first slab is allocated on first use.
+ */
+void arena_init(arena_t *arena) {
+    arena->slabs = NULL;
+    arena->pos = arena->end = NULL;
+    arena->allocs = arena->bytes = 0;
+    arena->nslabs = arena->slab_bytes = 0;
+}
+
+/**
+ *  void arena_reserve(arena_t *arena, unsigned long size)
+ * 
+ *  Allocates a new slab if there isn't size bytes left in the current one.
+ *  Requests larger than ASLABSIZE get their own slab.
+ */
+void arena_reserve(arena_t *arena, unsigned long size) {
+    arena_slab_t *slab;
+    unsigned long slab_size;
+    
+    if(arena->pos != NULL && (unsigned long) (arena->end - arena->pos) >= size)
+        return;
+    
+    slab_size = (size > ASLABSIZE) ? size : ASLABSIZE;
+    
+    if((slab = (arena_slab_t *) malloc(ARENA_ALIGN(sizeof(arena_slab_t)) + slab_size)) == NULL) {
+        raise_error("Out of memory.");
+    }
+    
+    slab->size = slab_size;
+    slab->next = arena->slabs;
+    arena->slabs = slab;
+    
+    arena->pos = (char *) slab + ARENA_ALIGN(sizeof(arena_slab_t));
+    arena->end = arena->pos + slab_size;
+    
+    arena->nslabs++;
+    arena->slab_bytes += slab_size;
+}
+
+/**
+ *  void *arena_alloc(arena_t *arena, unsigned long size)
+ * 
+ *  Returns size bytes of memory from the current slab, allocates a new slab
+ *  when there isn't enough space left.
+ */
+void *arena_alloc(arena_t *arena, unsigned long size) {
+    char *p;
+    
+    size = ARENA_ALIGN(size);
+    arena_reserve(arena, size);
+    
+    p = arena->pos;
+    arena->pos += size;
+    
+    arena->allocs++;
+    arena->bytes += size;
+    
+    return p;
+}
+
+/**
+ *  void *arena_alloc_line(arena_t *arena, unsigned long size)
+ * 
+ *  Same as arena_alloc, but returned memory starts at a cache line, so up to
+ *  CACHE_LINE bytes are read from memory at once. Skipped bytes are counted
+ *  as allocated.
+ */
+void *arena_alloc_line(arena_t *arena, unsigned long size) {
+    unsigned long pad;
+    
+    arena_reserve(arena, ARENA_ALIGN(size) + CACHE_LINE);
+    
+    /* only lower bits of address matter, they survive the conversion */
+    pad = (CACHE_LINE - (unsigned long) arena->pos % CACHE_LINE) % CACHE_LINE;
+    arena->pos += pad;
+    arena->bytes += pad;
+    
+    return arena_alloc(arena, size);
+}
+
+/**
+ *  void arena_move(arena_t *dst, arena_t *src)
+ * 
+ *  Moves all slabs of src to dst, memory allocated from src is then freed
+ *  with dst. Dst keeps allocating from it's current slab. Src is left empty.
+ */
+void arena_move(arena_t *dst, arena_t *src) {
+    arena_slab_t *last;
+    
+    if(src->slabs == NULL)
+        return;
+    
+    if(dst->slabs == NULL) {
+        *dst = *src;
+    }
+    else {
+        for(last = src->slabs; last->next != NULL; last = last->next)
+            ;
+        
+        /* slabs of src are put behind the current slab of dst */
+        last->next = dst->slabs->next;
+        dst->slabs->next = src->slabs;
+        
+        dst->allocs += src->allocs;
+        dst->bytes += src->bytes;
+        dst->nslabs += src->nslabs;
+        dst->slab_bytes += src->slab_bytes;
+    }
+    
+    arena_init(src);
+}
+
+/**
+ *  void arena_reset(arena_t *arena)
+ * 
+ *  Frees all allocated memory at once, but keeps the current slab for reuse.
+ */
+void arena_reset(arena_t *arena) {
+    arena_slab_t *slab;
+    arena_slab_t *next;
+    
+    if(arena->slabs == NULL)
+        return;
+    
+    for(slab = arena->slabs->next; slab != NULL; slab = next) {
+        next = slab->next;
+        free(slab);
+    }
+    
+    slab = arena->slabs;
+    slab->next = NULL;
+    
+    arena->pos = (char *) slab + ARENA_ALIGN(sizeof(arena_slab_t));
+    arena->end = arena->pos + slab->size;
+    arena->allocs = arena->bytes = 0;
+    arena->nslabs = 1;
+    arena->slab_bytes = slab->size;
+}
+
+/**
+ *  void arena_free(arena_t *arena)
+ * 
+ *  Frees all slabs, arena is left empty.
+ */
+void arena_free(arena_t *arena) {
+    arena_slab_t *next;
+    
+    while(arena->slabs != NULL) {
+        next = arena->slabs->next;
+        free(arena->slabs);
+        arena->slabs = next;
+    }
+    
+    arena_init(arena);
+}
+
+/**
+ *  void arena_print(arena_t *arena)
+ * 
+ *  Prints number of allocations, their bytes and slabs of arena.
+ */
+void arena_print(arena_t *arena) {
+    printf("Memory: %lu allocations, %lu bytes in %lu slabs of %lu bytes (%.1f %% used).\n",
+            arena->allocs, arena->bytes, arena->nslabs, arena->slab_bytes,
+            (arena->slab_bytes > 0) ? 100.0 * arena->bytes / arena->slab_bytes : 0.0);
+}
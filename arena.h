@@ -0,0 +1,49 @@
+/*
+ *  Text analysis program
+ * 
+ *  File: arena.h
+ * 
+ *  Author: Martin Kucera, 2012
+ */
+
+#ifndef ARENA_H
+#define	ARENA_H
+
+/* Structures */
+
+typedef struct arena_slab arena_slab_t;
+
+/* slab header, allocated memory follows it */
+struct arena_slab {
+    arena_slab_t *next;
+    unsigned long size;
+};
+
+typedef struct {
+    /* all slabs, the current one first */
+    arena_slab_t *slabs;
+    /* free space of the current slab */
+    char *pos;
+    char *end;
+    
+    /* number of allocations and their bytes */
+    unsigned long allocs;
+    unsigned long bytes;
+    /* number of slabs and their total size */
+    unsigned long nslabs;
+    unsigned long slab_bytes;
+} arena_t;
+
+/* Function prototypes */
+
+void arena_init(arena_t *arena);
+void arena_reserve(arena_t *arena, unsigned long size);
+void *arena_alloc(arena_t *arena, unsigned long size);
+void *arena_alloc_line(arena_t *arena, unsigned long size);
+void arena_move(arena_t *dst, arena_t *src);
+void arena_reset(arena_t *arena);
+void arena_free(arena_t *arena);
+void arena_print(arena_t *arena);
+
+
+#endif	/* ARENA_H */
@@ -0,0 +1,798 @@
+/*
+ *  Text analysis program
+ * 
+ *  File: batch.c
+ *  Analyzes many files in one process. Files are given by a list file (one
+ *  name per line) or found in a directory tree. Each worker thread owns a
+ *  range of files, when it's empty the worker steals upper half of another
+ *  worker's range. Stats of each file are written into output directory,
+ *  optionally together with total stats of all files. Workers reuse their
+ *  stats, hash table and read buffer for all files they analyze.
+ * 
+ *  Total stats are kept by each worker in generations, a new one starts
+ *  whenever the worker continues with a file preceding the previous one.
+ *  Words of each file are appended to the current generation as a segment,
+ *  so merging all segments in order of their files gives the same order of
+ *  words as if all files were analyzed one after another.
+ * 
+ *  Author: Martin Kucera, 2012
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "global.h"
+#include "err.h"
+#include "file.h"
+#include "hash_table.h"
+#include "stat.h"
+#include "parser.h"
+#include "parallel.h"
+#include "batch.h"
+
+#ifdef HAVE_POSIX
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#endif
+
+/* Structures */
+
+typedef struct batch batch_t;
+
+typedef struct {
+    /* files [top, bottom) wait in queue, owner takes from top,
+     * other workers steal the upper half */
+    unsigned long top;
+    unsigned long bottom;
+#ifdef HAVE_POSIX
+    pthread_mutex_t lock;
+#endif
+} queue_t;
+
+typedef struct {
+    /* file index and words it added to total stats of worker's generation */
+    unsigned long file;
+    unsigned worker;
+    unsigned gen;
+    unsigned long start;
+    unsigned long num;
+} segment_t;
+
+typedef struct {
+    /* total stats of files analyzed in increasing order */
+    stats_t st;
+    /* words of st in insertion order, listed before the merge */
+    word_t **words;
+} generation_t;
+
+typedef struct {
+    batch_t *b;
+    unsigned id;
+    queue_t queue;
+    
+    /* total stats of analyzed files */
+    generation_t *gens;
+    unsigned ngens;
+    segment_t *segments;
+    unsigned long nsegments;
+    unsigned long segments_size;
+    /* last analyzed file */
+    unsigned long last;
+    
+    unsigned long done;
+    unsigned long failed;
+} worker_t;
+
+struct batch {
+    char **files;
+    unsigned long nfiles;
+    unsigned long files_size;
+    /* length of directory name stripped from output names */
+    unsigned long root_len;
+    
+    char *outdir;
+    int total;
+    
+    worker_t *workers;
+    unsigned nworkers;
+};
+
+/**
+ *  void batch_add_file(batch_t *b, char *name)
+ * 
+ *  Adds file name into batch, name is freed with the batch.
+ */
+void batch_add_file(batch_t *b, char *name) {
+    if(b->nfiles == b->files_size) {
+        b->files_size = (b->files_size) ? b->files_size * 2 : 256;
+        
+        if((b->files = (char **) realloc(b->files, sizeof(char *) * b->files_size)) == NULL) {
+            raise_error("Out of memory.");
+        }
+    }
+    
+    b->files[b->nfiles++] = name;
+}
+
+/**
+ *  void batch_add_list(batch_t *b, char *list)
+ * 
+ *  Adds all files named in list file, one name per line. Empty lines are
+ *  skipped.
+ */
+void batch_add_list(batch_t *b, char *list) {
+    FILE *fp;
+    char line[LBUFFSIZE];
+    char *name;
+    unsigned long len;
+    
+    open_file(&fp, list, "rb");
+    
+    while(fgets(line, LBUFFSIZE, fp) != NULL) {
+        len = strlen(line);
+        
+        while(len > 0 && (line[len - 1] == _LF || line[len - 1] == _CR)) {
+            line[--len] = '\0';
+        }
+        
+        if(len == 0)
+            continue;
+        
+        if((name = (char *) malloc(len + 1)) == NULL) {
+            raise_error("Out of memory.");
+        }
+        
+        strcpy(name, line);
+        batch_add_file(b, name);
+    }
+    
+    close_file(&fp);
+}
+
+#ifdef HAVE_POSIX
+
+/**
+ *  int batch_is_dir(char *path)
+ * 
+ *  Checks whether path is a directory.
+ */
+int batch_is_dir(char *path) {
+    struct stat st;
+    
+    return (stat(path, &st) == 0 && S_ISDIR(st.st_mode));
+}
+
+/**
+ *  void batch_add_dir(batch_t *b, char *path)
+ * 
+ *  Adds all regular files in directory tree starting at path, symlinks to
+ *  files are added but symlinks to directories are skipped.
+ */
+void batch_add_dir(batch_t *b, char *path) {
+    DIR *dir;
+    struct dirent *entry;
+    struct stat st;
+    char *name;
+    
+    if((dir = opendir(path)) == NULL) {
+        fprintf(stderr, "Warning: Couldn't read directory named: %s\n", path);
+        return;
+    }
+    
+    while((entry = readdir(dir)) != NULL) {
+        if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        
+        if((name = (char *) malloc(strlen(path) + strlen(entry->d_name) + 2)) == NULL) {
+            raise_error("Out of memory.");
+        }
+        
+        sprintf(name, "%s/%s", path, entry->d_name);
+        
+        /* symlinked directories aren't followed, they can make a loop */
+        if(lstat(name, &st) == 0 && S_ISDIR(st.st_mode)) {
+            batch_add_dir(b, name);
+            free(name);
+        }
+        else if(stat(name, &st) == 0 && S_ISREG(st.st_mode)) {
+            batch_add_file(b, name);
+        }
+        else {
+            free(name);
+        }
+    }
+    
+    closedir(dir);
+}
+
+#else
+
+int batch_is_dir(char *path) {
+    return 0;
+}
+
+void batch_add_dir(batch_t *b, char *path) {
+    raise_error("Directories are not supported on this platform.");
+}
+
+#endif
+
+/**
+ *  int cmp_file_name(const void *a, const void *b)
+ * 
+ *  Compares two file names, directory entries are analyzed in this order.
+ */
+int cmp_file_name(const void *a, const void *b) {
+    return strcmp(*(char **) a, *(char **) b);
+}
+
+/**
+ *  int cmp_segment(const void *a, const void *b)
+ * 
+ *  Compares two segments by their file index.
+ */
+int cmp_segment(const void *a, const void *b) {
+    segment_t *sa = *(segment_t **) a;
+    segment_t *sb = *(segment_t **) b;
+    
+    return (sa->file > sb->file) - (sa->file < sb->file);
+}
+
+/**
+ *  int batch_steal(queue_t *q, unsigned long *top, unsigned long *bottom)
+ * 
+ *  Takes upper half of files waiting in queue q, saves their range into top
+ *  and bottom. Returns 0 if q is empty.
+ */
+int batch_steal(queue_t *q, unsigned long *top, unsigned long *bottom) {
+    int found = 0;
+    
+#ifdef HAVE_POSIX
+    pthread_mutex_lock(&q->lock);
+#endif
+    
+    if(q->top < q->bottom) {
+        (*top) = q->top + (q->bottom - q->top) / 2;
+        (*bottom) = q->bottom;
+        
+        q->bottom = (*top);
+        found = 1;
+    }
+    
+#ifdef HAVE_POSIX
+    pthread_mutex_unlock(&q->lock);
+#endif
+    
+    return found;
+}
+
+/**
+ *  int batch_take(worker_t *w, unsigned long *file)
+ * 
+ *  Takes next file from worker's own queue, if it's empty steals files from
+ *  other workers. Returns 0 when all queues are empty.
+ */
+int batch_take(worker_t *w, unsigned long *file) {
+    queue_t *q = &(w->queue);
+    unsigned long top, bottom;
+    unsigned i;
+    int found = 0;
+    
+#ifdef HAVE_POSIX
+    pthread_mutex_lock(&q->lock);
+#endif
+    
+    if(q->top < q->bottom) {
+        (*file) = q->top++;
+        found = 1;
+    }
+    
+#ifdef HAVE_POSIX
+    pthread_mutex_unlock(&q->lock);
+#endif
+    
+    for(i = 1; i < w->b->nworkers && !found; i++) {
+        if(batch_steal(&(w->b->workers[(w->id + i) % w->b->nworkers].queue), &top, &bottom)) {
+#ifdef HAVE_POSIX
+            pthread_mutex_lock(&q->lock);
+#endif
+            
+            q->top = top + 1;
+            q->bottom = bottom;
+            
+#ifdef HAVE_POSIX
+            pthread_mutex_unlock(&q->lock);
+#endif
+            
+            (*file) = top;
+            found = 1;
+        }
+    }
+    
+    return found;
+}
+
+/**
+ *  void batch_add_total(worker_t *w, stats_t *st, unsigned long file)
+ * 
+ *  Adds stats of one file to total stats of worker's current generation. New
+ *  words are appended to the total table as one segment belonging to the
+ *  file.
+ */
+void batch_add_total(worker_t *w, stats_t *st, unsigned long file) {
+    word_t *word = NULL;
+    word_t *found;
+    word_t *copy;
+    segment_t *seg;
+    stats_t *total;
+    unsigned long start;
+    
+    if(w->ngens == 0 || file < w->last) {
+        if((w->gens = (generation_t *) realloc(w->gens, sizeof(generation_t) * (w->ngens + 1))) == NULL) {
+            raise_error("Out of memory.");
+        }
+        
+        stat_init(&(w->gens[w->ngens].st));
+        w->gens[w->ngens].words = NULL;
+        w->ngens++;
+    }
+    
+    w->last = file;
+    total = &(w->gens[w->ngens - 1].st);
+    start = hash_count(total->word_table);
+    
+    hash_get_next(st->word_table, &word);
+    while(word != NULL) {
+        hash_find_hashed(total->word_table, WORD_KEY(word), word->hh.keylen, word->hh.hash, &found);
+        
+        if(found) {
+            found->count += word->count;
+        }
+        else {
+            copy = new_word(total, WORD_KEY(word), word->hh.keylen);
+            copy->count = word->count;
+            
+            hash_add_hashed(&total->word_table, copy, word->hh.keylen, word->hh.hash);
+        }
+        
+        hash_get_next(st->word_table, &word);
+    }
+    
+    add_letters(total, st);
+    
+    if(hash_count(total->word_table) == start)
+        return;
+    
+    if(w->nsegments == w->segments_size) {
+        w->segments_size = (w->segments_size) ? w->segments_size * 2 : 64;
+        
+        if((w->segments = (segment_t *) realloc(w->segments, sizeof(segment_t) * w->segments_size)) == NULL) {
+            raise_error("Out of memory.");
+        }
+    }
+    
+    seg = &(w->segments[w->nsegments++]);
+    seg->file = file;
+    seg->worker = w->id;
+    seg->gen = w->ngens - 1;
+    seg->start = start;
+    seg->num = hash_count(total->word_table) - start;
+}
+
+/**
+ *  char *batch_output_name(batch_t *b, unsigned long file)
+ * 
+ *  Returns allocated name of output file for given input file. Input name
+ *  relative to the analyzed directory is mirrored under output directory
+ *  with .stat appended. Parent references (..) and colons are replaced by
+ *  underscores, so output files stay inside output directory.
+ */
+char *batch_output_name(batch_t *b, unsigned long file) {
+    char *name = b->files[file] + b->root_len;
+    char *out;
+    char *pc;
+    unsigned long len;
+    
+    if((out = (char *) malloc(strlen(b->outdir) + strlen(name) + 8)) == NULL) {
+        raise_error("Out of memory.");
+    }
+    
+    strcpy(out, b->outdir);
+    pc = out + strlen(out);
+    
+    while(*name != '\0') {
+        len = strcspn(name, "/\\");
+        
+        /* empty and current directory components are skipped */
+        if(len > 1 || (len == 1 && name[0] != '.')) {
+            *(pc++) = '/';
+            
+            if(len == 2 && name[0] == '.' && name[1] == '.') {
+                memcpy(pc, "__", 2);
+            }
+            else {
+                memcpy(pc, name, len);
+            }
+            
+            for(; len > 0; len--, pc++) {
+                if(*pc == ':')
+                    (*pc) = '_';
+            }
+        }
+        
+        name += strcspn(name, "/\\");
+        
+        if(*name != '\0')
+            name++;
+    }
+    
+    strcpy(pc, ".stat");
+    
+    return out;
+}
+
+/**
+ *  void batch_check_outputs(batch_t *b)
+ * 
+ *  Checks that no two input files map to the same output file, stats of one
+ *  of them would be lost otherwise.
+ */
+void batch_check_outputs(batch_t *b) {
+    char **names;
+    char *message;
+    unsigned long i;
+    
+    if((names = (char **) malloc(sizeof(char *) * b->nfiles)) == NULL) {
+        raise_error("Out of memory.");
+    }
+    
+    for(i = 0; i < b->nfiles; i++) {
+        names[i] = batch_output_name(b, i);
+    }
+    
+    qsort(names, b->nfiles, sizeof(char *), cmp_file_name);
+    
+    for(i = 1; i < b->nfiles; i++) {
+        if(strcmp(names[i - 1], names[i]) != 0)
+            continue;
+        
+        if((message = (char *) malloc(strlen(names[i]) + 64)) == NULL) {
+            raise_error("Out of memory.");
+        }
+        
+        sprintf(message, "More input files would be written to: %s", names[i]);
+        raise_error(message);
+    }
+    
+    for(i = 0; i < b->nfiles; i++) {
+        free(names[i]);
+    }
+    
+    free(names);
+}
+
+#ifdef HAVE_POSIX
+
+/**
+ *  void batch_make_dirs(char *name)
+ * 
+ *  Creates all missing parent directories of file name.
+ */
+void batch_make_dirs(char *name) {
+    char *pc;
+    char *message;
+    
+    for(pc = strchr(name + 1, '/'); pc != NULL; pc = strchr(pc + 1, '/')) {
+        (*pc) = '\0';
+        
+        if(mkdir(name, 0777) != 0 && (errno != EEXIST || !batch_is_dir(name))) {
+            if((message = (char *) malloc(strlen(name) + 64)) == NULL) {
+                raise_error("Out of memory.");
+            }
+            
+            sprintf(message, "Couldn't create directory named: %s", name);
+            raise_error(message);
+        }
+        
+        (*pc) = '/';
+    }
+}
+
+#else
+
+void batch_make_dirs(char *name) {
+}
+
+#endif
+
+/**
+ *  int batch_file(worker_t *w, stats_t *st, unsigned long file, char *buff)
+ * 
+ *  Analyzes one file of the batch and writes it's stats. Files which can't
+ *  be mapped are read in chunks into buff. Returns 0 if the file couldn't be
+ *  read or written.
+ */
+int batch_file(worker_t *w, stats_t *st, unsigned long file, char *buff) {
+    FILE *fp;
+    carry_t carry = {NULL, 0, 0};
+    char *data;
+    char *name;
+    unsigned long size;
+    
+    if((fp = fopen(w->b->files[file], "rb")) == NULL) {
+        fprintf(stderr, "Warning: Couldn't read file named: %s\n", w->b->files[file]);
+        return 0;
+    }
+    
+    if(map_file(fp, &data, &size)) {
+        parse_buffer(st, data, size);
+        unmap_file(data, size);
+    }
+    else {
+        while((size = read_chunk(fp, buff, 0, CBUFFSIZE)) > 0) {
+            parse_chunk(st, &carry, buff, size);
+        }
+        
+        parse_chunk_end(st, &carry);
+    }
+    
+    fclose(fp);
+    
+    /* write_stats sorts words and letters, totals are added first */
+    if(w->b->total) {
+        batch_add_total(w, st, file);
+    }
+    
+    name = batch_output_name(w->b, file);
+    
+    if((fp = fopen(name, "wb")) == NULL) {
+        fprintf(stderr, "Warning: Couldn't write to file named: %s\n", name);
+        free(name);
+        return 0;
+    }
+    
+    write_stats(st, fp);
+    
+    fclose(fp);
+    free(name);
+    
+    return 1;
+}
+
+/**
+ *  void *batch_worker(void *arg)
+ * 
+ *  Thread function, analyzes files until there are none left in any queue.
+ */
+void *batch_worker(void *arg) {
+    worker_t *w = (worker_t *) arg;
+    stats_t st;
+    unsigned long file;
+    char *buff;
+    
+    if((buff = (char *) malloc(CBUFFSIZE)) == NULL) {
+        raise_error("Out of memory.");
+    }
+    
+    stat_init(&st);
+    
+    while(batch_take(w, &file)) {
+        if(batch_file(w, &st, file, buff)) {
+            w->done++;
+        }
+        else {
+            w->failed++;
+        }
+        
+        stat_reset(&st);
+    }
+    
+    stat_free(&st);
+    free(buff);
+    
+    return NULL;
+}
+
+/**
+ *  void batch_write_total(batch_t *b, char *name)
+ * 
+ *  Merges total stats of all workers and writes them to file name. Segments
+ *  are merged in order of their files, so words are in order of their first
+ *  occurrence, same as if all files were analyzed one after another.
+ */
+void batch_write_total(batch_t *b, char *name) {
+    FILE *fp;
+    stats_t st;
+    generation_t *gen;
+    segment_t **segments;
+    word_t *w;
+    word_t *found;
+    unsigned long nsegments = 0;
+    unsigned long i, j;
+    unsigned t, g;
+    
+    for(t = 0; t < b->nworkers; t++) {
+        nsegments += b->workers[t].nsegments;
+    }
+    
+    if((segments = (segment_t **) malloc(sizeof(segment_t *) * (nsegments + 1))) == NULL) {
+        raise_error("Out of memory.");
+    }
+    
+    stat_init(&st);
+    nsegments = 0;
+    
+    for(t = 0; t < b->nworkers; t++) {
+        for(g = 0; g < b->workers[t].ngens; g++) {
+            gen = &(b->workers[t].gens[g]);
+            gen->words = (word_t **) malloc(sizeof(word_t *) * (hash_count(gen->st.word_table) + 1));
+            
+            if(!gen->words) {
+                raise_error("Out of memory.");
+            }
+            
+            i = 0;
+            w = NULL;
+            
+            hash_get_next(gen->st.word_table, &w);
+            while(w != NULL) {
+                gen->words[i++] = w;
+                hash_get_next(gen->st.word_table, &w);
+            }
+            
+            /* items are moved into st, generation's table isn't needed */
+            if(gen->st.word_table) {
+                hash_drop_table(gen->st.word_table->hh.table);
+                gen->st.word_table = NULL;
+            }
+            
+            add_letters(&st, &(gen->st));
+            arena_move(&st.arena, &(gen->st.arena));
+        }
+        
+        for(j = 0; j < b->workers[t].nsegments; j++) {
+            segments[nsegments++] = &(b->workers[t].segments[j]);
+        }
+    }
+    
+    qsort(segments, nsegments, sizeof(segment_t *), cmp_segment);
+    
+    for(i = 0; i < nsegments; i++) {
+        gen = &(b->workers[segments[i]->worker].gens[segments[i]->gen]);
+        
+        for(j = segments[i]->start; j < segments[i]->start + segments[i]->num; j++) {
+            w = gen->words[j];
+            hash_find_hashed(st.word_table, WORD_KEY(w), w->hh.keylen, w->hh.hash, &found);
+            
+            if(found) {
+                found->count += w->count;
+            }
+            else {
+                if(w->hh.keylen > st.w_length_max)
+                    st.w_length_max = w->hh.keylen;
+                
+                add_word_length(&st, w->hh.keylen);
+                hash_add_hashed(&st.word_table, w, w->hh.keylen, w->hh.hash);
+            }
+        }
+    }
+    
+    open_file(&fp, name, "wb");
+    write_stats(&st, fp);
+    close_file(&fp);
+    
+    stat_free(&st);
+    free(segments);
+}
+
+/**
+ *  void batch_run(char *input, char *outdir, char *total, unsigned threads)
+ * 
+ *  Analyzes all files named in list file or found in directory input using
+ *  given number of threads. Stats of each file are written into outdir, total
+ *  stats of all files into file named total, if it's not NULL.
+ */
+void batch_run(char *input, char *outdir, char *total, unsigned threads) {
+    batch_t b;
+    unsigned long done = 0;
+    unsigned long failed = 0;
+    unsigned long i;
+    char *name;
+    unsigned t;
+    
+    b.files = NULL;
+    b.nfiles = b.files_size = 0;
+    b.root_len = 0;
+    b.outdir = outdir;
+    b.total = (total != NULL);
+    
+    if(batch_is_dir(input)) {
+        batch_add_dir(&b, input);
+        qsort(b.files, b.nfiles, sizeof(char *), cmp_file_name);
+        
+        b.root_len = strlen(input);
+    }
+    else {
+        batch_add_list(&b, input);
+    }
+    
+    if(b.nfiles == 0) {
+        raise_error("No files to analyze.");
+    }
+    
+    batch_check_outputs(&b);
+    
+    /* directories are created before workers start, they'd race otherwise */
+    for(i = 0; i < b.nfiles; i++) {
+        name = batch_output_name(&b, i);
+        batch_make_dirs(name);
+        free(name);
+    }
+    
+    printf("Analyzing %lu files using %u threads ...\n", b.nfiles, threads);
+    
+    b.nworkers = threads;
+    
+    if((b.workers = (worker_t *) malloc(sizeof(worker_t) * threads)) == NULL) {
+        raise_error("Out of memory.");
+    }
+    
+    /* each worker starts with a continuous range of files */
+    for(t = 0; t < threads; t++) {
+        b.workers[t].b = &b;
+        b.workers[t].id = t;
+        b.workers[t].queue.top = (b.nfiles / threads) * t;
+        b.workers[t].queue.bottom = (t == threads - 1) ? b.nfiles : (b.nfiles / threads) * (t + 1);
+        b.workers[t].gens = NULL;
+        b.workers[t].ngens = 0;
+        b.workers[t].segments = NULL;
+        b.workers[t].nsegments = b.workers[t].segments_size = 0;
+        b.workers[t].last = 0;
+        b.workers[t].done = b.workers[t].failed = 0;
+    
+#ifdef HAVE_POSIX
+        pthread_mutex_init(&b.workers[t].queue.lock, NULL);
+#endif
+    }
+    
+    parallel_run(batch_worker, b.workers, sizeof(worker_t), threads);
+    
+    for(t = 0; t < threads; t++) {
+        done += b.workers[t].done;
+        failed += b.workers[t].failed;
+    }
+    
+    printf("Analyzed %lu files, %lu failed.\n", done, failed);
+    
+    if(total != NULL) {
+        printf("Saving total stats to: %s ...\n", total);
+        batch_write_total(&b, total);
+    }
+    
+    for(t = 0; t < threads; t++) {
+        for(i = 0; i < b.workers[t].ngens; i++) {
+            stat_free(&(b.workers[t].gens[i].st));
+            free(b.workers[t].gens[i].words);
+        }
+        
+        free(b.workers[t].gens);
+        free(b.workers[t].segments);
+    
+#ifdef HAVE_POSIX
+        pthread_mutex_destroy(&b.workers[t].queue.lock);
+#endif
+    }
+    
+    for(i = 0; i < b.nfiles; i++) {
+        free(b.files[i]);
+    }
+    
+    free(b.files);
+    free(b.workers);
+    
+    hash_free_pool();
+}
@@ -0,0 +1,16 @@
+/*
+ *  Text analysis program
+ * 
+ *  File: batch.h
+ * 
+ *  Author: Martin Kucera, 2012
+ */
+
+#ifndef BATCH_H
+#define	BATCH_H
+
+/* Function prototypes */
+
+void batch_run(char *input, char *outdir, char *total, unsigned threads);
+
+#endif	/* BATCH_H */
@@ -0,0 +1,2362 @@
+/*
+ *  Text analysis program
+ * 
+ *  File: bench.c
+ *  Benchmarks, built as separate program by make bench and run with name of
+ *  benchmark and an input file. Whole input is loaded into memory first, so
+ *  only the measured part of the analysis is timed, not reading. Each
+ *  benchmark runs BENCH_RUNS times and the best time is reported as
+ *  throughput in bytes per second. Benchmarks compare results of variants
+ *  and exit with EXIT_FAILURE when they differ, make test runs them.
+ * 
+ *  Author: Martin Kucera, 2012
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "global.h"
+#include "err.h"
+#include "file.h"
+#include "hash_table.h"
+#include "stat.h"
+#include "parser.h"
+#include "parallel.h"
+#include "sort.h"
+#include "approx.h"
+#include "hll.h"
+#include "spill.h"
+#include "binstat.h"
+#include "follow.h"
+#include "batch.h"
+#include "pipeline.h"
+#include "scan.h"
+#include "fold.h"
+#include "cp1250_ctype.h"
+#include "bench.h"
+
+#ifdef HAVE_POSIX
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#endif
+
+#define BENCH_RUNS 3
+/* number of random inputs compared with parse_line */
+#define BENCH_CHECKS 500
+/* number of random words added to table benchmark */
+#define BENCH_KEYS 2000000
+/* memory needed by one key of scaling benchmark, word, table and resize */
+#define BENCH_KEY_BYTES 128
+/* bytes of keys hashed by hash benchmark */
+#define BENCH_HASH_BYTES 200000000
+/* longest chain shown separately by hash benchmark */
+#define BENCH_CHAIN_MAX 6
+/* words of collision benchmark with the same lower bits of hash_jen */
+#define BENCH_COLLIDE_KEYS 2000
+#define BENCH_COLLIDE_BITS 16
+/* most threads of shared table benchmark */
+#define BENCH_THREADS 64
+/* number of random words with random counts sorted by sort benchmark */
+#define BENCH_SORT_KEYS 10000000
+/* number of most frequent words looked for by approx benchmark */
+#define BENCH_APPROX_TOP 100
+/* largest number of words selected by top benchmark */
+#define BENCH_TOP_MAX 100000
+/* number of appends to input followed by follow benchmark */
+#define BENCH_APPENDS 10
+/* number of files of growing size analyzed by batch benchmark and most
+ * threads analyzing them */
+#define BENCH_BATCH_FILES 16
+#define BENCH_BATCH_THREADS 8
+/* pipeline benchmark input fills the ring this many times over */
+#define BENCH_PIPELINE_RINGS 2
+
+#ifdef COUNT_TOUCHES
+#define touched_reset() (touched_bytes = 0)
+#define touched_save(n) ((n) = touched_bytes)
+#else
+#define touched_reset()
+#define touched_save(n)
+#endif
+
+/* Structures */
+
+typedef struct {
+    const char *name;
+    const char *desc;
+    void (*func)(const char *data, unsigned long len);
+} bench_t;
+
+/* Summary of stats, results of compared variants have to be equal */
+typedef struct {
+    unsigned long words;
+    unsigned long distinct;
+    unsigned long letters;
+} bench_sum_t;
+
+/**
+ *  void bench_summary(stats_t *st, bench_sum_t *sum)
+ * 
+ *  Counts all words, distinct words and letters in st.
+ */
+void bench_summary(stats_t *st, bench_sum_t *sum) {
+    word_t *w = NULL;
+    
+    sum->words = 0;
+    sum->distinct = hash_count(st->word_table);
+    sum->letters = st->l_total;
+    
+    hash_get_next(st->word_table, &w);
+    while(w != NULL) {
+        sum->words += w->count;
+        hash_get_next(st->word_table, &w);
+    }
+}
+
+/**
+ *  void bench_report(const char *name, double best, unsigned long len, bench_sum_t *sum)
+ * 
+ *  Prints one line of results.
+ */
+void bench_report(const char *name, double best, unsigned long len, bench_sum_t *sum) {
+    printf("%-12s %9.1f ms %9.1f MB/s %10lu words %9lu distinct\n", name, best * 1000,
+            (best > 0) ? len / best / 1e6 : 0, sum->words, sum->distinct);
+}
+
+/**
+ *  void bench_check(bench_sum_t *a, bench_sum_t *b)
+ * 
+ *  Raises error if two compared variants gave different results.
+ */
+void bench_check(bench_sum_t *a, bench_sum_t *b) {
+    if(a->words != b->words || a->distinct != b->distinct || a->letters != b->letters) {
+        raise_error("Benchmark variants gave different results.");
+    }
+}
+
+/**
+ *  void bench_tokenize(const char *data, unsigned long len)
+ * 
+ *  Compares original strtok tokenizer (parse_line on each line) with fused
+ *  parse_buffer. Line splitting is done on a copy before timing. Number of
+ *  bytes touched per word is shown when built with -DCOUNT_TOUCHES.
+ */
+void bench_tokenize(const char *data, unsigned long len) {
+    stats_t st;
+    bench_sum_t sum[2];
+    char *copy;
+    char **lines;
+    unsigned long nlines = 0;
+    unsigned long i;
+#ifdef COUNT_TOUCHES
+    unsigned long touched[2];
+#endif
+    double start, time, best[2];
+    int run;
+    
+    for(i = 0; i < len; i++) {
+        if(data[i] == '\n')
+            nlines++;
+    }
+    
+    copy = (char *) malloc(len + 1);
+    lines = (char **) malloc(sizeof(char *) * (nlines + 1));
+    
+    if(!copy || !lines) {
+        raise_error("Out of memory.");
+    }
+    
+    best[0] = best[1] = -1;
+    
+    for(run = 0; run < BENCH_RUNS; run++) {
+        /* strtok modifies lines, they are split again for each run */
+        memcpy(copy, data, len);
+        copy[len] = '\0';
+        
+        nlines = 0;
+        lines[nlines++] = copy;
+        for(i = 0; i < len; i++) {
+            if(copy[i] == '\n') {
+                copy[i] = '\0';
+                lines[nlines++] = copy + i + 1;
+            }
+        }
+        
+        stat_init(&st);
+        touched_reset();
+        start = parallel_time();
+        for(i = 0; i < nlines; i++) {
+            parse_line(&st, lines[i]);
+        }
+        time = parallel_time() - start;
+        touched_save(touched[0]);
+        
+        if(best[0] < 0 || time < best[0])
+            best[0] = time;
+        
+        bench_summary(&st, &sum[0]);
+        stat_free(&st);
+        
+        stat_init(&st);
+        touched_reset();
+        start = parallel_time();
+        parse_buffer(&st, data, len);
+        time = parallel_time() - start;
+        touched_save(touched[1]);
+        
+        if(best[1] < 0 || time < best[1])
+            best[1] = time;
+        
+        bench_summary(&st, &sum[1]);
+        stat_free(&st);
+    }
+    
+    bench_check(&sum[0], &sum[1]);
+    
+    bench_report("strtok", best[0], len, &sum[0]);
+    bench_report("fused", best[1], len, &sum[1]);
+    
+#ifdef COUNT_TOUCHES
+    printf("Bytes touched per word: strtok %.1f, fused %.1f\n", 
+            (double) touched[0] / sum[0].words, (double) touched[1] / sum[1].words);
+#else
+    printf("Build with -DCOUNT_TOUCHES to count bytes touched per word.\n");
+#endif
+    
+    free(lines);
+    free(copy);
+}
+
+/**
+ *  int bench_equal(stats_t *a, stats_t *b)
+ * 
+ *  Checks whether two stats are the same, including order of words.
+ */
+int bench_equal(stats_t *a, stats_t *b) {
+    word_t *wa = NULL;
+    word_t *wb = NULL;
+    unsigned i;
+    
+    if(hash_count(a->word_table) != hash_count(b->word_table) || a->l_total != b->l_total 
+            || a->w_length_max != b->w_length_max)
+        return 0;
+    
+    hash_get_next(a->word_table, &wa);
+    hash_get_next(b->word_table, &wb);
+    while(wa != NULL && wb != NULL) {
+        if(wa->count != wb->count || strcmp(WORD_KEY(wa), WORD_KEY(wb)) != 0)
+            return 0;
+        
+        hash_get_next(a->word_table, &wa);
+        hash_get_next(b->word_table, &wb);
+    }
+    
+    for(i = 0; i < a->w_length_max; i++) {
+        if(a->w_lengths[i] != b->w_lengths[i])
+            return 0;
+    }
+    
+    for(i = 0; a->l_frequency && i < L_FREQUENCY_SIZE; i++) {
+        if(a->l_frequency[i].count != b->l_frequency[i].count)
+            return 0;
+    }
+    
+    return 1;
+}
+
+/**
+ *  void bench_random(char *buff, unsigned long len)
+ * 
+ *  Fills buff with random CP1250 text, mostly letters of both cases with
+ *  frequent delimiters, apostrophes and ch. Zero byte isn't used, parse_line
+ *  would see it as the end of input.
+ */
+void bench_random(char *buff, unsigned long len) {
+    static const char pool[] = "aAbBcChHzZ'' '  \t\r\n.,-09!?\"#&*"
+            "\x8a\x9a\x8e\x9e\xc8\xe8\xd8\xf8\xc1\xe1\xa5\xb9\xbc\xbe\xdf"
+            "\x80\x84\x85\x91\x92\x93\x94\xa0\xff";
+    unsigned long i;
+    
+    for(i = 0; i < len; i++) {
+        buff[i] = (rand() % 4 == 0) ? (char) (rand() % 255 + 1) : pool[rand() % (sizeof(pool) - 1)];
+    }
+}
+
+/**
+ *  void bench_scan(const char *data, unsigned long len)
+ * 
+ *  Checks that parse_buffer with each scan_words kernel gives the same stats
+ *  as parse_line on random inputs of various lengths and alignments, then
+ *  compares speed of the kernels, alone and in parse_buffer.
+ */
+void bench_scan(const char *data, unsigned long len) {
+    static const char *kernels[] = {"scalar", "ssse3", "avx2", NULL};
+    unsigned long bounds[2 * SCAN_BATCH];
+    stats_t ref, st;
+    char *buff;
+    char *copy;
+    unsigned long size, offset, pos, n, words = 0;
+    unsigned long check;
+    double start, time, best[2];
+    int k, run;
+    
+    buff = (char *) malloc(65536 + 64);
+    copy = (char *) malloc(65536 + 64);
+    
+    if(!buff || !copy) {
+        raise_error("Out of memory.");
+    }
+    
+    srand(1);
+    
+    for(check = 0; check < BENCH_CHECKS; check++) {
+        size = (check % 10 == 0) ? 65536 : (unsigned long) rand() % 300;
+        offset = rand() % 32;
+        bench_random(buff + offset, size);
+        
+        memcpy(copy, buff + offset, size);
+        copy[size] = '\0';
+        
+        stat_init(&ref);
+        parse_line(&ref, copy);
+        
+        for(k = 0; kernels[k] != NULL; k++) {
+            if(!scan_set_kernel(kernels[k]))
+                continue;
+            
+            stat_init(&st);
+            parse_buffer(&st, buff + offset, size);
+            
+            if(!bench_equal(&ref, &st)) {
+                printf("Kernel %s differs from parse_line on random input %lu.\n", kernels[k], check);
+                raise_error("Self check failed.");
+            }
+            
+            stat_free(&st);
+        }
+        
+        stat_free(&ref);
+    }
+    
+    printf("Self check passed, %d random inputs.\n", BENCH_CHECKS);
+    
+    for(k = 0; kernels[k] != NULL; k++) {
+        if(!scan_set_kernel(kernels[k])) {
+            printf("%-12s not supported by CPU\n", kernels[k]);
+            continue;
+        }
+        
+        best[0] = best[1] = -1;
+        
+        for(run = 0; run < BENCH_RUNS; run++) {
+            start = parallel_time();
+            pos = words = 0;
+            while((n = scan_words(data, len, &pos, bounds, SCAN_BATCH)) > 0) {
+                words += n;
+            }
+            time = parallel_time() - start;
+            
+            if(best[0] < 0 || time < best[0])
+                best[0] = time;
+            
+            stat_init(&st);
+            start = parallel_time();
+            parse_buffer(&st, data, len);
+            time = parallel_time() - start;
+            stat_free(&st);
+            
+            if(best[1] < 0 || time < best[1])
+                best[1] = time;
+        }
+        
+        printf("%-12s scan %9.1f MB/s, parse %9.1f MB/s, %lu tokens\n", kernels[k],
+                (best[0] > 0) ? len / best[0] / 1e6 : 0, (best[1] > 0) ? len / best[1] / 1e6 : 0, words);
+    }
+    
+    scan_set_kernel("auto");
+    
+    free(copy);
+    free(buff);
+}
+
+/**
+ *  void bench_fold(const char *data, unsigned long len)
+ * 
+ *  Checks that each fold_buffer kernel converts random buffers of various
+ *  lengths and alignments the same way as cp1250_tolower, then compares
+ *  speed of the kernels with converting one byte at a time by cp1250_tolower.
+ */
+void bench_fold(const char *data, unsigned long len) {
+    static const char *kernels[] = {"scalar", "ssse3", "avx2", NULL};
+    char *buff;
+    char *out;
+    unsigned long size, offset, i;
+    unsigned long check;
+    double start, time, best;
+    int k, run;
+    
+    buff = (char *) malloc(len + 64);
+    out = (char *) malloc(len + 64);
+    
+    if(!buff || !out) {
+        raise_error("Out of memory.");
+    }
+    
+    srand(1);
+    
+    for(check = 0; check < BENCH_CHECKS; check++) {
+        size = (unsigned long) rand() % ((len < 4096) ? len + 1 : 4096);
+        offset = rand() % 32;
+        bench_random(buff + offset, size);
+        
+        for(k = 0; kernels[k] != NULL; k++) {
+            if(!fold_set_kernel(kernels[k]))
+                continue;
+            
+            fold_buffer(out + offset, buff + offset, size);
+            
+            for(i = 0; i < size; i++) {
+                if((unsigned char) out[offset + i] != cp1250_tolower((unsigned char) buff[offset + i])) {
+                    printf("Kernel %s differs from cp1250_tolower on random input %lu.\n", kernels[k], check);
+                    raise_error("Self check failed.");
+                }
+            }
+        }
+    }
+    
+    printf("Self check passed, %d random inputs.\n", BENCH_CHECKS);
+    
+    best = -1;
+    for(run = 0; run < BENCH_RUNS; run++) {
+        start = parallel_time();
+        for(i = 0; i < len; i++) {
+            out[i] = (char) cp1250_tolower((unsigned char) data[i]);
+        }
+        time = parallel_time() - start;
+        
+        if(best < 0 || time < best)
+            best = time;
+    }
+    
+    printf("%-12s %9.1f MB/s\n", "tolower", (best > 0) ? len / best / 1e6 : 0);
+    
+    for(k = 0; kernels[k] != NULL; k++) {
+        if(!fold_set_kernel(kernels[k])) {
+            printf("%-12s not supported by CPU\n", kernels[k]);
+            continue;
+        }
+        
+        best = -1;
+        for(run = 0; run < BENCH_RUNS; run++) {
+            start = parallel_time();
+            fold_buffer(out, data, len);
+            time = parallel_time() - start;
+            
+            if(best < 0 || time < best)
+                best = time;
+        }
+        
+        printf("%-12s %9.1f MB/s\n", kernels[k], (best > 0) ? len / best / 1e6 : 0);
+    }
+    
+    fold_set_kernel("auto");
+    
+    free(out);
+    free(buff);
+}
+
+/**
+ *  word_t **bench_keys(stats_t *st, const char *data, unsigned long len, unsigned long *num, unsigned long random)
+ * 
+ *  Returns array of distinct words of data in insertion order, followed by
+ *  given number of random words, num is set to the number of all words.
+ *  Words are taken out of table of st, they are freed with st.
+ */
+word_t **bench_keys(stats_t *st, const char *data, unsigned long len, unsigned long *num, unsigned long random) {
+    word_t **words;
+    word_t *w = NULL;
+    word_t *found;
+    char key[16];
+    unsigned long i, distinct;
+    unsigned k, length;
+    
+    stat_init(st);
+    parse_buffer(st, data, len);
+    
+    distinct = hash_count(st->word_table);
+    
+    if((words = (word_t **) malloc(sizeof(word_t *) * (distinct + random + 1))) == NULL) {
+        raise_error("Out of memory.");
+    }
+    
+    *num = 0;
+    hash_get_next(st->word_table, &w);
+    while(w != NULL) {
+        words[(*num)++] = w;
+        hash_get_next(st->word_table, &w);
+    }
+    
+    for(i = 0; i < random; i++) {
+        do {
+            length = 3 + rand() % 10;
+            for(k = 0; k < length; k++) {
+                key[k] = 'a' + rand() % 26;
+            }
+            key[length] = '\0';
+            
+            hash_find_hashed(st->word_table, key, length, hash_func(key, length), &found);
+        } while(found != NULL);
+        
+        w = new_word(st, key, length);
+        hash_add_hashed(&st->word_table, w, length, hash_func(key, length));
+        words[(*num)++] = w;
+    }
+    
+    if(st->word_table) {
+        hash_drop_table(st->word_table->hh.table);
+    }
+    
+    st->word_table = NULL;
+    
+    return words;
+}
+
+/**
+ *  void bench_engine(word_t **words, unsigned long num, int engine)
+ * 
+ *  Inserts num words into an empty table of given engine, then looks all of
+ *  them up (hits) and looks up the same number of missing keys, which differ
+ *  from inserted ones in their last character. Prints operations per second.
+ */
+void bench_engine(word_t **words, unsigned long num, int engine) {
+    word_t *head;
+    word_t *found;
+    char key[KEY_MAX_LEN + 2];
+    unsigned long *misses;
+    unsigned long i, hits;
+    unsigned keylen;
+    double start, time, best[3];
+    int run;
+    
+    if((misses = (unsigned long *) malloc(sizeof(unsigned long) * (num + 1))) == NULL) {
+        raise_error("Out of memory.");
+    }
+    
+    /* missing keys have an extra character, their hashes are computed ahead */
+    for(i = 0; i < num; i++) {
+        keylen = words[i]->hh.keylen;
+        memcpy(key, WORD_KEY(words[i]), keylen);
+        key[keylen] = '#';
+        misses[i] = hash_func(key, keylen + 1);
+    }
+    
+    hash_set_engine(engine);
+    best[0] = best[1] = best[2] = -1;
+    
+    for(run = 0; run < BENCH_RUNS; run++) {
+        head = NULL;
+        
+        start = parallel_time();
+        for(i = 0; i < num; i++) {
+            hash_add_hashed(&head, words[i], words[i]->hh.keylen, words[i]->hh.hash);
+        }
+        time = parallel_time() - start;
+        
+        if(best[0] < 0 || time < best[0])
+            best[0] = time;
+        
+        hits = 0;
+        start = parallel_time();
+        for(i = 0; i < num; i++) {
+            hash_find_hashed(head, WORD_KEY(words[i]), words[i]->hh.keylen, words[i]->hh.hash, &found);
+            hits += (found != NULL);
+        }
+        time = parallel_time() - start;
+        
+        if(best[1] < 0 || time < best[1])
+            best[1] = time;
+        
+        start = parallel_time();
+        for(i = 0; i < num; i++) {
+            hash_find_hashed(head, WORD_KEY(words[i]), words[i]->hh.keylen + 1, misses[i], &found);
+            hits += (found != NULL);
+        }
+        time = parallel_time() - start;
+        
+        if(best[2] < 0 || time < best[2])
+            best[2] = time;
+        
+        if(hits != num) {
+            raise_error("Benchmark lookups gave wrong results.");
+        }
+        
+        hash_drop_table(head->hh.table);
+    }
+    
+    printf("%-12s insert %7.1f, hit %7.1f, miss %7.1f Mops/s\n", (engine == HASH_OPEN) ? "open" : "chained",
+            num / best[0] / 1e6, num / best[1] / 1e6, num / best[2] / 1e6);
+    
+    free(misses);
+}
+
+/**
+ *  void bench_table(const char *data, unsigned long len)
+ * 
+ *  Compares open addressing and chained table engines on distinct words of
+ *  input and then on BENCH_KEYS random words, which don't fit into caches.
+ *  Finally times whole parse_buffer with each engine.
+ */
+void bench_table(const char *data, unsigned long len) {
+    stats_t st;
+    word_t **words;
+    unsigned long num;
+    double start, time, best;
+    int engine, run;
+    
+    srand(1);
+    words = bench_keys(&st, data, len, &num, BENCH_KEYS);
+    
+    printf("%lu distinct words of input:\n", num - BENCH_KEYS);
+    for(engine = HASH_CHAINED; engine <= HASH_OPEN; engine++) {
+        bench_engine(words, num - BENCH_KEYS, engine);
+    }
+    
+    printf("%lu words with random ones:\n", num);
+    for(engine = HASH_CHAINED; engine <= HASH_OPEN; engine++) {
+        bench_engine(words, num, engine);
+    }
+    
+    stat_free(&st);
+    free(words);
+    
+    printf("Whole parse_buffer:\n");
+    for(engine = HASH_CHAINED; engine <= HASH_OPEN; engine++) {
+        hash_set_engine(engine);
+        best = -1;
+        
+        for(run = 0; run < BENCH_RUNS; run++) {
+            stat_init(&st);
+            start = parallel_time();
+            parse_buffer(&st, data, len);
+            time = parallel_time() - start;
+            stat_free(&st);
+            
+            if(best < 0 || time < best)
+                best = time;
+        }
+        
+        printf("%-12s %9.1f MB/s\n", (engine == HASH_OPEN) ? "open" : "chained", len / best / 1e6);
+    }
+    
+    hash_set_engine(HASH_CHAINED);
+}
+
+/**
+ *  int bench_cmp_double(const void *a, const void *b)
+ * 
+ *  Compares two doubles for qsort, ascending.
+ */
+int bench_cmp_double(const void *a, const void *b) {
+    double da = *((const double *) a);
+    double db = *((const double *) b);
+    
+    return (da > db) - (da < db);
+}
+
+/**
+ *  void bench_latency(word_t **words, unsigned long num, int engine, int mode, double *lat)
+ * 
+ *  Adds num words into an empty table the way add_word does, lookup followed
+ *  by insert, and saves time of each word into lat. Prints total time, mean
+ *  and worst latencies, afterwards checks that all words are found.
+ */
+void bench_latency(word_t **words, unsigned long num, int engine, int mode, double *lat) {
+    word_t *head = NULL;
+    word_t *found;
+    unsigned long i;
+    double start, end, total = 0;
+    
+    hash_set_engine(engine);
+    hash_set_rehash(mode);
+    
+    start = parallel_time();
+    for(i = 0; i < num; i++) {
+        hash_find_hashed(head, WORD_KEY(words[i]), words[i]->hh.keylen, words[i]->hh.hash, &found);
+        
+        if(!found) {
+            hash_add_hashed(&head, words[i], words[i]->hh.keylen, words[i]->hh.hash);
+        }
+        
+        end = parallel_time();
+        lat[i] = end - start;
+        total += lat[i];
+        start = end;
+    }
+    
+    for(i = 0; i < num; i++) {
+        hash_find_hashed(head, WORD_KEY(words[i]), words[i]->hh.keylen, words[i]->hh.hash, &found);
+        
+        if(found != words[i]) {
+            raise_error("Benchmark lookups gave wrong results.");
+        }
+    }
+    
+    hash_drop_table(head->hh.table);
+    
+    qsort(lat, num, sizeof(double), bench_cmp_double);
+    
+    printf("%-8s %-12s %8.1f ms total, mean %6.0f ns, p99 %6.0f ns, p99.9 %8.0f ns, max %10.0f ns\n",
+            (engine == HASH_OPEN) ? "open" : "chained", (mode == HASH_REHASH_FULL) ? "full" : "incremental",
+            total * 1e3, total / num * 1e9, lat[num / 100 * 99] * 1e9, lat[num / 1000 * 999] * 1e9,
+            lat[num - 1] * 1e9);
+}
+
+/**
+ *  void bench_rehash(const char *data, unsigned long len)
+ * 
+ *  Compares full and incremental resize of both table engines on distinct
+ *  words of input and BENCH_KEYS random words. Worst insert latency shows
+ *  the stall of resizing the whole table at once.
+ */
+void bench_rehash(const char *data, unsigned long len) {
+    stats_t st;
+    word_t **words;
+    double *lat;
+    unsigned long num;
+    int engine, mode;
+    
+    srand(1);
+    words = bench_keys(&st, data, len, &num, BENCH_KEYS);
+    
+    if((lat = (double *) malloc(sizeof(double) * (num + 1))) == NULL) {
+        raise_error("Out of memory.");
+    }
+    
+    printf("%lu words, latency of lookup and insert:\n", num);
+    for(engine = HASH_CHAINED; engine <= HASH_OPEN; engine++) {
+        for(mode = HASH_REHASH_FULL; mode <= HASH_REHASH_INCREMENTAL; mode++) {
+            bench_latency(words, num, engine, mode, lat);
+        }
+    }
+    
+    hash_set_engine(HASH_CHAINED);
+    hash_set_rehash(HASH_REHASH_FULL);
+    
+    stat_free(&st);
+    free(words);
+    free(lat);
+}
+
+/**
+ *  unsigned long bench_memory()
+ * 
+ *  Returns size of physical memory in bytes, 0 if it isn't known.
+ */
+unsigned long bench_memory() {
+#ifdef HAVE_POSIX
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long size = sysconf(_SC_PAGE_SIZE);
+    
+    if(pages > 0 && size > 0) {
+        return (unsigned long) pages * (unsigned long) size;
+    }
+#endif
+    
+    return 0;
+}
+
+/**
+ *  void bench_scaling(const char *data, unsigned long len)
+ * 
+ *  Inserts from 1K up to 500M distinct generated keys into empty tables of
+ *  both engines and prints cost of one insert (lookup miss and insert, as in
+ *  add_word) and one lookup hit. Sizes which don't fit into 3/4 of physical
+ *  memory (BENCH_KEY_BYTES per key) are skipped. Input isn't used.
+ */
+void bench_scaling(const char *data, unsigned long len) {
+    unsigned long sizes[] = {1000, 10000, 100000, 1000000, 10000000, 100000000, 500000000, 0};
+    stats_t st;
+    word_t **words;
+    word_t *head;
+    word_t *found;
+    char key[8];
+    unsigned long memory = bench_memory() / 4 * 3;
+    unsigned long i, n, num, x;
+    double start, insert, hit;
+    int engine, s, k;
+    
+    num = 0;
+    for(s = 0; sizes[s]; s++) {
+        if(memory == 0 || sizes[s] <= memory / BENCH_KEY_BYTES)
+            num = sizes[s];
+    }
+    
+    if((words = (word_t **) malloc(sizeof(word_t *) * num)) == NULL) {
+        raise_error("Out of memory.");
+    }
+    
+    /* multiplying by an odd number is a permutation of 32-bit numbers, keys
+     * are all different, but don't come in order */
+    stat_init(&st);
+    for(i = 0; i < num; i++) {
+        x = (i * 2654435761UL) & 0xffffffffUL;
+        
+        for(k = 0; k < 7; k++) {
+            key[k] = 'a' + x % 26;
+            x /= 26;
+        }
+        key[7] = '\0';
+        
+        words[i] = new_word(&st, key, 7);
+        words[i]->hh.hash = hash_func(key, 7);
+    }
+    
+    printf("%-12s %12s %14s %14s\n", "engine", "keys", "ns / insert", "ns / hit");
+    
+    for(engine = HASH_CHAINED; engine <= HASH_OPEN; engine++) {
+        hash_set_engine(engine);
+        
+        for(s = 0; sizes[s]; s++) {
+            n = sizes[s];
+            
+            if(n > num) {
+                printf("%-12s %12lu skipped, needs about %lu MB of memory\n", (engine == HASH_OPEN) ? "open" : "chained",
+                        n, n / 1000000 * BENCH_KEY_BYTES);
+                continue;
+            }
+            
+            head = NULL;
+            
+            start = parallel_time();
+            for(i = 0; i < n; i++) {
+                hash_find_hashed(head, WORD_KEY(words[i]), 7, words[i]->hh.hash, &found);
+                hash_add_hashed(&head, words[i], 7, words[i]->hh.hash);
+            }
+            insert = parallel_time() - start;
+            
+            start = parallel_time();
+            for(i = 0; i < n; i++) {
+                hash_find_hashed(head, WORD_KEY(words[i]), 7, words[i]->hh.hash, &found);
+                
+                if(found != words[i]) {
+                    raise_error("Benchmark lookups gave wrong results.");
+                }
+            }
+            hit = parallel_time() - start;
+            
+            printf("%-12s %12lu %14.1f %14.1f\n", (engine == HASH_OPEN) ? "open" : "chained",
+                    n, insert / n * 1e9, hit / n * 1e9);
+            
+            hash_drop_table(head->hh.table);
+        }
+    }
+    
+    hash_set_engine(HASH_CHAINED);
+    
+    stat_free(&st);
+    free(words);
+}
+
+/**
+ *  void bench_chains(word_t **words, unsigned long num)
+ * 
+ *  Prints distribution of chain lengths of num words hashed by hash_func in
+ *  a chained table with as many buckets as it would have after growing,
+ *  next to the one expected from a random function (Poisson).
+ */
+void bench_chains(word_t **words, unsigned long num) {
+    unsigned long *lengths;
+    unsigned long hist[BENCH_CHAIN_MAX + 1];
+    unsigned long count = 1;
+    unsigned long i, max = 0;
+    double load, expected, rest = 1;
+    int k;
+    
+    while(count * BUCKET_LOAD_MAX < num) {
+        count *= 2;
+    }
+    
+    if((lengths = (unsigned long *) calloc(count, sizeof(unsigned long))) == NULL) {
+        raise_error("Out of memory.");
+    }
+    
+    for(i = 0; i < num; i++) {
+        lengths[hash_get_index(hash_func(WORD_KEY(words[i]), words[i]->hh.keylen), count)]++;
+    }
+    
+    memset(hist, 0, sizeof(hist));
+    for(i = 0; i < count; i++) {
+        hist[(lengths[i] < BENCH_CHAIN_MAX) ? lengths[i] : BENCH_CHAIN_MAX]++;
+        
+        if(lengths[i] > max)
+            max = lengths[i];
+    }
+    
+    load = (double) num / count;
+    expected = exp(-load);
+    
+    printf("%-4s %lu buckets, load %.2f, longest chain %lu\n", hash_func_name(), count, load, max);
+    for(k = 0; k <= BENCH_CHAIN_MAX; k++) {
+        /* last line has all longer chains */
+        if(k == BENCH_CHAIN_MAX)
+            expected = rest;
+        
+        printf("     %d%s items: %6.2f %% of buckets, random %6.2f %%\n", k, (k == BENCH_CHAIN_MAX) ? "+" : " ",
+                100.0 * hist[k] / count, 100.0 * expected);
+        rest -= expected;
+        expected *= load / (k + 1);
+    }
+    
+    free(lengths);
+}
+
+/**
+ *  void bench_hash(const char *data, unsigned long len)
+ * 
+ *  Checks that parser computes hash_jen of each word when it hashes words
+ *  itself. Then compares hash functions on distinct words of input, hashes
+ *  per second, distribution of chain lengths and whole parse_buffer.
+ */
+void bench_hash(const char *data, unsigned long len) {
+    const char *names[] = {"jen", "wy", NULL};
+    hash_func_t saved = hash_func;
+    stats_t st;
+    word_t **words;
+    unsigned long num, i, bytes = 0, rounds, r;
+    unsigned long sum = 0;
+    double start, time, best;
+    int f, run;
+    
+    hash_set_func("jen");
+    words = bench_keys(&st, data, len, &num, 0);
+    
+    for(i = 0; i < num; i++) {
+        if(words[i]->hh.hash != hash_jen(WORD_KEY(words[i]), words[i]->hh.keylen)) {
+            raise_error("Hash of word computed by parser differs from hash_jen.");
+        }
+        
+        bytes += words[i]->hh.keylen;
+    }
+    
+    printf("Parser hashes match hash_jen, %lu distinct words, %.1f bytes on average.\n",
+            num, (double) bytes / num);
+    
+    /* distinct words are hashed again and again, up to BENCH_HASH_BYTES */
+    rounds = BENCH_HASH_BYTES / (bytes + 1) + 1;
+    
+    for(f = 0; names[f] != NULL; f++) {
+        if(!hash_set_func(names[f]))
+            continue;
+        
+        best = -1;
+        for(run = 0; run < BENCH_RUNS; run++) {
+            start = parallel_time();
+            for(r = 0; r < rounds; r++) {
+                for(i = 0; i < num; i++) {
+                    sum += hash_func(WORD_KEY(words[i]), words[i]->hh.keylen);
+                }
+            }
+            time = parallel_time() - start;
+            
+            if(best < 0 || time < best)
+                best = time;
+        }
+        
+        printf("%-4s %9.1f MB/s, %7.1f Mhashes/s\n", names[f],
+                bytes * rounds / best / 1e6, num * rounds / best / 1e6);
+    }
+    
+    for(f = 0; names[f] != NULL; f++) {
+        if(hash_set_func(names[f]))
+            bench_chains(words, num);
+    }
+    
+    stat_free(&st);
+    free(words);
+    
+    printf("Whole parse_buffer (checksum %lx):\n", sum & 0xff);
+    for(f = 0; names[f] != NULL; f++) {
+        if(!hash_set_func(names[f]))
+            continue;
+        
+        best = -1;
+        for(run = 0; run < BENCH_RUNS; run++) {
+            stat_init(&st);
+            start = parallel_time();
+            parse_buffer(&st, data, len);
+            time = parallel_time() - start;
+            stat_free(&st);
+            
+            if(best < 0 || time < best)
+                best = time;
+        }
+        
+        printf("%-4s %9.1f MB/s\n", names[f], len / best / 1e6);
+    }
+    
+    hash_func = saved;
+}
+
+/**
+ *  unsigned long bench_hash_same(const char *key, unsigned len)
+ * 
+ *  Hash function of collision benchmark, all keys have the same hash, as if
+ *  any real function was broken.
+ */
+unsigned long bench_hash_same(const char *key, unsigned len) {
+    return 0x5a5a5a5aUL;
+}
+
+/**
+ *  void bench_collide_run(const char *corpus, word_t **words, unsigned long num, int engine)
+ * 
+ *  Hashes num words again by hash_func, adds them into an empty table the
+ *  way add_word does and prints time per word and size of overflow tree.
+ */
+void bench_collide_run(const char *corpus, word_t **words, unsigned long num, int engine) {
+    word_t *head = NULL;
+    word_t *found;
+    unsigned long i, tree;
+    double start, time;
+    
+    for(i = 0; i < num; i++) {
+        words[i]->hh.hash = hash_func(WORD_KEY(words[i]), words[i]->hh.keylen);
+    }
+    
+    hash_set_engine(engine);
+    
+    start = parallel_time();
+    for(i = 0; i < num; i++) {
+        hash_find_hashed(head, WORD_KEY(words[i]), words[i]->hh.keylen, words[i]->hh.hash, &found);
+        
+        if(found) {
+            raise_error("Benchmark lookups gave wrong results.");
+        }
+        
+        hash_add_hashed(&head, words[i], words[i]->hh.keylen, words[i]->hh.hash);
+    }
+    time = parallel_time() - start;
+    
+    tree = head->hh.table->tree_num;
+    hash_drop_table(head->hh.table);
+    
+    printf("%-26s %-8s %8lu words %10.0f ns / insert, %lu in tree\n", corpus,
+            (engine == HASH_OPEN) ? "open" : "chained", num, time / num * 1e9, tree);
+}
+
+/**
+ *  void bench_collide(const char *data, unsigned long len)
+ * 
+ *  Adds synthetic colliding words into tables. First words with the same
+ *  hash, with and without overflow trees, then words whose hash_jen without
+ *  seed ends with BENCH_COLLIDE_BITS zero bits, hashed with and without
+ *  random seed. Cost per word shouldn't grow with number of words when
+ *  trees or seed are used. Input isn't used.
+ */
+void bench_collide(const char *data, unsigned long len) {
+    unsigned long sizes[] = {1000, 4000, 16000, 64000, 0};
+    hash_func_t saved = hash_func;
+    stats_t st;
+    word_t **words;
+    char key[16];
+    unsigned long mask = (1UL << BENCH_COLLIDE_BITS) - 1;
+    unsigned long i, x;
+    int engine, s, k;
+    
+    if((words = (word_t **) malloc(sizeof(word_t *) * 64000)) == NULL) {
+        raise_error("Out of memory.");
+    }
+    
+    stat_init(&st);
+    for(i = 0; i < 64000; i++) {
+        x = (i * 2654435761UL) & 0xffffffffUL;
+        
+        for(k = 0; k < 7; k++) {
+            key[k] = 'a' + x % 26;
+            x /= 26;
+        }
+        key[7] = '\0';
+        
+        words[i] = new_word(&st, key, 7);
+        words[i]->hh.keylen = 7;
+    }
+    
+    hash_func = bench_hash_same;
+    
+    for(engine = HASH_CHAINED; engine <= HASH_OPEN; engine++) {
+        for(s = 0; sizes[s]; s++) {
+            hash_set_fallback(1);
+            bench_collide_run("same hash, tree", words, sizes[s], engine);
+            
+            /* without trees it's quadratic, largest size takes minutes */
+            if(sizes[s] <= 16000) {
+                hash_set_fallback(0);
+                bench_collide_run("same hash, no tree", words, sizes[s], engine);
+            }
+        }
+    }
+    
+    hash_set_fallback(1);
+    stat_free(&st);
+    
+    /* words colliding in lower bits of hash_jen without seed are found by
+     * trying random ones */
+    hash_func = hash_jen;
+    hash_set_seed(0);
+    srand(1);
+    stat_init(&st);
+    
+    for(i = 0; i < BENCH_COLLIDE_KEYS; i++) {
+        do {
+            for(k = 0; k < 10; k++) {
+                key[k] = 'a' + rand() % 26;
+            }
+        } while((hash_jen(key, 10) & mask) != 0);
+        
+        key[10] = '\0';
+        words[i] = new_word(&st, key, 10);
+        words[i]->hh.keylen = 10;
+    }
+    
+    for(engine = HASH_CHAINED; engine <= HASH_OPEN; engine++) {
+        hash_set_seed(0);
+        bench_collide_run("jen low bits, no seed", words, BENCH_COLLIDE_KEYS, engine);
+        
+        hash_set_seed(hash_random_seed());
+        bench_collide_run("jen low bits, random seed", words, BENCH_COLLIDE_KEYS, engine);
+    }
+    
+    hash_set_seed(0);
+    hash_set_engine(HASH_CHAINED);
+    hash_func = saved;
+    
+    stat_free(&st);
+    free(words);
+}
+
+/**
+ *  void bench_words(const char *data, unsigned long len)
+ * 
+ *  Prints memory used per distinct word (structure, key and alignment) of
+ *  input with BENCH_KEYS random words and speed of lookups in random order,
+ *  so each one goes to memory for the word, hits compare keys too.
+ */
+void bench_words(const char *data, unsigned long len) {
+    stats_t st;
+    word_t **words;
+    word_t *head;
+    word_t *found;
+    word_t *tmp;
+    unsigned long num, i, j, hits;
+    unsigned long bytes = 0;
+    double start, time, best[2];
+    int engine, run;
+    
+    srand(1);
+    words = bench_keys(&st, data, len, &num, BENCH_KEYS);
+    
+    for(i = 0; i < num; i++) {
+        bytes += words[i]->hh.keylen;
+    }
+    
+    printf("%lu words, %.1f bytes of key on average, %.1f bytes per word in arena "
+            "(structure %lu bytes)\n", num, (double) bytes / num,
+            (double) st.arena.bytes / st.arena.allocs, (unsigned long) sizeof(word_t));
+    
+    for(engine = HASH_CHAINED; engine <= HASH_OPEN; engine++) {
+        hash_set_engine(engine);
+        head = NULL;
+        
+        for(i = 0; i < num; i++) {
+            hash_add_hashed(&head, words[i], words[i]->hh.keylen, words[i]->hh.hash);
+        }
+        
+        best[0] = best[1] = -1;
+        for(run = 0; run < BENCH_RUNS; run++) {
+            /* new random order of lookups for each run */
+            for(i = num - 1; i > 0; i--) {
+                j = ((unsigned long) rand() * ((unsigned long) RAND_MAX + 1) + rand()) % (i + 1);
+                tmp = words[i];
+                words[i] = words[j];
+                words[j] = tmp;
+            }
+            
+            hits = 0;
+            start = parallel_time();
+            for(i = 0; i < num; i++) {
+                hash_find_hashed(head, WORD_KEY(words[i]), words[i]->hh.keylen, words[i]->hh.hash, &found);
+                hits += (found != NULL);
+            }
+            time = parallel_time() - start;
+            
+            if(best[0] < 0 || time < best[0])
+                best[0] = time;
+            
+            /* same word with different hash, probes items with the same
+             * fingerprint or chain, but doesn't compare keys */
+            start = parallel_time();
+            for(i = 0; i < num; i++) {
+                hash_find_hashed(head, WORD_KEY(words[i]), words[i]->hh.keylen, ~words[i]->hh.hash, &found);
+                hits += (found != NULL);
+            }
+            time = parallel_time() - start;
+            
+            if(best[1] < 0 || time < best[1])
+                best[1] = time;
+            
+            if(hits != num) {
+                raise_error("Benchmark lookups gave wrong results.");
+            }
+        }
+        
+        printf("%-12s hit %7.1f, miss %7.1f Mops/s\n", (engine == HASH_OPEN) ? "open" : "chained",
+                num / best[0] / 1e6, num / best[1] / 1e6);
+        
+        hash_drop_table(head->hh.table);
+    }
+    
+    hash_set_engine(HASH_CHAINED);
+    
+    stat_free(&st);
+    free(words);
+}
+
+/**
+ *  void bench_shared(const char *data, unsigned long len)
+ * 
+ *  Compares merging of partial tables with one shared table from 1 to
+ *  BENCH_THREADS threads. Results of both are checked against parse_buffer
+ *  in one thread, including order of words.
+ */
+void bench_shared(const char *data, unsigned long len) {
+    stats_t ref, st;
+    double start, time, best[2];
+    unsigned threads;
+    int mode, run;
+    
+#ifdef HAVE_POSIX
+    printf("%ld processors online\n", sysconf(_SC_NPROCESSORS_ONLN));
+#endif
+    
+    stat_init(&ref);
+    parse_buffer(&ref, data, len);
+    
+    printf("%-8s %12s %12s\n", "threads", "merge MB/s", "shared MB/s");
+    for(threads = 1; threads <= BENCH_THREADS; threads *= 2) {
+        for(mode = 0; mode < 2; mode++) {
+            best[mode] = -1;
+            
+            for(run = 0; run < BENCH_RUNS; run++) {
+                stat_init(&st);
+                start = parallel_time();
+                
+                if(mode) {
+                    parallel_parse_shared(&st, data, len, threads);
+                }
+                else {
+                    parallel_parse(&st, data, len, threads);
+                }
+                
+                time = parallel_time() - start;
+                
+                if(!bench_equal(&ref, &st)) {
+                    raise_error("Benchmark variants gave different results.");
+                }
+                
+                stat_free(&st);
+                
+                if(best[mode] < 0 || time < best[mode])
+                    best[mode] = time;
+            }
+        }
+        
+        printf("%-8u %12.1f %12.1f\n", threads, len / best[0] / 1e6, len / best[1] / 1e6);
+    }
+    
+    stat_free(&ref);
+}
+
+/**
+ *  void bench_sort(const char *data, unsigned long len)
+ * 
+ *  Compares hash_sort (merge sort of the list) with sort_radix in 1 to 8
+ *  threads on distinct words of input and BENCH_SORT_KEYS random words with
+ *  random counts. Order of sorted words has to be the same in all variants.
+ */
+void bench_sort(const char *data, unsigned long len) {
+    stats_t st;
+    word_t **words;
+    word_t **sorted;
+    word_t *head;
+    word_t *w;
+    unsigned long num, i;
+    unsigned threads = 0;
+    double start, time, best;
+    int run;
+    
+    srand(1);
+    words = bench_keys(&st, data, len, &num, BENCH_SORT_KEYS);
+    
+    /* many small counts and few large ones, like in text */
+    for(i = 0; i < num; i++) {
+        if(words[i]->count == 1)
+            words[i]->count = 1 + rand() % (1 << (rand() % 20));
+    }
+    
+    if((sorted = (word_t **) malloc(sizeof(word_t *) * num)) == NULL) {
+        raise_error("Out of memory.");
+    }
+    
+    printf("%lu words\n", num);
+    
+    /* threads 0 is hash_sort */
+    for(threads = 0; threads <= 8; threads = (threads) ? threads * 2 : 1) {
+        best = -1;
+        
+        for(run = 0; run < BENCH_RUNS; run++) {
+            head = NULL;
+            for(i = 0; i < num; i++) {
+                hash_add_hashed(&head, words[i], words[i]->hh.keylen, words[i]->hh.hash);
+            }
+            
+            start = parallel_time();
+            if(threads) {
+                sort_radix(&head, threads);
+            }
+            else {
+                hash_sort(&head);
+            }
+            time = parallel_time() - start;
+            
+            if(best < 0 || time < best)
+                best = time;
+            
+            w = NULL;
+            for(i = 0; i < num; i++) {
+                hash_get_next(head, &w);
+                
+                if(threads == 0) {
+                    sorted[i] = w;
+                }
+                else if(sorted[i] != w) {
+                    raise_error("Benchmark variants gave different results.");
+                }
+            }
+            
+            hash_drop_table(head->hh.table);
+        }
+        
+        if(threads) {
+            printf("radix %-6u %9.1f ms %9.1f Mwords/s\n", threads, best * 1000, num / best / 1e6);
+        }
+        else {
+            printf("%-12s %9.1f ms %9.1f Mwords/s\n", "merge", best * 1000, num / best / 1e6);
+        }
+    }
+    
+    stat_free(&st);
+    free(sorted);
+    free(words);
+}
+
+/**
+ *  void bench_top(const char *data, unsigned long len)
+ * 
+ *  Compares radix sort of all words with sort_top of 10 to BENCH_TOP_MAX
+ *  most frequent ones, on distinct words of input and BENCH_SORT_KEYS random
+ *  words with random counts. Selected words have to be the first ones of
+ *  the sorted list.
+ */
+void bench_top(const char *data, unsigned long len) {
+    stats_t st;
+    word_t **words;
+    word_t **top = NULL;
+    word_t *head = NULL;
+    word_t *w;
+    unsigned long num, i, k, top_num;
+    double start, time, best;
+    int run;
+    
+    srand(1);
+    words = bench_keys(&st, data, len, &num, BENCH_SORT_KEYS);
+    
+    for(i = 0; i < num; i++) {
+        if(words[i]->count == 1)
+            words[i]->count = 1 + rand() % (1 << (rand() % 20));
+        
+        hash_add_hashed(&head, words[i], words[i]->hh.keylen, words[i]->hh.hash);
+    }
+    
+    printf("%lu words\n", num);
+    
+    for(k = 10; k <= BENCH_TOP_MAX; k *= 100) {
+        best = -1;
+        
+        for(run = 0; run < BENCH_RUNS; run++) {
+            if(top)
+                free(top);
+            
+            start = parallel_time();
+            top = sort_top(head, k, &top_num);
+            time = parallel_time() - start;
+            
+            if(best < 0 || time < best)
+                best = time;
+        }
+        
+        printf("top %-8lu %9.1f ms\n", k, best * 1000);
+    }
+    
+    start = parallel_time();
+    sort_radix(&head, 1);
+    printf("%-12s %9.1f ms\n", "radix all", (parallel_time() - start) * 1000);
+    
+    /* the largest selection has to be the beginning of sorted list */
+    w = NULL;
+    for(i = 0; i < top_num; i++) {
+        hash_get_next(head, &w);
+        
+        if(top[i] != w) {
+            raise_error("Benchmark variants gave different results.");
+        }
+    }
+    
+    free(top);
+    hash_drop_table(head->hh.table);
+    stat_free(&st);
+    free(words);
+}
+
+/**
+ *  void bench_approx(const char *data, unsigned long len)
+ * 
+ *  Compares exact parse with approximate counting in 64K to 16M bytes,
+ *  with and without Count-Min sketch. Prints the largest error of reported
+ *  counts against exact ones and how many of BENCH_APPROX_TOP most frequent
+ *  words were found. Exact count has to be within bounds of each counter.
+ */
+void bench_approx(const char *data, unsigned long len) {
+    stats_t ref, st;
+    approx_counter_t **sorted;
+    word_t **top;
+    word_t *w;
+    unsigned long budget, i, j, num, top_num, found, err;
+    double start, time, best;
+    int countmin, run;
+    
+    stat_init(&ref);
+    start = parallel_time();
+    parse_buffer(&ref, data, len);
+    printf("%-16s %9.1f ms\n", "exact", (parallel_time() - start) * 1000);
+    
+    top = sort_top(ref.word_table, BENCH_APPROX_TOP, &top_num);
+    
+    printf("%-16s %9s %9s %9s %9s\n", "approx", "ms", "counters", "max err", "top found");
+    for(budget = 65536; budget <= 16777216; budget *= 16) {
+        for(countmin = 0; countmin < 2; countmin++) {
+            best = -1;
+            
+            for(run = 0; run < BENCH_RUNS; run++) {
+                if(run > 0)
+                    stat_free(&st);
+                
+                stat_init(&st);
+                st.approx = approx_create(budget, countmin);
+                
+                start = parallel_time();
+                parse_buffer(&st, data, len);
+                time = parallel_time() - start;
+                
+                if(best < 0 || time < best)
+                    best = time;
+            }
+            
+            sorted = approx_sorted(st.approx);
+            num = (st.approx->num < top_num) ? st.approx->num : top_num;
+            found = err = 0;
+            
+            for(i = 0; i < st.approx->num; i++) {
+                hash_find_str(ref.word_table, sorted[i]->key, &w);
+                
+                if(w == NULL || w->count > sorted[i]->count 
+                        || w->count < sorted[i]->count - sorted[i]->error) {
+                    raise_error("Benchmark variants gave different results.");
+                }
+                
+                if(sorted[i]->count - w->count > err)
+                    err = sorted[i]->count - w->count;
+            }
+            
+            /* most frequent words have to be among the first counters */
+            for(i = 0; i < top_num; i++) {
+                for(j = 0; j < num; j++) {
+                    if(strcmp(sorted[j]->key, WORD_KEY(top[i])) == 0) {
+                        found++;
+                        break;
+                    }
+                }
+            }
+            
+            printf("%5luK %-10s %9.1f %9lu %9lu %5lu/%lu\n", budget / 1024, 
+                    (countmin) ? "countmin" : "", best * 1000, st.approx->capacity, err, found, top_num);
+            
+            free(sorted);
+            stat_free(&st);
+        }
+    }
+    
+    free(top);
+    stat_free(&ref);
+}
+
+/**
+ *  void bench_distinct(const char *data, unsigned long len)
+ * 
+ *  Compares exact parse with estimation of distinct words by HyperLogLog,
+ *  with both hash functions. Prints error of #words and the largest error
+ *  of #len lines against exact ones.
+ */
+void bench_distinct(const char *data, unsigned long len) {
+    stats_t ref, st;
+    hash_func_t funcs[] = {hash_jen, NULL};
+    hash_func_t saved = hash_func;
+    double start, time, best, words, err, max_err;
+    unsigned i;
+    int f, run;
+    
+#ifdef HAVE_HASH_WY
+    funcs[1] = hash_wy;
+#endif
+    
+    printf("%-8s %9s %9s %9s %9s\n", "hash", "exact ms", "hll ms", "#words %", "#len %");
+    for(f = 0; f < 2 && funcs[f]; f++) {
+        hash_func = funcs[f];
+        best = -1;
+        
+        for(run = 0; run < BENCH_RUNS; run++) {
+            stat_init(&ref);
+            start = parallel_time();
+            parse_buffer(&ref, data, len);
+            time = parallel_time() - start;
+            
+            if(run < BENCH_RUNS - 1)
+                stat_free(&ref);
+            
+            if(best < 0 || time < best)
+                best = time;
+        }
+        
+        printf("%-8s %9.1f", hash_func_name(), best * 1000);
+        best = -1;
+        
+        for(run = 0; run < BENCH_RUNS; run++) {
+            stat_init(&st);
+            st.distinct = distinct_create();
+            start = parallel_time();
+            parse_buffer(&st, data, len);
+            time = parallel_time() - start;
+            
+            if(run < BENCH_RUNS - 1)
+                stat_free(&st);
+            
+            if(best < 0 || time < best)
+                best = time;
+        }
+        
+        words = hll_estimate(&st.distinct->words);
+        max_err = 0;
+        
+        for(i = 0; i < ref.w_length_max; i++) {
+            if(ref.w_lengths[i] == 0)
+                continue;
+            
+            err = fabs(hll_estimate(&st.distinct->lengths[i]) - ref.w_lengths[i]) / ref.w_lengths[i];
+            
+            if(err > max_err)
+                max_err = err;
+        }
+        
+        printf(" %9.1f %9.2f %9.2f\n", best * 1000, 
+                100 * fabs(words - hash_count(ref.word_table)) / hash_count(ref.word_table), 100 * max_err);
+        
+        stat_free(&ref);
+        stat_free(&st);
+    }
+    
+    hash_func = saved;
+}
+
+/**
+ *  unsigned long bench_read_tmp(FILE *fp, char **out)
+ * 
+ *  Reads everything written into temporary file fp and closes it, out is
+ *  set to the contents and their length is returned. Contents are freed by
+ *  caller.
+ */
+unsigned long bench_read_tmp(FILE *fp, char **out) {
+    unsigned long size;
+    
+    size = (unsigned long) ftell(fp);
+    rewind(fp);
+    
+    if((*out = (char *) malloc(size + 1)) == NULL) {
+        raise_error("Out of memory.");
+    }
+    
+    if(fread(*out, 1, size, fp) != size) {
+        raise_error("Can't read temporary file.");
+    }
+    
+    fclose(fp);
+    
+    return size;
+}
+
+/**
+ *  unsigned long bench_spill_write(stats_t *st, const char *data, unsigned long len, char **out)
+ * 
+ *  Parses data into st and writes it's stats into a temporary file, out is
+ *  set to it's contents and their length is returned. Contents are freed
+ *  by caller.
+ */
+unsigned long bench_spill_write(stats_t *st, const char *data, unsigned long len, char **out) {
+    FILE *fp = spill_tmpfile();
+    
+    parse_buffer(st, data, len);
+    write_stats(st, fp);
+    
+    return bench_read_tmp(fp, out);
+}
+
+/**
+ *  void bench_spill(const char *data, unsigned long len)
+ * 
+ *  Compares parse and write_stats with all words in memory and with 16M to
+ *  256K budget spilling them to disk. Output has to be the same.
+ */
+void bench_spill(const char *data, unsigned long len) {
+    stats_t st;
+    char *ref, *out;
+    unsigned long budget, ref_len, out_len;
+    unsigned runs;
+    double start, time, best;
+    int run;
+    
+    printf("%-10s %9s %9s\n", "budget", "runs", "ms");
+    for(budget = 0; budget >= 262144 || budget == 0; budget = (budget) ? budget / 4 : 16777216) {
+        best = -1;
+        
+        for(run = 0; run < BENCH_RUNS; run++) {
+            /* pooled table of previous budget would count into this one */
+            hash_free_pool();
+            stat_init(&st);
+            
+            if(budget) {
+                st.spill = spill_create(budget);
+            }
+            
+            start = parallel_time();
+            out_len = bench_spill_write(&st, data, len, &out);
+            time = parallel_time() - start;
+            
+            runs = (budget) ? st.spill->spilled : 0;
+            stat_free(&st);
+            
+            if(best < 0 || time < best)
+                best = time;
+            
+            if(budget == 0 && run == 0) {
+                ref = out;
+                ref_len = out_len;
+                continue;
+            }
+            
+            if(out_len != ref_len || memcmp(out, ref, ref_len) != 0) {
+                raise_error("Benchmark variants gave different results.");
+            }
+            
+            free(out);
+        }
+        
+        if(budget) {
+            printf("%9luK %9u %9.1f\n", budget / 1024, runs, best * 1000);
+        }
+        else {
+            printf("%-10s %9u %9.1f\n", "memory", runs, best * 1000);
+        }
+    }
+    
+    free(ref);
+}
+
+/**
+ *  unsigned long bench_text_lookup(const char *text, unsigned long size, word_t **words, unsigned long num)
+ * 
+ *  Parses word section of text stats into a new table and looks up num
+ *  words in it, like every query of text stats has to. Returns sum of
+ *  counts found.
+ */
+unsigned long bench_text_lookup(const char *text, unsigned long size, word_t **words, unsigned long num) {
+    stats_t st;
+    word_t *w;
+    const char *line = text;
+    const char *end = text + size;
+    const char *space;
+    unsigned long i, sum = 0;
+    unsigned keylen;
+    int section = 0;
+    
+    stat_init(&st);
+    
+    while(line < end && section < 2) {
+        for(space = line; space < end && *space != ' ' && *space != _CR; space++)
+            ;
+        
+        if(strncmp(line, "%%%", 3) == 0) {
+            section++;
+        }
+        else if(section == 1 && space < end && *space == ' ') {
+            keylen = (unsigned) (space - line);
+            w = new_word(&st, (char *) line, keylen);
+            w->count = (unsigned) strtoul(space + 1, NULL, 10);
+            hash_add_hashed(&st.word_table, w, keylen, hash_func(line, keylen));
+        }
+        
+        while(line < end && *line != _LF) {
+            line++;
+        }
+        line++;
+    }
+    
+    for(i = 0; i < num; i++) {
+        hash_find_hashed(st.word_table, WORD_KEY(words[i]), words[i]->hh.keylen,
+                hash_func(WORD_KEY(words[i]), words[i]->hh.keylen), &w);
+        sum += (w != NULL) ? w->count : 0;
+    }
+    
+    stat_free(&st);
+    
+    return sum;
+}
+
+/**
+ *  void bench_binary(const char *data, unsigned long len)
+ * 
+ *  Compares looking up every word of data in text stats, which have to be
+ *  parsed into a table first, with lookups in index of binary stats loaded
+ *  into memory like by query. Both have to find the counts of the table.
+ */
+void bench_binary(const char *data, unsigned long len) {
+    stats_t st;
+    word_t **words;
+    word_t *w = NULL;
+    binstat_record_t *rec;
+    FILE *fp;
+    char *text, *bin;
+    unsigned long text_len, bin_len, num, i;
+    unsigned long sum = 0, found;
+    double start, time, best[2];
+    int run;
+    
+    stat_init(&st);
+    text_len = bench_spill_write(&st, data, len, &text);
+    
+    fp = spill_tmpfile();
+    binstat_write_stats(&st, fp);
+    bin_len = bench_read_tmp(fp, &bin);
+    
+    num = hash_count(st.word_table);
+    if((words = (word_t **) malloc(sizeof(word_t *) * (num + 1))) == NULL) {
+        raise_error("Out of memory.");
+    }
+    
+    num = 0;
+    hash_get_next(st.word_table, &w);
+    while(w != NULL) {
+        sum += w->count;
+        words[num++] = w;
+        hash_get_next(st.word_table, &w);
+    }
+    
+    best[0] = best[1] = -1;
+    for(run = 0; run < BENCH_RUNS; run++) {
+        start = parallel_time();
+        found = bench_text_lookup(text, text_len, words, num);
+        time = parallel_time() - start;
+        
+        if(best[0] < 0 || time < best[0])
+            best[0] = time;
+        
+        if(found != sum) {
+            raise_error("Benchmark variants gave different results.");
+        }
+        
+        found = 0;
+        start = parallel_time();
+        for(i = 0; i < num; i++) {
+            rec = binstat_find(bin, WORD_KEY(words[i]));
+            found += (rec != NULL) ? rec->count : 0;
+        }
+        time = parallel_time() - start;
+        
+        if(best[1] < 0 || time < best[1])
+            best[1] = time;
+        
+        if(found != sum) {
+            raise_error("Benchmark variants gave different results.");
+        }
+    }
+    
+    printf("%lu words, %lu lookups\n", num, num);
+    printf("%-8s %10s %9s %12s\n", "format", "bytes", "ms", "us/lookup");
+    printf("%-8s %10lu %9.1f %12.3f\n", "text", text_len, best[0] * 1000, best[0] * 1e6 / num);
+    printf("%-8s %10lu %9.1f %12.3f\n", "binary", bin_len, best[1] * 1000, best[1] * 1e6 / num);
+    
+    free(text);
+    free(bin);
+    free(words);
+    stat_free(&st);
+}
+
+/**
+ *  unsigned long bench_binary_write(stats_t *st, char **out)
+ * 
+ *  Writes binary stats of st into memory, out is set to them and their
+ *  length is returned. Stats are freed by caller.
+ */
+unsigned long bench_binary_write(stats_t *st, char **out) {
+    FILE *fp = spill_tmpfile();
+    
+    binstat_write_stats(st, fp);
+    
+    return bench_read_tmp(fp, out);
+}
+
+/**
+ *  void bench_update(const char *data, unsigned long len)
+ * 
+ *  Compares parsing whole data with loading binary stats of it's first 90 %
+ *  and parsing only the rest, like --update. Written stats have to be the
+ *  same.
+ */
+void bench_update(const char *data, unsigned long len) {
+    stats_t st;
+    char *snap, *ref, *out;
+    unsigned long cut, snap_len, ref_len, out_len;
+    double start, time, best[2];
+    int run;
+    
+    /* last tenth starts after a delimiter */
+    cut = parse_boundary(data, len / 10 * 9);
+    
+    stat_init(&st);
+    parse_buffer(&st, data, cut);
+    snap_len = bench_binary_write(&st, &snap);
+    stat_free(&st);
+    
+    best[0] = best[1] = -1;
+    for(run = 0; run < BENCH_RUNS; run++) {
+        stat_init(&st);
+        
+        start = parallel_time();
+        parse_buffer(&st, data, len);
+        ref_len = bench_binary_write(&st, &ref);
+        time = parallel_time() - start;
+        
+        stat_free(&st);
+        
+        if(best[0] < 0 || time < best[0])
+            best[0] = time;
+        
+        stat_init(&st);
+        
+        start = parallel_time();
+        binstat_load_data(&st, snap);
+        parse_buffer(&st, data + cut, len - cut);
+        out_len = bench_binary_write(&st, &out);
+        time = parallel_time() - start;
+        
+        stat_free(&st);
+        
+        if(best[1] < 0 || time < best[1])
+            best[1] = time;
+        
+        if(out_len != ref_len || memcmp(out, ref, ref_len) != 0) {
+            raise_error("Benchmark variants gave different results.");
+        }
+        
+        free(ref);
+        free(out);
+    }
+    
+    printf("snapshot of %lu bytes, %lu new bytes\n", snap_len, len - cut);
+    printf("%-8s %9s\n", "variant", "ms");
+    printf("%-8s %9.1f\n", "full", best[0] * 1000);
+    printf("%-8s %9.1f\n", "update", best[1] * 1000);
+    
+    free(snap);
+}
+
+/**
+ *  void bench_follow(const char *data, unsigned long len)
+ * 
+ *  Compares parsing all appended data again after each of BENCH_APPENDS
+ *  appends with parsing only the appended bytes, like --follow. Appends end
+ *  in the middle of words. Stats written after each append have to be the
+ *  same.
+ */
+void bench_follow(const char *data, unsigned long len) {
+    stats_t st, inc;
+    FILE *fp;
+    char *ref, *out;
+    unsigned long ref_len, out_len, end, cut, parsed;
+    double start, best[2], time[2];
+    int run, k;
+    
+    best[0] = best[1] = -1;
+    for(run = 0; run < BENCH_RUNS; run++) {
+        time[0] = time[1] = 0;
+        parsed = 0;
+        stat_init(&inc);
+        
+        for(k = 1; k <= BENCH_APPENDS; k++) {
+            end = len / BENCH_APPENDS * k;
+            
+            if(k == BENCH_APPENDS)
+                end = len;
+            
+            /* the last word might not be complete until the next append */
+            cut = (k == BENCH_APPENDS) ? len : parse_boundary(data, end);
+            
+            start = parallel_time();
+            stat_init(&st);
+            parse_buffer(&st, data, cut);
+            fp = spill_tmpfile();
+            write_stats(&st, fp);
+            time[0] += parallel_time() - start;
+            
+            ref_len = bench_read_tmp(fp, &ref);
+            stat_free(&st);
+            
+            start = parallel_time();
+            parse_buffer(&inc, data + parsed, cut - parsed);
+            parsed = cut;
+            fp = spill_tmpfile();
+            follow_write_stats(&inc, NULL, fp);
+            time[1] += parallel_time() - start;
+            
+            out_len = bench_read_tmp(fp, &out);
+            
+            if(out_len != ref_len || memcmp(out, ref, ref_len) != 0) {
+                raise_error("Benchmark variants gave different results.");
+            }
+            
+            free(ref);
+            free(out);
+        }
+        
+        stat_free(&inc);
+        
+        if(best[0] < 0 || time[0] < best[0])
+            best[0] = time[0];
+        
+        if(best[1] < 0 || time[1] < best[1])
+            best[1] = time[1];
+    }
+    
+    printf("%d appends of %lu bytes\n", BENCH_APPENDS, len / BENCH_APPENDS);
+    printf("%-8s %9s\n", "variant", "ms");
+    printf("%-8s %9.1f\n", "rerun", best[0] * 1000);
+    printf("%-8s %9.1f\n", "follow", best[1] * 1000);
+}
+
+/**
+ *  unsigned long bench_read_file(char *name, char **out)
+ * 
+ *  Reads whole file name, out is set to it's contents and their length is
+ *  returned. Contents are freed by caller.
+ */
+unsigned long bench_read_file(char *name, char **out) {
+    FILE *fp;
+    
+    open_file(&fp, name, "rb");
+    fseek(fp, 0, SEEK_END);
+    
+    return bench_read_tmp(fp, out);
+}
+
+/**
+ *  void bench_batch(const char *data, unsigned long len)
+ * 
+ *  Splits data into BENCH_BATCH_FILES files of growing size, so workers
+ *  steal from each other, and analyzes them by batch_run with 1 to
+ *  BENCH_BATCH_THREADS threads. Stats of each file have to be the same as
+ *  of the file parsed alone, total stats the same as of all files parsed
+ *  one after another. Files are written into current directory.
+ */
+void bench_batch(const char *data, unsigned long len) {
+    stats_t st;
+    stats_t total;
+    FILE *fp;
+    FILE *list;
+    char name[64];
+    char *ref[BENCH_BATCH_FILES];
+    char *total_ref, *out;
+    unsigned long ref_len[BENCH_BATCH_FILES];
+    unsigned long cut[BENCH_BATCH_FILES + 1];
+    unsigned long total_len, out_len;
+    unsigned threads;
+    double start, time, best;
+    int i, run;
+    
+    open_file(&list, "cstat_batch.lst", "wb");
+    stat_init(&total);
+    
+    /* sizes grow with square of file number, the first one can be empty */
+    cut[0] = 0;
+    for(i = 1; i <= BENCH_BATCH_FILES; i++) {
+        cut[i] = (i == BENCH_BATCH_FILES) ? len 
+                : parse_boundary(data, (unsigned long) ((double) len * i * i / BENCH_BATCH_FILES / BENCH_BATCH_FILES));
+        
+        if(cut[i] < cut[i - 1])
+            cut[i] = cut[i - 1];
+    }
+    
+    for(i = 0; i < BENCH_BATCH_FILES; i++) {
+        sprintf(name, "cstat_batch_%d.txt", i);
+        fprintf(list, "%s\n", name);
+        
+        open_file(&fp, name, "wb");
+        
+        if(cut[i + 1] > cut[i] && fwrite(data + cut[i], 1, cut[i + 1] - cut[i], fp) != cut[i + 1] - cut[i]) {
+            raise_error("Can't write temporary file.");
+        }
+        
+        close_file(&fp);
+        
+        stat_init(&st);
+        parse_buffer(&st, data + cut[i], cut[i + 1] - cut[i]);
+        fp = spill_tmpfile();
+        write_stats(&st, fp);
+        ref_len[i] = bench_read_tmp(fp, &ref[i]);
+        stat_free(&st);
+        
+        parse_buffer(&total, data + cut[i], cut[i + 1] - cut[i]);
+    }
+    
+    close_file(&list);
+    
+    fp = spill_tmpfile();
+    write_stats(&total, fp);
+    total_len = bench_read_tmp(fp, &total_ref);
+    stat_free(&total);
+    
+    printf("%-8s %9s\n", "threads", "ms");
+    for(threads = 1; threads <= BENCH_BATCH_THREADS; threads *= 2) {
+        best = -1;
+        
+        for(run = 0; run < BENCH_RUNS; run++) {
+            start = parallel_time();
+            batch_run("cstat_batch.lst", ".", "cstat_batch.total", threads);
+            time = parallel_time() - start;
+            
+            if(best < 0 || time < best)
+                best = time;
+            
+            for(i = 0; i < BENCH_BATCH_FILES; i++) {
+                sprintf(name, "./cstat_batch_%d.txt.stat", i);
+                out_len = bench_read_file(name, &out);
+                
+                if(out_len != ref_len[i] || memcmp(out, ref[i], ref_len[i]) != 0) {
+                    raise_error("Benchmark variants gave different results.");
+                }
+                
+                free(out);
+            }
+            
+            out_len = bench_read_file("cstat_batch.total", &out);
+            
+            if(out_len != total_len || memcmp(out, total_ref, total_len) != 0) {
+                raise_error("Benchmark variants gave different results.");
+            }
+            
+            free(out);
+        }
+        
+        printf("%-8u %9.1f\n", threads, best * 1000);
+    }
+    
+    for(i = 0; i < BENCH_BATCH_FILES; i++) {
+        sprintf(name, "cstat_batch_%d.txt", i);
+        remove(name);
+        sprintf(name, "./cstat_batch_%d.txt.stat", i);
+        remove(name);
+        free(ref[i]);
+    }
+    
+    remove("cstat_batch.lst");
+    remove("cstat_batch.total");
+    free(total_ref);
+}
+
+/**
+ *  void bench_pipeline_pipe(stats_t *st, const char *data, unsigned long len)
+ * 
+ *  Parses data by pipeline_parse from a pipe, which is read by fread. Data
+ *  is written into the pipe by a child process. Without POSIX data is read
+ *  from a temporary file instead.
+ */
+void bench_pipeline_pipe(stats_t *st, const char *data, unsigned long len) {
+    FILE *fp;
+#ifdef HAVE_POSIX
+    int fds[2];
+    pid_t pid;
+    unsigned long written = 0;
+    ssize_t w;
+    
+    if(pipe(fds) != 0 || (pid = fork()) < 0) {
+        raise_error("Couldn't create pipe.");
+    }
+    
+    if(pid == 0) {
+        close(fds[0]);
+        
+        while(written < len && (w = write(fds[1], data + written, len - written)) > 0) {
+            written += w;
+        }
+        
+        _exit((written == len) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    
+    close(fds[1]);
+    
+    if((fp = fdopen(fds[0], "rb")) == NULL) {
+        raise_error("Couldn't create pipe.");
+    }
+    
+    pipeline_parse(st, fp);
+    fclose(fp);
+    waitpid(pid, NULL, 0);
+#else
+    fp = spill_tmpfile();
+    
+    if(fwrite(data, 1, len, fp) != len) {
+        raise_error("Can't write temporary file.");
+    }
+    
+    rewind(fp);
+    pipeline_parse(st, fp);
+    fclose(fp);
+#endif
+}
+
+/**
+ *  void bench_pipeline(const char *data, unsigned long len)
+ * 
+ *  Compares parse_buffer of whole input, like process_input of mapped file,
+ *  with pipeline_parse of a file read by pread and of a pipe read by fread.
+ *  Data is repeated until it fills the ring of CBUFFSIZE buffers
+ *  BENCH_PIPELINE_RINGS times and a word is put across each boundary of
+ *  buffers, so it's carried into the next one. Stats have to be the same.
+ */
+void bench_pipeline(const char *data, unsigned long len) {
+    static const char word[] = "pipelinecarry";
+    stats_t ref, st;
+    FILE *fp;
+    char *input;
+    unsigned long size, i;
+    double start, time, best[3];
+    int run, v;
+    
+    size = (unsigned long) CBUFFSIZE * PBUFFNUM * BENCH_PIPELINE_RINGS + len / 2 + 1;
+    
+    if((input = (char *) malloc(size)) == NULL) {
+        raise_error("Out of memory.");
+    }
+    
+    for(i = 0; i < size; i += len) {
+        memcpy(input + i, data, (size - i < len) ? size - i : len);
+    }
+    
+    for(i = CBUFFSIZE; i + sizeof(word) < size; i += CBUFFSIZE) {
+        memcpy(input + i - sizeof(word) / 2, word, sizeof(word) - 1);
+    }
+    
+    best[0] = best[1] = best[2] = -1;
+    for(run = 0; run < BENCH_RUNS; run++) {
+        stat_init(&ref);
+        
+        start = parallel_time();
+        parse_buffer(&ref, input, size);
+        time = parallel_time() - start;
+        
+        if(best[0] < 0 || time < best[0])
+            best[0] = time;
+        
+        for(v = 1; v <= 2; v++) {
+            stat_init(&st);
+            
+            if(v == 1) {
+                fp = spill_tmpfile();
+                
+                if(fwrite(input, 1, size, fp) != size) {
+                    raise_error("Can't write temporary file.");
+                }
+                
+                rewind(fp);
+                
+                start = parallel_time();
+                pipeline_parse(&st, fp);
+                time = parallel_time() - start;
+                
+                fclose(fp);
+            }
+            else {
+                start = parallel_time();
+                bench_pipeline_pipe(&st, input, size);
+                time = parallel_time() - start;
+            }
+            
+            if(best[v] < 0 || time < best[v])
+                best[v] = time;
+            
+            if(!bench_equal(&ref, &st)) {
+                raise_error("Benchmark variants gave different results.");
+            }
+            
+            stat_free(&st);
+        }
+        
+        stat_free(&ref);
+    }
+    
+    printf("%lu bytes in buffers of %lu bytes\n", size, (unsigned long) CBUFFSIZE);
+    printf("%-8s %9s\n", "variant", "ms");
+    printf("%-8s %9.1f\n", "parse", best[0] * 1000);
+    printf("%-8s %9.1f\n", "pread", best[1] * 1000);
+    printf("%-8s %9.1f\n", "fread", best[2] * 1000);
+    
+    free(input);
+}
+
+/* All benchmarks */
+bench_t benchmarks[] = {
+    {"tokenize", "strtok tokenizer vs. lookup table tokenizer", bench_tokenize},
+    {"scan", "scan_words kernels, checked against parse_line", bench_scan},
+    {"fold", "fold_buffer kernels vs. cp1250_tolower", bench_fold},
+    {"table", "open addressing vs. chained hash table", bench_table},
+    {"rehash", "worst insert latency of full vs. incremental resize", bench_rehash},
+    {"scaling", "cost of insert and lookup from 1K to 500M keys", bench_scaling},
+    {"hash", "hash functions, throughput and chain lengths", bench_hash},
+    {"words", "memory per word and lookups in random order", bench_words},
+    {"collide", "colliding words with and without overflow trees and seed", bench_collide},
+    {"shared", "merged partial tables vs. shared table, 1 to 64 threads", bench_shared},
+    {"sort", "merge sort of word list vs. radix sort of an array", bench_sort},
+    {"top", "heap selection of 10 to 10^5 most frequent words vs. radix sort", bench_top},
+    {"approx", "approximate counts in 64K to 16M vs. exact ones", bench_approx},
+    {"distinct", "HyperLogLog estimate of #words and #len vs. exact parse", bench_distinct},
+    {"spill", "words in memory vs. spilled to disk in 16M to 256K", bench_spill},
+    {"binary", "lookups in parsed text stats vs. index of binary stats", bench_binary},
+    {"update", "parse of whole input vs. update of stats of it's first 90 %", bench_update},
+    {"follow", "parse of whole input vs. of appended bytes after each append", bench_follow},
+    {"pipeline", "parse of mapped input vs. pipeline of pread and fread", bench_pipeline},
+    {"batch", "files analyzed one by one vs. by batch in 1 to 8 threads", bench_batch},
+    {NULL, NULL, NULL}
+};
+
+/**
+ *  void bench_list()
+ * 
+ *  Prints names of all benchmarks.
+ */
+void bench_list() {
+    int i;
+    
+    for(i = 0; benchmarks[i].name != NULL; i++) {
+        printf("\t\t %-12s %s\n", benchmarks[i].name, benchmarks[i].desc);
+    }
+}
+
+/**
+ *  void bench_run(char *name, char *input)
+ * 
+ *  Loads whole input file into memory and runs benchmark with given name on
+ *  it. Raises error if there's no such benchmark or input is empty.
+ */
+void bench_run(char *name, char *input) {
+    FILE *fp;
+    char *data;
+    unsigned long len = 0;
+    unsigned long size = CBUFFSIZE;
+    unsigned long read;
+    int i;
+    
+    for(i = 0; benchmarks[i].name != NULL; i++) {
+        if(strcmp(benchmarks[i].name, name) == 0)
+            break;
+    }
+    
+    if(benchmarks[i].name == NULL) {
+        raise_error("Unknown benchmark.");
+    }
+    
+    if(strcmp(input, "-") == 0) {
+        fp = stdin;
+    }
+    else {
+        open_file(&fp, input, "rb");
+    }
+    
+    if((data = (char *) malloc(size)) == NULL) {
+        raise_error("Out of memory.");
+    }
+    
+    while((read = read_chunk(fp, data, len, size)) > 0) {
+        len += read;
+        
+        if(len == size) {
+            size *= 2;
+            
+            if((data = (char *) realloc(data, size)) == NULL) {
+                raise_error("Out of memory.");
+            }
+        }
+    }
+    
+    if(fp != stdin) {
+        fclose(fp);
+    }
+    
+    if(len == 0)
+        raise_error("Input file is empty.");
+    
+    printf("Benchmark %s, %lu bytes, best of %d runs:\n", name, len, BENCH_RUNS);
+    benchmarks[i].func(data, len);
+    
+    free(data);
+}
+
+/**
+ *  int main(int argc, char **argv)
+ * 
+ *  Runs benchmark named by the first argument on input file named by the
+ *  second one, '-' reads standard input.
+ */
+int main(int argc, char **argv) {
+    if(argc != 3) {
+        printf("USAGE: cstat_bench.exe name inpf\n");
+        printf("Benchmarks:\n");
+        bench_list();
+        
+        return EXIT_FAILURE;
+    }
+    
+    scan_init();
+    fold_init();
+    bench_run(argv[1], argv[2]);
+    
+    return EXIT_SUCCESS;
+}
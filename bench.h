@@ -0,0 +1,18 @@
+/*
+ *  Text analysis program
+ * 
+ *  File: bench.h
+ * 
+ *  Author: Martin Kucera, 2012
+ */
+
+#ifndef BENCH_H
+#define	BENCH_H
+
+/* Function prototypes */
+
+void bench_list();
+void bench_run(char *name, char *input);
+
+
+#endif	/* BENCH_H */
@@ -0,0 +1,490 @@
+/*
+ *  Text analysis program
+ * 
+ *  File: binstat.c
+ *  Binary stats file which is mapped into memory and queried as it is,
+ *  without parsing it again. Sections are arrays of structures at aligned
+ *  offsets written in header: word lengths, letters at their indexes,
+ *  records of words in the same order as text stats, open addressing index
+ *  of records, record numbers in order of insertion of words and keys. Keys
+ *  are hashed by FNV-1a which doesn't depend on --hash and --seed, files
+ *  are read back by the platform which wrote them. Stats are updated by
+ *  loading them into table again and parsing new input.
+ *  Lookup by the index and loading in order of insertion cost space: with
+ *  the index at most 3/4 full and the record numbers of inserted words the
+ *  file is about 2.7 times larger than text stats of the same words.
+ * 
+ *  Author: Martin Kucera, 2012
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "binstat.h"
+#include "stat.h"
+#include "sort.h"
+#include "file.h"
+#include "err.h"
+#include "global.h"
+#include "hash_table.h"
+#include "cp1250_ctype.h"
+
+/**
+ *  unsigned long binstat_hash(const char *key, unsigned len)
+ * 
+ *  Returns 32-bit FNV-1a hash of key, same for every run of program.
+ */
+unsigned long binstat_hash(const char *key, unsigned len) {
+    unsigned long hash = 2166136261UL;
+    unsigned i;
+    
+    for(i = 0; i < len; i++) {
+        hash ^= (unsigned char) key[i];
+        hash = (hash * 16777619UL) & 0xffffffffUL;
+    }
+    
+    return hash;
+}
+
+/**
+ *  unsigned long binstat_align(unsigned long offset)
+ * 
+ *  Returns offset rounded up to the start of next section.
+ */
+unsigned long binstat_align(unsigned long offset) {
+    return (offset + BINSTAT_ALIGN - 1) & ~((unsigned long) BINSTAT_ALIGN - 1);
+}
+
+/**
+ *  void binstat_write_section(FILE *fp, void *data, unsigned long size, unsigned long *offset)
+ * 
+ *  Writes section of size bytes and pads it to the start of next one,
+ *  offset is moved behind the padding.
+ */
+void binstat_write_section(FILE *fp, void *data, unsigned long size, unsigned long *offset) {
+    static const char zero[BINSTAT_ALIGN] = {0};
+    unsigned long pad = binstat_align(*offset + size) - (*offset + size);
+    
+    if((size > 0 && fwrite(data, 1, size, fp) != size)
+            || (pad > 0 && fwrite(zero, 1, pad, fp) != pad)) {
+        raise_error("Can't write binary stats.");
+    }
+    
+    (*offset) += size + pad;
+}
+
+/**
+ *  void binstat_write_stats(stats_t *st, FILE *output_file)
+ * 
+ *  Writes stats of word table to output_file in binary format, with
+ *  sort_set_top only records of the most frequent words.
+ */
+void binstat_write_stats(stats_t *st, FILE *output_file) {
+    binstat_header_t header;
+    binstat_record_t *records;
+    unsigned *index;
+    unsigned *inserted;
+    word_t **words;
+    word_t **order;
+    word_t *w = NULL;
+    letter_t empty[L_FREQUENCY_SIZE];
+    unsigned long i, n, slot, num_inserted, key_size = 0;
+    unsigned long offset;
+    
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BINSTAT_MAGIC, 4);
+    header.version = BINSTAT_VERSION;
+    header.long_size = sizeof(unsigned long);
+    header.order = 1;
+    header.words = hash_count(st->word_table);
+    header.w_length_max = st->w_length_max;
+    header.l_total = st->l_total;
+    
+    if((order = (word_t **) malloc(sizeof(word_t *) * (header.words + 1))) == NULL) {
+        raise_error("Out of memory.");
+    }
+    
+    /* order of insertion is lost by sorting */
+    n = 0;
+    hash_get_next(st->word_table, &w);
+    while(w != NULL) {
+        order[n++] = w;
+        hash_get_next(st->word_table, &w);
+    }
+    
+    /* words in the same order as write_stats */
+    if(sort_top_count > 0) {
+        words = sort_top(st->word_table, sort_top_count, &header.records);
+    }
+    else {
+        sort_words(&st->word_table);
+        header.records = header.words;
+        
+        if((words = (word_t **) malloc(sizeof(word_t *) * (header.records + 1))) == NULL) {
+            raise_error("Out of memory.");
+        }
+        
+        n = 0;
+        hash_get_next(st->word_table, &w);
+        while(w != NULL) {
+            words[n++] = w;
+            hash_get_next(st->word_table, &w);
+        }
+    }
+    
+    if(header.records > BINSTAT_MAX) {
+        raise_error("Too many words for binary stats.");
+    }
+    
+    /* index is at most 3/4 full */
+    header.slots = 2;
+    while(header.slots < header.records + header.records / 3 + 1) {
+        header.slots <<= 1;
+    }
+    
+    records = (binstat_record_t *) malloc(sizeof(binstat_record_t) * (header.records + 1));
+    index = (unsigned *) malloc(sizeof(unsigned) * header.slots);
+    inserted = (unsigned *) malloc(sizeof(unsigned) * (header.records + 1));
+    
+    if(records == NULL || index == NULL || inserted == NULL) {
+        raise_error("Out of memory.");
+    }
+    
+    for(i = 0; i < header.slots; i++) {
+        index[i] = BINSTAT_EMPTY;
+    }
+    
+    for(n = 0; n < header.records; n++) {
+        if(key_size > BINSTAT_MAX) {
+            raise_error("Too many words for binary stats.");
+        }
+        
+        records[n].key = (unsigned) key_size;
+        records[n].count = words[n]->count;
+        key_size += words[n]->hh.keylen + 1;
+        
+        slot = binstat_hash(WORD_KEY(words[n]), words[n]->hh.keylen) & (header.slots - 1);
+        while(index[slot] != BINSTAT_EMPTY) {
+            slot = (slot + 1) & (header.slots - 1);
+        }
+        
+        index[slot] = (unsigned) n;
+    }
+    
+    /* record numbers of words in order of insertion, found by the index */
+    num_inserted = (header.records == header.words) ? header.records : 0;
+    for(n = 0; n < num_inserted; n++) {
+        slot = binstat_hash(WORD_KEY(order[n]), order[n]->hh.keylen) & (header.slots - 1);
+        while(words[index[slot]] != order[n]) {
+            slot = (slot + 1) & (header.slots - 1);
+        }
+        
+        inserted[n] = index[slot];
+    }
+    
+    header.lengths = binstat_align(sizeof(header));
+    header.letters = binstat_align(header.lengths + sizeof(unsigned) * header.w_length_max);
+    header.records_off = binstat_align(header.letters + sizeof(letter_t) * L_FREQUENCY_SIZE);
+    header.index = binstat_align(header.records_off + sizeof(binstat_record_t) * header.records);
+    header.inserted = binstat_align(header.index + sizeof(unsigned) * header.slots);
+    header.keys = binstat_align(header.inserted + sizeof(unsigned) * num_inserted);
+    header.size = header.keys + key_size;
+    
+    offset = 0;
+    binstat_write_section(output_file, &header, sizeof(header), &offset);
+    binstat_write_section(output_file, st->w_lengths, sizeof(unsigned) * header.w_length_max, &offset);
+    
+    /* letters at their indexes, write_letters sorts them */
+    if(st->l_frequency != NULL) {
+        binstat_write_section(output_file, st->l_frequency, sizeof(letter_t) * L_FREQUENCY_SIZE, &offset);
+    }
+    else {
+        memset(empty, 0, sizeof(empty));
+        binstat_write_section(output_file, empty, sizeof(empty), &offset);
+    }
+    
+    binstat_write_section(output_file, records, sizeof(binstat_record_t) * header.records, &offset);
+    binstat_write_section(output_file, index, sizeof(unsigned) * header.slots, &offset);
+    binstat_write_section(output_file, inserted, sizeof(unsigned) * num_inserted, &offset);
+    
+    for(n = 0; n < header.records; n++) {
+        if(fwrite(WORD_KEY(words[n]), 1, words[n]->hh.keylen + 1, output_file) != words[n]->hh.keylen + 1) {
+            raise_error("Can't write binary stats.");
+        }
+    }
+    
+    free(order);
+    free(words);
+    free(records);
+    free(index);
+    free(inserted);
+}
+
+/**
+ *  binstat_record_t *binstat_find(char *data, const char *key)
+ * 
+ *  Returns record of word key in mapped binary stats data, NULL if the word
+ *  isn't there.
+ */
+binstat_record_t *binstat_find(char *data, const char *key) {
+    binstat_header_t *header = (binstat_header_t *) data;
+    binstat_record_t *records = (binstat_record_t *) (data + header->records_off);
+    unsigned *index = (unsigned *) (data + header->index);
+    unsigned long slot = binstat_hash(key, (unsigned) strlen(key)) & (header->slots - 1);
+    
+    while(index[slot] != BINSTAT_EMPTY) {
+        if(strcmp(data + header->keys + records[index[slot]].key, key) == 0) {
+            return &records[index[slot]];
+        }
+        
+        slot = (slot + 1) & (header->slots - 1);
+    }
+    
+    return NULL;
+}
+
+/**
+ *  int binstat_section(unsigned long offset, unsigned long num, unsigned long size, unsigned long end)
+ * 
+ *  Returns 1 if section of num items of size bytes starts at aligned offset
+ *  and ends before end, 0 otherwise.
+ */
+int binstat_section(unsigned long offset, unsigned long num, unsigned long size, unsigned long end) {
+    return offset % BINSTAT_ALIGN == 0 && offset <= end && num <= (end - offset) / size;
+}
+
+/**
+ *  void binstat_check(char *data, unsigned long size)
+ * 
+ *  Raises error if size bytes of data aren't binary stats written by this
+ *  version of program on this platform. Every section, record number and
+ *  key offset is checked, so corrupted file can't be read out of data.
+ */
+void binstat_check(char *data, unsigned long size) {
+    binstat_header_t *header = (binstat_header_t *) data;
+    binstat_record_t *records;
+    letter_t *letters;
+    unsigned *index;
+    unsigned *inserted;
+    unsigned long i, empty = 0, num_inserted, key_size;
+    
+    if(size < sizeof(binstat_header_t) || memcmp(header->magic, BINSTAT_MAGIC, 4) != 0
+            || header->version != BINSTAT_VERSION || header->size != size) {
+        raise_error("Not a binary stats file.");
+    }
+    
+    if(header->long_size != sizeof(unsigned long) || header->order != 1) {
+        raise_error("Binary stats were written by another platform.");
+    }
+    
+    /* sections follow each other in order of header */
+    num_inserted = (header->records == header->words) ? header->records : 0;
+    if(header->lengths < sizeof(binstat_header_t) || header->keys > size
+            || header->records > header->words || header->records > BINSTAT_MAX
+            || header->slots < 2 || (header->slots & (header->slots - 1)) != 0
+            || header->slots <= header->records
+            || !binstat_section(header->lengths, header->w_length_max, sizeof(unsigned), header->letters)
+            || !binstat_section(header->letters, L_FREQUENCY_SIZE, sizeof(letter_t), header->records_off)
+            || !binstat_section(header->records_off, header->records, sizeof(binstat_record_t), header->index)
+            || !binstat_section(header->index, header->slots, sizeof(unsigned), header->inserted)
+            || !binstat_section(header->inserted, num_inserted, sizeof(unsigned), header->keys)
+            || !binstat_section(header->keys, 0, 1, size)) {
+        raise_error("Not a binary stats file.");
+    }
+    
+    letters = (letter_t *) (data + header->letters);
+    records = (binstat_record_t *) (data + header->records_off);
+    index = (unsigned *) (data + header->index);
+    inserted = (unsigned *) (data + header->inserted);
+    key_size = size - header->keys;
+    
+    for(i = 0; i < L_FREQUENCY_SIZE; i++) {
+        if(memchr(letters[i].key, '\0', sizeof(letters[i].key)) == NULL) {
+            raise_error("Not a binary stats file.");
+        }
+    }
+    
+    /* keys are terminated before the end of data if the last one is */
+    if(header->records > 0 && data[size - 1] != '\0') {
+        raise_error("Not a binary stats file.");
+    }
+    
+    for(i = 0; i < header->records; i++) {
+        if(records[i].key >= key_size || data[header->keys + records[i].key] == '\0') {
+            raise_error("Not a binary stats file.");
+        }
+    }
+    
+    /* search for a missing word stops at empty slot */
+    for(i = 0; i < header->slots; i++) {
+        if(index[i] == BINSTAT_EMPTY) {
+            empty++;
+        }
+        else if(index[i] >= header->records) {
+            raise_error("Not a binary stats file.");
+        }
+    }
+    
+    if(empty == 0) {
+        raise_error("Not a binary stats file.");
+    }
+    
+    for(i = 0; i < num_inserted; i++) {
+        if(inserted[i] >= header->records) {
+            raise_error("Not a binary stats file.");
+        }
+    }
+}
+
+/**
+ *  char *binstat_open(char *name, unsigned long *size, int *mapped)
+ * 
+ *  Maps binary stats file name into memory and checks it's header, returns
+ *  it's data, size is set to it's length. On platform without mmap whole
+ *  file is read instead and mapped is set to 0. Data is released by
+ *  binstat_close.
+ */
+char *binstat_open(char *name, unsigned long *size, int *mapped) {
+    FILE *fp;
+    char *data;
+    
+    open_file(&fp, name, "rb");
+    
+    if(!(*mapped = map_file(fp, &data, size))) {
+        if((*size = (unsigned long) get_file_size(fp)) < sizeof(binstat_header_t)) {
+            raise_error("Not a binary stats file.");
+        }
+        
+        if((data = (char *) malloc(*size)) == NULL) {
+            raise_error("Out of memory.");
+        }
+        
+        if(fread(data, 1, *size, fp) != *size) {
+            raise_error("Can't read binary stats.");
+        }
+    }
+    
+    /* mapping stays valid after the file is closed */
+    close_file(&fp);
+    
+    binstat_check(data, *size);
+    
+    return data;
+}
+
+/**
+ *  void binstat_close(char *data, unsigned long size, int mapped)
+ * 
+ *  Releases data of binary stats returned by binstat_open.
+ */
+void binstat_close(char *data, unsigned long size, int mapped) {
+    if(mapped) {
+        unmap_file(data, size);
+    }
+    else {
+        free(data);
+    }
+}
+
+/**
+ *  void binstat_query(char *name, char **words, int num)
+ * 
+ *  Prints counts of num words in binary stats file name, 0 for words which
+ *  aren't there. Words are lowercased like by the parser. Without words
+ *  prints #words, #maxlen and #len lines.
+ */
+void binstat_query(char *name, char **words, int num) {
+    char *data;
+    unsigned long size;
+    int mapped;
+    binstat_header_t *header;
+    binstat_record_t *rec;
+    unsigned *lengths;
+    char key[KEY_MAX_LEN + 1];
+    int i;
+    unsigned j;
+    
+    data = binstat_open(name, &size, &mapped);
+    header = (binstat_header_t *) data;
+    
+    if(num == 0) {
+        lengths = (unsigned *) (data + header->lengths);
+        
+        printf("#words %lu\n", header->words);
+        printf("#maxlen %u\n", header->w_length_max);
+        
+        for(j = 0; j < header->w_length_max; j++) {
+            printf("#len(%u) %u\n", (j + 1), lengths[j]);
+        }
+    }
+    
+    for(i = 0; i < num; i++) {
+        for(j = 0; words[i][j] != '\0' && j < KEY_MAX_LEN; j++) {
+            key[j] = (char) cp1250_tolower((unsigned char) words[i][j]);
+        }
+        key[j] = '\0';
+        
+        rec = binstat_find(data, key);
+        printf("%s %u\n", key, (rec != NULL) ? rec->count : 0);
+    }
+    
+    binstat_close(data, size, mapped);
+}
+
+/**
+ *  void binstat_load_data(stats_t *st, char *data)
+ * 
+ *  Loads binary stats data into empty st, words are inserted in their
+ *  original order, so words parsed afterwards are counted and sorted the
+ *  same as if the whole input was parsed again. Stats written with --top
+ *  don't have all words and can't be loaded.
+ */
+void binstat_load_data(stats_t *st, char *data) {
+    binstat_header_t *header = (binstat_header_t *) data;
+    binstat_record_t *records;
+    unsigned *inserted;
+    unsigned long n;
+    char *key;
+    word_t *w;
+    unsigned length;
+    
+    if(header->records != header->words) {
+        raise_error("Binary stats written with --top can't be updated.");
+    }
+    
+    records = (binstat_record_t *) (data + header->records_off);
+    inserted = (unsigned *) (data + header->inserted);
+    
+    for(n = 0; n < header->records; n++) {
+        key = data + header->keys + records[inserted[n]].key;
+        length = (unsigned) strlen(key);
+        
+        if(length > st->w_length_max)
+            st->w_length_max = length;
+        
+        add_word_length(st, length);
+        
+        w = new_word(st, key, length);
+        w->count = records[inserted[n]].count;
+        hash_add_hashed(&st->word_table, w, length, hash_func(key, length));
+    }
+    
+    memcpy(stat_letters(st), data + header->letters, sizeof(letter_t) * L_FREQUENCY_SIZE);
+    st->l_total = header->l_total;
+}
+
+/**
+ *  void binstat_load(stats_t *st, char *name)
+ * 
+ *  Loads binary stats file name into empty st, see binstat_load_data.
+ */
+void binstat_load(stats_t *st, char *name) {
+    char *data;
+    unsigned long size;
+    int mapped;
+    
+    data = binstat_open(name, &size, &mapped);
+    binstat_load_data(st, data);
+    binstat_close(data, size, mapped);
+}
@@ -0,0 +1,81 @@
+/*
+ *  Text analysis program
+ * 
+ *  File: binstat.h
+ * 
+ *  Author: Martin Kucera, 2012
+ */
+
+#ifndef BINSTAT_H
+#define	BINSTAT_H
+
+#include <stdio.h>
+#include "stat.h"
+
+/* First bytes of binary stats file and it's version */
+#define BINSTAT_MAGIC "CSTB"
+#define BINSTAT_VERSION 2
+/* Sections of file start at multiples of this */
+#define BINSTAT_ALIGN 8
+/* Empty slot of index */
+#define BINSTAT_EMPTY ((unsigned) -1)
+/* Largest offset of key and number of records, sections use unsigned */
+#define BINSTAT_MAX ((unsigned) -2)
+
+/* Structures */
+
+/* beginning of file, offsets are from the beginning of file */
+typedef struct {
+    char magic[4];
+    unsigned version;
+    /* sizeof(unsigned long) and 1 in native byte order of the writer,
+     * file is read only by the same platform */
+    unsigned long_size;
+    unsigned order;
+    
+    /* number of distinct words and of written records, less with --top */
+    unsigned long words;
+    unsigned long records;
+    unsigned w_length_max;
+    unsigned long l_total;
+    /* number of slots of index, power of two more than records */
+    unsigned long slots;
+    
+    /* unsigned count of words of each length, w_length_max of them */
+    unsigned long lengths;
+    /* letter_t of each letter at it's index, L_FREQUENCY_SIZE of them */
+    unsigned long letters;
+    /* binstat_record_t of words sorted by count like in text stats */
+    unsigned long records_off;
+    /* unsigned record number in each slot or BINSTAT_EMPTY */
+    unsigned long index;
+    /* unsigned record numbers in order of insertion of words, only when
+     * all words are written */
+    unsigned long inserted;
+    /* terminated keys of words */
+    unsigned long keys;
+    unsigned long size;
+} binstat_header_t;
+
+typedef struct {
+    /* offset of terminated key from keys section */
+    unsigned key;
+    unsigned count;
+} binstat_record_t;
+
+/* Function prototypes */
+
+unsigned long binstat_hash(const char *key, unsigned len);
+unsigned long binstat_align(unsigned long offset);
+void binstat_write_section(FILE *fp, void *data, unsigned long size, unsigned long *offset);
+void binstat_write_stats(stats_t *st, FILE *output_file);
+binstat_record_t *binstat_find(char *data, const char *key);
+int binstat_section(unsigned long offset, unsigned long num, unsigned long size, unsigned long end);
+void binstat_check(char *data, unsigned long size);
+char *binstat_open(char *name, unsigned long *size, int *mapped);
+void binstat_close(char *data, unsigned long size, int mapped);
+void binstat_query(char *name, char **words, int num);
+void binstat_load_data(stats_t *st, char *data);
+void binstat_load(stats_t *st, char *name);
+
+#endif	/* BINSTAT_H */
@@ -11,6 +11,58 @@
 
 #include "cp1250_ctype.h"
 
+/* All delimiters */
+unsigned char delimiters[] = {
+    9,		/* HT */
+    10,		/* LF */
+    11,		/* VT */
+    13,		/* CR */
+    32,		/* SP */
+    33,		/* ! */
+    34,		/* " */
+    36,		/* $ */
+    37,		/* % */
+    40,		/* ( */
+    41,		/* ) */
+    44,		/* , */
+    45,         /* - */
+    46,		/* . */
+    48,         /* 0 */
+    49,         /* 1 */
+    50,         /* 2 */
+    51,         /* 3 */
+    52,         /* 4 */
+    53,         /* 5 */
+    54,         /* 6 */
+    55,         /* 7 */
+    56,         /* 8 */
+    57,         /* 9 */
+    58,		/* : */
+    59,		/* ; */
+    63,		/* ? */
+    64,		/* @ */
+    91,		/* [ */
+    93,		/* ] */
+    123,	/* { */
+    125,	/* } */
+    126,	/* ~ */
+    130,	/* ‚ */
+    132,	/* „ */
+    133,	/* … */
+    137,	/* ‰ */
+    145,	/* ‘ */
+    146,        /* ’ */
+    147,	/* “ */
+    148, 	/* ” */
+    '\0'
+};
+
+/* Outer delimiters */
+unsigned char delimiters_outer[] = {
+    39,          /* ' */
+    '\0'
+};
+
 /* array of CP1250 specific characters */
 unsigned short dict[128] = {
     _PUNCT, /* 0x80 € */
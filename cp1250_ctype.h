@@ -17,6 +17,21 @@
 #define _PUNCT          0x10    /* Punctuation character */
 #define _EMPTY		0x20    /* Unused */
 
+/* Character classes of cp1250_class table */
+#define _TDELIM         0x1     /* Delimiter, splits words (zero byte included) */
+#define _TOUTER         0x2     /* Outer delimiter, allowed only inside a word */
+#define _TALPHA         0x4     /* Alphabetic letter */
+
+/* Delimiters and lookup tables generated from them and dict by cp1250_gen */
+
+extern unsigned char delimiters[];
+extern unsigned char delimiters_outer[];
+extern const unsigned char cp1250_class[256];
+extern const unsigned char cp1250_fold[256];
+extern const unsigned char cp1250_nibble_lo[16];
+extern const unsigned char cp1250_nibble_hi[16];
+extern const int cp1250_nibble_ok;
+
 /* Function prototypes */
 
 int cp1250_isalpha(int c);
@@ -0,0 +1,135 @@
+/*
+ *  Text analysis program
+ * 
+ *  File: cp1250_gen.c
+ *  Build time generator of cp1250_table.c. Goes through all 256 characters
+ *  once and writes lookup tables of character classes and lowercase letters
+ *  computed from delimiters and dict, so the tokenizer needs only a single
+ *  array access per character instead of function calls and string searches.
+ *  Delimiters are also split by low and high nibble into two 16 byte tables
+ *  used by vectorized scanner in scan.c.
+ * 
+ *  Author: Martin Kucera, 2012
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cp1250_ctype.h"
+
+/**
+ *  void print_table(const char *name, unsigned char *table, int size)
+ * 
+ *  Prints table of size values as a C array definition.
+ */
+void print_table(const char *name, unsigned char *table, int size) {
+    int c;
+    
+    printf("const unsigned char %s[%d] = {", name, size);
+    
+    for(c = 0; c < size; c++) {
+        printf("%s%3d%s", (c % 16 == 0) ? "\n    " : "", table[c], (c < size - 1) ? "," : "");
+    }
+    
+    printf("\n};\n\n");
+}
+
+/**
+ *  int nibble_tables(unsigned char *class, unsigned char *lo, unsigned char *hi)
+ * 
+ *  Builds nibble lookup tables of delimiters. Each distinct set of low nibbles
+ *  that form a delimiter with some high nibble gets one bit, byte c is then a
+ *  delimiter exactly when lo[c & 15] & hi[c >> 4] isn't zero. Returns 0 if
+ *  there are more than 8 distinct sets, which can't be represented.
+ */
+int nibble_tables(unsigned char *class, unsigned char *lo, unsigned char *hi) {
+    unsigned sets[8];
+    unsigned set;
+    int nsets = 0;
+    int h, l, b;
+    
+    memset(lo, 0, 16);
+    memset(hi, 0, 16);
+    
+    for(h = 0; h < 16; h++) {
+        set = 0;
+        
+        for(l = 0; l < 16; l++) {
+            if(class[h * 16 + l] & _TDELIM)
+                set |= 1 << l;
+        }
+        
+        if(set == 0)
+            continue;
+        
+        for(b = 0; b < nsets && sets[b] != set; b++)
+            ;
+        
+        if(b == nsets) {
+            if(nsets == 8)
+                return 0;
+            
+            sets[nsets++] = set;
+            
+            for(l = 0; l < 16; l++) {
+                if(set & (1 << l))
+                    lo[l] |= 1 << b;
+            }
+        }
+        
+        hi[h] = 1 << b;
+    }
+    
+    return 1;
+}
+
+/**
+ *  int main()
+ * 
+ *  Prints generated cp1250_table.c to standard output.
+ */
+int main() {
+    unsigned char class[256];
+    unsigned char fold[256];
+    unsigned char lo[16];
+    unsigned char hi[16];
+    int nibble_ok;
+    int c;
+    
+    for(c = 0; c < 256; c++) {
+        class[c] = 0;
+        fold[c] = (unsigned char) c;
+        
+        if(c == 0 || strchr((char *) delimiters, c) != NULL) {
+            class[c] |= _TDELIM;
+        }
+        
+        if(c != 0 && strchr((char *) delimiters_outer, c) != NULL) {
+            class[c] |= _TOUTER;
+        }
+        
+        if(cp1250_isalpha(c)) {
+            class[c] |= _TALPHA;
+            fold[c] = (unsigned char) cp1250_tolower(c);
+        }
+    }
+    
+    nibble_ok = nibble_tables(class, lo, hi);
+    
+    printf("/*\n");
+    printf(" *  Text analysis program\n");
+    printf(" * \n");
+    printf(" *  File: cp1250_table.c\n");
+    printf(" *  Generated by cp1250_gen, do not edit.\n");
+    printf(" */\n\n");
+    printf("#include \"cp1250_ctype.h\"\n\n");
+    
+    print_table("cp1250_class", class, 256);
+    print_table("cp1250_fold", fold, 256);
+    print_table("cp1250_nibble_lo", lo, 16);
+    print_table("cp1250_nibble_hi", hi, 16);
+    printf("const int cp1250_nibble_ok = %d;\n", nibble_ok);
+    
+    return (EXIT_SUCCESS);
+}
@@ -9,12 +9,19 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
 
 #include "file.h"
 #include "err.h"
 #include "cp1250_ctype.h"
 #include "global.h"
 
+#ifdef HAVE_POSIX
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
 /**
  *  void open_file(FILE **fp, char *name, char *mode)
  * 
@@ -125,6 +132,66 @@ int read_line(FILE *fp, char *buff) {
     return 0;
 }
 
+/**
+ *  unsigned long read_chunk(FILE *fp, char *buff, unsigned long carry, unsigned long size)
+ * 
+ *  Fills buff of size bytes from fp. First carry bytes of buff hold the rest
+ *  of previous chunk (word that was split) and are kept, new data is appended
+ *  after them. Returns number of newly read bytes, 0 at the end of file. Works
+ *  with pipes, file is never seeked.
+ */
+unsigned long read_chunk(FILE *fp, char *buff, unsigned long carry, unsigned long size) {
+    unsigned long read;
+    
+    read = fread(buff + carry, 1, size - carry, fp);
+    
+    if(ferror(fp)) {
+        raise_error("Error reading input.");
+    }
+    
+    return read;
+}
+
+/**
+ *  int is_seekable(FILE *fp)
+ * 
+ *  Checks whether fp can be seeked, pipes and terminals can't.
+ */
+int is_seekable(FILE *fp) {
+    return (fseek(fp, 0, SEEK_CUR) == 0);
+}
+
+/**
+ *  int seek_file(FILE *fp, unsigned long offset)
+ * 
+ *  Moves fp to offset from the beginning of file, offsets above LONG_MAX
+ *  are reached too. Returns 0 on success like fseek.
+ */
+int seek_file(FILE *fp, unsigned long offset) {
+#if defined(_WIN32)
+    return _fseeki64(fp, (__int64) offset, SEEK_SET);
+#elif defined(HAVE_POSIX)
+    return fseeko(fp, (off_t) offset, SEEK_SET);
+#else
+    long step;
+    
+    if(fseek(fp, 0L, SEEK_SET) != 0)
+        return -1;
+    
+    /* long can be shorter than offset */
+    while(offset > 0) {
+        step = (offset > LONG_MAX) ? LONG_MAX : (long) offset;
+        
+        if(fseek(fp, step, SEEK_CUR) != 0)
+            return -1;
+        
+        offset -= (unsigned long) step;
+    }
+    
+    return 0;
+#endif
+}
+
 /**
  *  void write_line(FILE *fp, char *line)
  * 
@@ -152,3 +219,49 @@ long get_file_size(FILE *fp) {
     
     return end;
 }
+
+/**
+ *  int map_file(FILE *fp, char **data, unsigned long *size)
+ * 
+ *  Maps whole file associated with fp into memory for reading, pointer to the
+ *  mapped data is saved to data and it's length to size. Returns 0 if the file
+ *  can't be mapped (not a regular file, empty file or platform without mmap),
+ *  read_line has to be used instead.
+ */
+int map_file(FILE *fp, char **data, unsigned long *size) {
+#ifdef HAVE_POSIX
+    struct stat st;
+    void *p;
+    
+    if(fstat(fileno(fp), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+        return 0;
+    }
+    
+    p = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+    
+    if(p == MAP_FAILED) {
+        return 0;
+    }
+    
+    /* input is read only once from start to end */
+    posix_madvise(p, (size_t) st.st_size, POSIX_MADV_SEQUENTIAL);
+    
+    (*data) = (char *) p;
+    (*size) = (unsigned long) st.st_size;
+    
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/**
+ *  void unmap_file(char *data, unsigned long size)
+ * 
+ *  Releases memory mapped by map_file.
+ */
+void unmap_file(char *data, unsigned long size) {
+#ifdef HAVE_POSIX
+    munmap(data, (size_t) size);
+#endif
+}
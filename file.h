@@ -17,8 +17,13 @@
 void open_file(FILE **fp, char *name, char *mode);
 void close_file(FILE **fp);
 int read_line(FILE *fp, char *buff);
+unsigned long read_chunk(FILE *fp, char *buff, unsigned long carry, unsigned long size);
+int is_seekable(FILE *fp);
+int seek_file(FILE *fp, unsigned long offset);
 void write_line(FILE *fp, char *line);
 long get_file_size(FILE *fp);
+int map_file(FILE *fp, char **data, unsigned long *size);
+void unmap_file(char *data, unsigned long size);
 
 
 #endif	/* FILE_H */
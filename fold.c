@@ -0,0 +1,245 @@
+/*
+ *  Text analysis program
+ * 
+ *  File: fold.c
+ *  Converts whole buffers to lowercase before they are tokenized. Vector
+ *  kernels look up difference between each byte and it's lowercase
+ *  equivalent by low nibble in 16 byte rows of cp1250_fold, one row for
+ *  each high nibble that contains uppercase letters (ASCII and CP1250
+ *  alike), and add it to the byte. Kernel is chosen at runtime by CPU
+ *  features, scalar kernel using cp1250_fold is the fallback.
+ * 
+ *  Author: Martin Kucera, 2012
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "global.h"
+#include "cp1250_ctype.h"
+#include "fold.h"
+
+#ifdef HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/* Function prototypes */
+
+void fold_buffer_scalar(char *dst, const char *src, unsigned long len);
+
+/* kernel used by fold_buffer, the fastest one after fold_init */
+fold_func_t fold_kernel = fold_buffer_scalar;
+
+/**
+ *  void fold_buffer_scalar(char *dst, const char *src, unsigned long len)
+ * 
+ *  Scalar kernel, converts bytes one at a time using cp1250_fold.
+ */
+void fold_buffer_scalar(char *dst, const char *src, unsigned long len) {
+    unsigned long i;
+    
+    for(i = 0; i < len; i++) {
+        dst[i] = (char) cp1250_fold[(unsigned char) src[i]];
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+
+/**
+ *  int fold_rows(unsigned char *rows, unsigned char *deltas)
+ * 
+ *  Finds rows of cp1250_fold (high nibbles) with uppercase letters, saves
+ *  their high nibbles into rows and 16 differences to lowercase of each one
+ *  into deltas. Returns number of rows.
+ */
+int fold_rows(unsigned char *rows, unsigned char *deltas) {
+    int nrows = 0;
+    int h, l, c;
+    
+    for(h = 0; h < 16; h++) {
+        for(l = 0; l < 16 && cp1250_fold[h * 16 + l] == h * 16 + l; l++)
+            ;
+        
+        if(l == 16)
+            continue;
+        
+        for(l = 0; l < 16; l++) {
+            c = h * 16 + l;
+            deltas[nrows * 16 + l] = (unsigned char) (cp1250_fold[c] - c);
+        }
+        
+        rows[nrows++] = (unsigned char) h;
+    }
+    
+    return nrows;
+}
+
+/**
+ *  void fold_buffer_ssse3(char *dst, const char *src, unsigned long len)
+ * 
+ *  SSSE3 kernel, converts blocks of 16 bytes.
+ */
+__attribute__((target("ssse3")))
+void fold_buffer_ssse3(char *dst, const char *src, unsigned long len) {
+    unsigned char rows[16];
+    unsigned char deltas[256];
+    __m128i table[16];
+    __m128i row[16];
+    __m128i nibble = _mm_set1_epi8(0x0f);
+    __m128i v, lo, hi, delta;
+    unsigned long i = 0;
+    int nrows, r;
+    
+    nrows = fold_rows(rows, deltas);
+    
+    for(r = 0; r < nrows; r++) {
+        table[r] = _mm_loadu_si128((const __m128i *) (deltas + 16 * r));
+        row[r] = _mm_set1_epi8((char) rows[r]);
+    }
+    
+    for(; i + 16 <= len; i += 16) {
+        v = _mm_loadu_si128((const __m128i *) (src + i));
+        lo = _mm_and_si128(v, nibble);
+        hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+        delta = _mm_setzero_si128();
+        
+        for(r = 0; r < nrows; r++) {
+            delta = _mm_or_si128(delta, _mm_and_si128(_mm_cmpeq_epi8(hi, row[r]),
+                    _mm_shuffle_epi8(table[r], lo)));
+        }
+        
+        _mm_storeu_si128((__m128i *) (dst + i), _mm_add_epi8(v, delta));
+    }
+    
+    fold_buffer_scalar(dst + i, src + i, len - i);
+}
+
+/**
+ *  void fold_buffer_avx2(char *dst, const char *src, unsigned long len)
+ * 
+ *  AVX2 kernel, converts blocks of 32 bytes.
+ */
+__attribute__((target("avx2")))
+void fold_buffer_avx2(char *dst, const char *src, unsigned long len) {
+    unsigned char rows[16];
+    unsigned char deltas[256];
+    __m256i table[16];
+    __m256i row[16];
+    __m256i nibble = _mm256_set1_epi8(0x0f);
+    __m256i v, lo, hi, delta;
+    unsigned long i = 0;
+    int nrows, r;
+    
+    nrows = fold_rows(rows, deltas);
+    
+    for(r = 0; r < nrows; r++) {
+        table[r] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) (deltas + 16 * r)));
+        row[r] = _mm256_set1_epi8((char) rows[r]);
+    }
+    
+    for(; i + 32 <= len; i += 32) {
+        v = _mm256_loadu_si256((const __m256i *) (src + i));
+        lo = _mm256_and_si256(v, nibble);
+        hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+        delta = _mm256_setzero_si256();
+        
+        for(r = 0; r < nrows; r++) {
+            delta = _mm256_or_si256(delta, _mm256_and_si256(_mm256_cmpeq_epi8(hi, row[r]),
+                    _mm256_shuffle_epi8(table[r], lo)));
+        }
+        
+        _mm256_storeu_si256((__m256i *) (dst + i), _mm256_add_epi8(v, delta));
+    }
+    
+    fold_buffer_scalar(dst + i, src + i, len - i);
+}
+
+#endif
+
+/**
+ *  fold_func_t fold_best_kernel()
+ * 
+ *  Returns the fastest kernel supported by CPU.
+ */
+fold_func_t fold_best_kernel() {
+#ifdef HAVE_X86_SIMD
+    if(__builtin_cpu_supports("avx2"))
+        return fold_buffer_avx2;
+    
+    if(__builtin_cpu_supports("ssse3"))
+        return fold_buffer_ssse3;
+#endif
+    
+    return fold_buffer_scalar;
+}
+
+/**
+ *  void fold_init()
+ * 
+ *  Chooses the fastest kernel supported by CPU, called before any threads
+ *  start like scan_init.
+ */
+void fold_init() {
+    fold_kernel = fold_best_kernel();
+}
+
+/**
+ *  void fold_buffer(char *dst, const char *src, unsigned long len)
+ * 
+ *  Converts len bytes of src to lowercase and saves them into dst, which can
+ *  be the same buffer as src. Characters other than uppercase letters are
+ *  copied as they are.
+ */
+void fold_buffer(char *dst, const char *src, unsigned long len) {
+    fold_kernel(dst, src, len);
+}
+
+/**
+ *  int fold_set_kernel(const char *name)
+ * 
+ *  Sets kernel used by fold_buffer, name is auto, scalar, ssse3 or avx2.
+ *  Returns 0 if there's no such kernel or CPU doesn't support it. Not thread
+ *  safe, only benchmarks use it.
+ */
+int fold_set_kernel(const char *name) {
+    fold_func_t kernel = NULL;
+    
+    if(strcmp(name, "auto") == 0) {
+        kernel = fold_best_kernel();
+    }
+    else if(strcmp(name, "scalar") == 0) {
+        kernel = fold_buffer_scalar;
+    }
+#ifdef HAVE_X86_SIMD
+    else if(strcmp(name, "ssse3") == 0 && __builtin_cpu_supports("ssse3")) {
+        kernel = fold_buffer_ssse3;
+    }
+    else if(strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        kernel = fold_buffer_avx2;
+    }
+#endif
+    
+    if(kernel == NULL)
+        return 0;
+    
+    fold_kernel = kernel;
+    
+    return 1;
+}
+
+/**
+ *  const char *fold_kernel_name()
+ * 
+ *  Returns name of the kernel used by fold_buffer.
+ */
+const char *fold_kernel_name() {
+#ifdef HAVE_X86_SIMD
+    if(fold_kernel == fold_buffer_avx2)
+        return "avx2";
+    
+    if(fold_kernel == fold_buffer_ssse3)
+        return "ssse3";
+#endif
+    
+    return "scalar";
+}
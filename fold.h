@@ -0,0 +1,25 @@
+/*
+ *  Text analysis program
+ * 
+ *  File: fold.h
+ * 
+ *  Author: Martin Kucera, 2012
+ */
+
+#ifndef FOLD_H
+#define	FOLD_H
+
+/* Structures */
+
+/* folding kernel, see fold_buffer */
+typedef void (*fold_func_t)(char *dst, const char *src, unsigned long len);
+
+/* Function prototypes */
+
+void fold_init();
+void fold_buffer(char *dst, const char *src, unsigned long len);
+int fold_set_kernel(const char *name);
+const char *fold_kernel_name();
+
+
+#endif	/* FOLD_H */
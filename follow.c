@@ -0,0 +1,475 @@
+/*
+ *  Text analysis program
+ * 
+ *  File: follow.c
+ *  Following of a file which is being appended to, like a log. Words stay
+ *  in table and only bytes appended since the last check are parsed. Last
+ *  word of read bytes might not be complete yet, it's kept and parsed with
+ *  bytes appended after it. Stats are written periodically, together with
+ *  checkpoint of parsed bytes, so the next run resumes where this one
+ *  stopped. Rotated or truncated file is finished and the new one is
+ *  followed from it's beginning.
+ * 
+ *  Author: Martin Kucera, 2012
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+
+#include "global.h"
+#include "err.h"
+#include "file.h"
+#include "hash_table.h"
+#include "stat.h"
+#include "parser.h"
+#include "sort.h"
+#include "binstat.h"
+#include "follow.h"
+
+#ifdef HAVE_POSIX
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+/* set by SIGINT or SIGTERM, stats are saved and following ends */
+volatile sig_atomic_t follow_stop = 0;
+
+/**
+ *  void follow_stop_signal(int sig)
+ * 
+ *  Signal handler, stops following after the current check.
+ */
+void follow_stop_signal(int sig) {
+    follow_stop = 1;
+}
+
+/**
+ *  void follow_sleep(unsigned seconds)
+ * 
+ *  Waits given number of seconds or until following is stopped.
+ */
+void follow_sleep(unsigned seconds) {
+#ifdef HAVE_POSIX
+    sleep(seconds);
+#elif defined(_WIN32)
+    Sleep(seconds * 1000);
+#else
+    /* standard C can't sleep, time is only polled */
+    time_t start = time(NULL);
+    
+    while(!follow_stop && difftime(time(NULL), start) < seconds)
+        ;
+#endif
+}
+
+/**
+ *  char *follow_name(char *name, char *suffix)
+ * 
+ *  Returns new string of name followed by suffix, freed by caller.
+ */
+char *follow_name(char *name, char *suffix) {
+    char *s;
+    
+    if((s = (char *) malloc(strlen(name) + strlen(suffix) + 1)) == NULL) {
+        raise_error("Out of memory.");
+    }
+    
+    strcpy(s, name);
+    strcat(s, suffix);
+    
+    return s;
+}
+
+/**
+ *  void follow_identity(FILE *fp, unsigned long *dev, unsigned long *ino)
+ * 
+ *  Sets device and inode of file fp, file renamed by rotation keeps them
+ *  and the new one gets other. Both are 0 on platform without them, only
+ *  truncation is recognized there.
+ */
+void follow_identity(FILE *fp, unsigned long *dev, unsigned long *ino) {
+#ifdef HAVE_POSIX
+    struct stat st;
+    
+    if(fstat(fileno(fp), &st) == 0) {
+        (*dev) = (unsigned long) st.st_dev;
+        (*ino) = (unsigned long) st.st_ino;
+        return;
+    }
+#endif
+    
+    (*dev) = 0;
+    (*ino) = 0;
+}
+
+/**
+ *  void follow_replace(char *tmp, char *name)
+ * 
+ *  Renames completely written file tmp to name, so there's always a whole
+ *  previous or new file name.
+ */
+void follow_replace(char *tmp, char *name) {
+#ifndef HAVE_POSIX
+    /* rename doesn't replace existing file everywhere */
+    remove(name);
+#endif
+    
+    if(rename(tmp, name) != 0) {
+        raise_error("Couldn't replace stats file.");
+    }
+}
+
+/**
+ *  int follow_load(stats_t *st, follow_t *f)
+ * 
+ *  Loads stats and position of followed file from checkpoint of f into
+ *  empty st. Returns 0 if there's no checkpoint yet.
+ */
+int follow_load(stats_t *st, follow_t *f) {
+    FILE *fp;
+    follow_header_t header;
+    char *data;
+    unsigned long size;
+    
+    if((fp = fopen(f->checkpoint, "rb")) == NULL) {
+        return 0;
+    }
+    
+    size = (unsigned long) get_file_size(fp);
+    
+    /* carried bytes and stats follow header */
+    if(fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, FOLLOW_MAGIC, 4) != 0
+            || size < sizeof(header) || header.carry > size - sizeof(header)) {
+        raise_error("Not a checkpoint file.");
+    }
+    
+    while(header.carry >= f->size) {
+        f->size *= 2;
+        
+        if((f->buff = (char *) realloc(f->buff, f->size)) == NULL) {
+            raise_error("Out of memory.");
+        }
+    }
+    
+    if(fread(f->buff, 1, header.carry, fp) != header.carry) {
+        raise_error("Can't read checkpoint.");
+    }
+    
+    size -= sizeof(header) + header.carry;
+    
+    if((data = (char *) malloc(size + 1)) == NULL) {
+        raise_error("Out of memory.");
+    }
+    
+    if(fread(data, 1, size, fp) != size) {
+        raise_error("Can't read checkpoint.");
+    }
+    
+    close_file(&fp);
+    
+    binstat_check(data, size);
+    binstat_load_data(st, data);
+    free(data);
+    
+    f->offset = header.offset;
+    f->len = header.carry;
+    f->dev = header.dev;
+    f->ino = header.ino;
+    
+    return 1;
+}
+
+/**
+ *  void follow_write_stats(stats_t *st, FILE *checkpoint, FILE *output_file)
+ * 
+ *  Writes binary stats of all words of st to checkpoint, if it's given, and
+ *  text stats to output_file. Words are put back into insertion order and
+ *  letters to their indexes afterwards, more of them are added later.
+ */
+void follow_write_stats(stats_t *st, FILE *checkpoint, FILE *output_file) {
+    letter_t letters[L_FREQUENCY_SIZE];
+    word_t **words;
+    word_t *w = NULL;
+    unsigned long num = 0;
+    unsigned long top = sort_top_count;
+    
+    if((words = (word_t **) malloc(sizeof(word_t *) * (hash_count(st->word_table) + 1))) == NULL) {
+        raise_error("Out of memory.");
+    }
+    
+    hash_get_next(st->word_table, &w);
+    while(w != NULL) {
+        words[num++] = w;
+        hash_get_next(st->word_table, &w);
+    }
+    
+    if(st->l_frequency != NULL) {
+        memcpy(letters, st->l_frequency, sizeof(letters));
+    }
+    
+    if(checkpoint != NULL) {
+        /* checkpoint has all words even with --top, so it can be loaded */
+        sort_set_top(0);
+        binstat_write_stats(st, checkpoint);
+        sort_set_top(top);
+    }
+    
+    write_stats(st, output_file);
+    
+    sort_relink(&st->word_table, words, num);
+    
+    if(st->l_frequency != NULL) {
+        memcpy(st->l_frequency, letters, sizeof(letters));
+    }
+    
+    free(words);
+}
+
+/**
+ *  void follow_save(stats_t *st, follow_t *f)
+ * 
+ *  Writes checkpoint and text stats of st into temporary files and renames
+ *  them, checkpoint first. Crash before the second rename leaves older text
+ *  stats, they are written again after restart.
+ */
+void follow_save(stats_t *st, follow_t *f) {
+    follow_header_t header;
+    char *tmp_checkpoint = follow_name(f->checkpoint, ".tmp");
+    char *tmp_output = follow_name(f->output, ".tmp");
+    FILE *checkpoint, *output_file;
+    
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FOLLOW_MAGIC, 4);
+    header.offset = f->offset;
+    header.carry = f->len;
+    header.dev = f->dev;
+    header.ino = f->ino;
+    
+    open_file(&checkpoint, tmp_checkpoint, "wb");
+    open_file(&output_file, tmp_output, "wb");
+    
+    if(fwrite(&header, sizeof(header), 1, checkpoint) != 1
+            || (f->len > 0 && fwrite(f->buff, 1, f->len, checkpoint) != f->len)) {
+        raise_error("Can't write checkpoint.");
+    }
+    
+    follow_write_stats(st, checkpoint, output_file);
+    
+    close_file(&checkpoint);
+    close_file(&output_file);
+    
+    follow_replace(tmp_checkpoint, f->checkpoint);
+    follow_replace(tmp_output, f->output);
+    
+    free(tmp_checkpoint);
+    free(tmp_output);
+}
+
+/**
+ *  int follow_seek(FILE *fp, unsigned long offset)
+ * 
+ *  Moves fp to offset, returns 0 if the file is shorter than offset bytes.
+ */
+int follow_seek(FILE *fp, unsigned long offset) {
+    if(offset == 0)
+        return (seek_file(fp, 0) == 0);
+    
+    /* seek behind the end succeeds, the last byte before offset is read */
+    return (seek_file(fp, offset - 1) == 0 && getc(fp) != EOF);
+}
+
+/**
+ *  int follow_open(stats_t *st, follow_t *f)
+ * 
+ *  Opens followed file and moves behind the carried bytes, returns 0 if it
+ *  doesn't exist. File which isn't the one offset was saved for, or which
+ *  is shorter, is followed from it's beginning, carried bytes were the last
+ *  word of the previous file.
+ */
+int follow_open(stats_t *st, follow_t *f) {
+    unsigned long dev, ino;
+    
+    if((f->fp = fopen(f->name, "rb")) == NULL) {
+        return 0;
+    }
+    
+    follow_identity(f->fp, &dev, &ino);
+    
+    if(dev != f->dev || ino != f->ino || !follow_seek(f->fp, f->offset + f->len)) {
+        parse_buffer(st, f->buff, f->len);
+        f->len = 0;
+        f->offset = 0;
+        
+        if(!follow_seek(f->fp, 0)) {
+            raise_error("Error reading input.");
+        }
+    }
+    
+    f->dev = dev;
+    f->ino = ino;
+    
+    return 1;
+}
+
+/**
+ *  unsigned long follow_read(stats_t *st, follow_t *f)
+ * 
+ *  Reads and parses bytes appended to followed file, like process_stream.
+ *  Offset is moved behind the last delimiter. Returns number of read bytes.
+ */
+unsigned long follow_read(stats_t *st, follow_t *f) {
+    unsigned long read, cut;
+    unsigned long total = 0;
+    
+    if(f->fp == NULL)
+        return 0;
+    
+    while(!follow_stop && (read = read_chunk(f->fp, f->buff, f->len, f->size)) > 0) {
+        total += read;
+        f->len += read;
+        
+        cut = parse_boundary(f->buff, f->len);
+        parse_buffer(st, f->buff, cut);
+        f->offset += cut;
+        
+        f->len -= cut;
+        memmove(f->buff, f->buff + cut, f->len);
+        
+        if(f->len == f->size) {
+            f->size *= 2;
+            
+            if((f->buff = (char *) realloc(f->buff, f->size)) == NULL) {
+                raise_error("Out of memory.");
+            }
+        }
+    }
+    
+    /* end of file is reached again when more bytes are appended */
+    clearerr(f->fp);
+    
+    return total;
+}
+
+/**
+ *  int follow_rotated(follow_t *f)
+ * 
+ *  Returns 1 if followed file was renamed or removed, or was truncated.
+ */
+int follow_rotated(follow_t *f) {
+#ifdef HAVE_POSIX
+    struct stat st;
+    
+    if(stat(f->name, &st) != 0) {
+        return 1;
+    }
+    
+    if((unsigned long) st.st_dev != f->dev || (unsigned long) st.st_ino != f->ino) {
+        return 1;
+    }
+    
+    return ((unsigned long) st.st_size < f->offset + f->len);
+#else
+    /* position is behind the read bytes again unless it was truncated */
+    return !follow_seek(f->fp, f->offset + f->len);
+#endif
+}
+
+/**
+ *  void follow_close(stats_t *st, follow_t *f)
+ * 
+ *  Finishes rotated file, bytes written into it before rotation are read
+ *  and it's last word is complete now. Next file is followed from it's
+ *  beginning.
+ */
+void follow_close(stats_t *st, follow_t *f) {
+    follow_read(st, f);
+    parse_buffer(st, f->buff, f->len);
+    
+    fclose(f->fp);
+    f->fp = NULL;
+    
+    f->len = 0;
+    f->offset = 0;
+    f->dev = 0;
+    f->ino = 0;
+}
+
+/**
+ *  void follow_run(stats_t *st, char *input, char *output, unsigned interval)
+ * 
+ *  Follows file input until SIGINT or SIGTERM. Stats are written to output
+ *  every interval seconds when there were new bytes, checkpoint to output
+ *  with .ckpt suffix. When the checkpoint exists, stats are loaded from it
+ *  and input is followed from the saved offset.
+ */
+void follow_run(stats_t *st, char *input, char *output, unsigned interval) {
+    follow_t f;
+    time_t saved;
+    int dirty = 1;
+    
+    f.name = input;
+    f.fp = NULL;
+    f.dev = f.ino = f.offset = 0;
+    f.size = CBUFFSIZE;
+    f.len = 0;
+    f.output = output;
+    f.checkpoint = follow_name(output, ".ckpt");
+    
+    if((f.buff = (char *) malloc(f.size)) == NULL) {
+        raise_error("Out of memory.");
+    }
+    
+    if(follow_load(st, &f)) {
+        printf("Resuming from checkpoint at byte %lu ...\n", f.offset);
+    }
+    
+    signal(SIGINT, follow_stop_signal);
+    signal(SIGTERM, follow_stop_signal);
+    
+    printf("Following %s, saving stats every %u seconds ...\n", input, interval);
+    saved = time(NULL);
+    
+    while(!follow_stop) {
+        if(f.fp == NULL) {
+            follow_open(st, &f);
+        }
+        
+        if(follow_read(st, &f) > 0) {
+            dirty = 1;
+        }
+        
+        if(f.fp != NULL && !follow_stop && follow_rotated(&f)) {
+            printf("Input was rotated, following the new file ...\n");
+            follow_close(st, &f);
+            dirty = 1;
+            
+            continue;
+        }
+        
+        if(dirty && difftime(time(NULL), saved) >= interval) {
+            follow_save(st, &f);
+            saved = time(NULL);
+            dirty = 0;
+        }
+        
+        follow_sleep(FOLLOW_POLL);
+    }
+    
+    printf("Saving stats to: %s ...\n", output);
+    follow_save(st, &f);
+    
+    if(f.fp != NULL) {
+        fclose(f.fp);
+    }
+    
+    free(f.buff);
+    free(f.checkpoint);
+}
@@ -0,0 +1,70 @@
+/*
+ *  Text analysis program
+ * 
+ *  File: follow.h
+ * 
+ *  Author: Martin Kucera, 2012
+ */
+
+#ifndef FOLLOW_H
+#define	FOLLOW_H
+
+#include <stdio.h>
+#include "stat.h"
+
+/* First bytes of checkpoint file */
+#define FOLLOW_MAGIC "CSTF"
+/* Seconds between checks of followed file for appended bytes */
+#define FOLLOW_POLL 1
+
+/* Structures */
+
+/* beginning of checkpoint file, carried bytes and binary stats of parsed
+ * bytes follow it */
+typedef struct {
+    char magic[4];
+    /* bytes of followed file parsed, up to the last delimiter */
+    unsigned long offset;
+    /* bytes read after offset, last word is complete if the file is gone */
+    unsigned long carry;
+    /* identity of followed file, rotated file has another one */
+    unsigned long dev;
+    unsigned long ino;
+} follow_header_t;
+
+typedef struct {
+    /* followed file, NULL after rotation until the new one appears */
+    char *name;
+    FILE *fp;
+    unsigned long dev;
+    unsigned long ino;
+    unsigned long offset;
+    
+    /* bytes read after offset, the last word might not be complete yet */
+    char *buff;
+    unsigned long size;
+    unsigned long len;
+    
+    /* text stats and checkpoint, written into temporary file and renamed */
+    char *output;
+    char *checkpoint;
+} follow_t;
+
+/* Function prototypes */
+
+void follow_stop_signal(int sig);
+void follow_sleep(unsigned seconds);
+char *follow_name(char *name, char *suffix);
+void follow_identity(FILE *fp, unsigned long *dev, unsigned long *ino);
+void follow_replace(char *tmp, char *name);
+int follow_load(stats_t *st, follow_t *f);
+void follow_write_stats(stats_t *st, FILE *checkpoint, FILE *output_file);
+void follow_save(stats_t *st, follow_t *f);
+int follow_seek(FILE *fp, unsigned long offset);
+int follow_open(stats_t *st, follow_t *f);
+unsigned long follow_read(stats_t *st, follow_t *f);
+int follow_rotated(follow_t *f);
+void follow_close(stats_t *st, follow_t *f);
+void follow_run(stats_t *st, char *input, char *output, unsigned interval);
+
+#endif	/* FOLLOW_H */
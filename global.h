@@ -10,9 +10,52 @@
 #ifndef GLOBAL_H
 #define	GLOBAL_H
 
+#include <limits.h>
+
 /* Output buffer size */
 #define OBUFFSIZE 512
 /* Line buffer size */
 #define LBUFFSIZE 2048
+/* Size of window converted to lowercase at once by parser */
+#define FBUFFSIZE 16384
+/* Chunk buffer size for streamed input */
+#define CBUFFSIZE 1048576
+/* Size of slabs of word arena */
+#define ASLABSIZE 1048576
+/* Size of CPU cache line, short words are aligned to it */
+#define CACHE_LINE 64
+/* Largest read buffer of each segment merged from disk, see spill.c */
+#define SBUFFSIZE 65536
+/* Number of chunk buffers in reader/parser pipeline */
+#define PBUFFNUM 4
+
+/* POSIX only features (memory mapped input, threads) */
+#if defined(__unix__) || defined(__unix) || (defined(__APPLE__) && defined(__MACH__))
+#define HAVE_POSIX
+#endif
+
+/* Counting of bytes touched by parser, shown by benchmarks when built with
+ * -DCOUNT_TOUCHES. Counter isn't thread safe, it's meant for one thread. */
+#ifdef COUNT_TOUCHES
+extern unsigned long touched_bytes;
+#define TOUCH(n) (touched_bytes += (n))
+#else
+#define TOUCH(n)
+#endif
+
+/* x86 vector kernels, chosen at runtime by CPU features (GCC and Clang) */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD
+#endif
+
+/* word-at-a-time hash, needs 64-bit unsigned long */
+#if ULONG_MAX > 0xffffffffUL
+#define HAVE_HASH_WY
+#endif
+
+/* 128-bit product of two unsigned longs (GCC and Clang) */
+#if defined(__GNUC__) && defined(__SIZEOF_INT128__)
+#define HAVE_INT128
+#endif
 
 #endif	/* GLOBAL_H */
@@ -3,12 +3,31 @@
  * 
  *  File: hash_table.c
  *  A hash table using separate chaining. Stores structures word_t containing
- *  word's key and it's count. Table expands when in any of it's
- *  buckets is more than BUCKET_NUM_TRESH items. Maximum number of buckets is 
- *  set using BUCKET_NUM_MAX, there will be no more expands when this number is
- *  reached. When expand is in progress and new bucket size would exceed this 
- *  limit, new bucket count is set to BUCKET_NUM_MAX. During expand all items
- *  are reindexed and placed into new table.
+ *  word's key and it's count. Table doubles it's bucket count when there's
+ *  more than BUCKET_LOAD_MAX items per bucket on average, so chains stay
+ *  short for any number of items. During expand all items are reindexed and
+ *  placed into new table.
+ * 
+ *  Alternatively table can use open addressing (HASH_OPEN engine). Items are
+ *  then kept in one array of slots with linear probing, next to it is an array
+ *  with one byte fingerprint of hash for each slot, so most probes are
+ *  resolved without touching items. Open table doubles when it's more than
+ *  7/8 full. Items of both engines are linked in insertion order, so
+ *  iteration and sorting are the same. Sizes are unsigned long, tables of
+ *  both engines grow up to HASH_COUNT_MAX.
+ * 
+ *  Keys are hashed by hash_func, byte at a time hash_jen or hash_wy, which
+ *  reads 8 bytes at a time and is available where unsigned long has 64 bits.
+ *  Both start from hash_seed, which can be random for each run, so colliding
+ *  keys can't be prepared in advance. If keys collide anyway, items of
+ *  chains longer than HASH_CHAIN_MAX (or probe runs longer than
+ *  HASH_PROBE_MAX) go into AVL tree of the table, ordered by hash and key.
+ * 
+ *  Both engines normally resize at once, moving all items during one insert.
+ *  With HASH_REHASH_INCREMENTAL the old arrays are kept next to the new ones
+ *  instead and every following insert or lookup moves HASH_MIGRATE_STEP of
+ *  old buckets or slots, items not moved yet are looked up in old arrays. No
+ *  single insert then has to wait for the whole table to be moved.
  * 
  *  Inspired by uthash, rewritten and simplified
  * 
@@ -22,25 +41,86 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <math.h>
+#include <time.h>
 
 #include "err.h"
+#include "global.h"
 #include "hash_table.h"
 
+#ifdef HAVE_POSIX
+#include <pthread.h>
+#endif
+
 /* starting bucket size */
 unsigned BUCKET_INIT_COUNT = 32;
-/* table expand flag */
-unsigned FLAG_EXPAND = 1;
+
+/* engine of new tables, open addressing is chosen by --table open */
+int hash_engine = HASH_CHAINED;
+
+/* resize mode of all tables */
+int hash_rehash = HASH_REHASH_FULL;
+
+/* hash function of keys, parser computes hash_jen while it reads the word,
+ * wy is chosen by --hash wy */
+hash_func_t hash_func = hash_jen;
+
+/* seed of hash_func, see hash_set_seed */
+unsigned long hash_seed = 0;
+
+/* items of long chains go into overflow tree, see hash_set_fallback */
+int hash_fallback = 1;
+
+#ifdef HAVE_HASH_WY
+/* secrets of wyhash */
+#define HASH_WY_P0 0x2d358dccaa6c78a5UL
+#define HASH_WY_P1 0x8bb84b93962eacc9UL
+#endif
+
+/* emptied tables kept for reuse, see hash_recycle_table */
+hash_table_t *table_pool = NULL;
+#ifdef HAVE_POSIX
+pthread_mutex_t table_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
 
 /** void hash_set_count(long count)
  * 
  *  Sets the initial bucket count, similiar to hash_guess_count, but sets the
- *  number directly
+ *  number directly. Count is rounded up to a power of two.
  */
 void hash_set_count(long count) {
-    if(count == 0 || count > BUCKET_NUM_MAX) 
+    unsigned long count_u = 1;
+    
+    if(count <= 0 || (unsigned long) count > HASH_COUNT_MAX) 
         return;
     
-    BUCKET_INIT_COUNT = count;
+    /* index is masked by count - 1, it has to be a power of two */
+    while(count_u < (unsigned long) count) {
+        count_u *= 2;
+    }
+    
+    BUCKET_INIT_COUNT = count_u;
+}
+
+/**
+ *  void hash_set_engine(int engine)
+ * 
+ *  Sets engine of new tables, HASH_CHAINED or HASH_OPEN. Recycled tables
+ *  are freed, they could use the other engine.
+ */
+void hash_set_engine(int engine) {
+    hash_engine = engine;
+    
+    hash_free_pool();
+}
+
+/**
+ *  void hash_set_rehash(int mode)
+ * 
+ *  Sets resize mode of tables, HASH_REHASH_FULL or HASH_REHASH_INCREMENTAL.
+ *  Resize already in progress is finished in it's original mode.
+ */
+void hash_set_rehash(int mode) {
+    hash_rehash = mode;
 }
 
 /**
@@ -77,29 +157,218 @@ void hash_guess_count(long count) {
     hash_set_count(count_u);
 }
 
-/** unsigned long hash_jen(char *key, unsigned len)
+/** unsigned long hash_jen(const char *key, unsigned len)
  * 
  *  Basic non-cryptographic hashing function for strings
  *  called one-at-a-time taken from wikipedia (designed by Bob Jenkins),
- *  takes a string and it's length as parameters.
+ *  takes a string and it's length as parameters. Same hash can be computed
+ *  incrementally with HASH_JEN_STEP and HASH_JEN_END.
  */
-unsigned long hash_jen(char *key, unsigned len) {
+unsigned long hash_jen(const char *key, unsigned len) {
     unsigned i;
     unsigned long hash;
     
-    for(hash = i = 0; i < len; i++) {
-      hash += key[i];
-	    hash += (hash << 10);
-	    hash ^= (hash >> 6);
+    for(hash = hash_seed, i = 0; i < len; i++) {
+        HASH_JEN_STEP(hash, key[i]);
     }
-
-    hash += (hash << 3);
-    hash ^= (hash >> 11);
-    hash += (hash << 15);
+    
+    HASH_JEN_END(hash);
+    
+    TOUCH(len);
 
     return hash;
 }
 
+#ifdef HAVE_HASH_WY
+
+/**
+ *  void hash_wy_mum(unsigned long *a, unsigned long *b)
+ * 
+ *  Multiplies a by b, saves lower half of 128-bit product into a and upper
+ *  half into b.
+ */
+void hash_wy_mum(unsigned long *a, unsigned long *b) {
+#ifdef HAVE_INT128
+    __extension__ typedef unsigned __int128 hash_u128_t;
+    hash_u128_t r = (hash_u128_t) (*a) * (*b);
+    
+    *a = (unsigned long) r;
+    *b = (unsigned long) (r >> 64);
+#else
+    unsigned long ha = *a >> 32, la = *a & 0xffffffffUL;
+    unsigned long hb = *b >> 32, lb = *b & 0xffffffffUL;
+    unsigned long rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    unsigned long t = rl + (rm0 << 32);
+    unsigned long c = (t < rl);
+    unsigned long lo = t + (rm1 << 32);
+    
+    c += (lo < t);
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+/**
+ *  unsigned long hash_wy_mix(unsigned long a, unsigned long b)
+ * 
+ *  Mixes a and b into one value, both halves of their product are xored.
+ */
+unsigned long hash_wy_mix(unsigned long a, unsigned long b) {
+    hash_wy_mum(&a, &b);
+    
+    return a ^ b;
+}
+
+/**
+ *  unsigned long hash_wy_r8(const unsigned char *p)
+ * 
+ *  Reads 8 bytes from p in native byte order, p doesn't have to be aligned.
+ */
+unsigned long hash_wy_r8(const unsigned char *p) {
+    unsigned long v;
+    
+    memcpy(&v, p, 8);
+    
+    return v;
+}
+
+/**
+ *  unsigned long hash_wy_r4(const unsigned char *p)
+ * 
+ *  Reads 4 bytes from p in native byte order, p doesn't have to be aligned.
+ */
+unsigned long hash_wy_r4(const unsigned char *p) {
+    unsigned int v;
+    
+    memcpy(&v, p, 4);
+    
+    return v;
+}
+
+/** unsigned long hash_wy(const char *key, unsigned len)
+ * 
+ *  Word-at-a-time hash for strings, wyhash (final version 4, by Wang Yi)
+ *  without it's 48 byte loop, words are short. Key is read 8 bytes at a
+ *  time, keys up to 16 bytes by two overlapping reads, so no byte after
+ *  it is touched. Each step is one 64x64 bit multiplication, results
+ *  differ on big and little endian machines.
+ */
+unsigned long hash_wy(const char *key, unsigned len) {
+    const unsigned char *p = (const unsigned char *) key;
+    unsigned long a, b;
+    unsigned long seed = hash_seed ^ hash_wy_mix(hash_seed ^ HASH_WY_P0, HASH_WY_P1);
+    unsigned i = len;
+    
+    if(len <= 16) {
+        if(len >= 4) {
+            a = (hash_wy_r4(p) << 32) | hash_wy_r4(p + ((len >> 3) << 2));
+            b = (hash_wy_r4(p + len - 4) << 32) | hash_wy_r4(p + len - 4 - ((len >> 3) << 2));
+        }
+        else if(len > 0) {
+            a = ((unsigned long) p[0] << 16) | ((unsigned long) p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        }
+        else {
+            a = b = 0;
+        }
+    }
+    else {
+        while(i > 16) {
+            seed = hash_wy_mix(hash_wy_r8(p) ^ HASH_WY_P1, hash_wy_r8(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        
+        a = hash_wy_r8(p + i - 16);
+        b = hash_wy_r8(p + i - 8);
+    }
+    
+    TOUCH(len);
+    
+    a ^= HASH_WY_P1;
+    b ^= seed;
+    hash_wy_mum(&a, &b);
+    
+    return hash_wy_mix(a ^ HASH_WY_P0 ^ len, b ^ HASH_WY_P1);
+}
+
+#endif
+
+/**
+ *  int hash_set_func(const char *name)
+ * 
+ *  Sets hash function of keys, name is jen or wy. Returns 0 if there's no
+ *  such function in this build. Has to be set before any table is filled,
+ *  items keep hashes they were inserted with.
+ */
+int hash_set_func(const char *name) {
+    if(strcmp(name, "jen") == 0) {
+        hash_func = hash_jen;
+        return 1;
+    }
+    
+#ifdef HAVE_HASH_WY
+    if(strcmp(name, "wy") == 0) {
+        hash_func = hash_wy;
+        return 1;
+    }
+#endif
+    
+    return 0;
+}
+
+/**
+ *  void hash_set_seed(unsigned long seed)
+ * 
+ *  Sets seed of hash functions. Has to be set before any table is filled,
+ *  like hash_set_func.
+ */
+void hash_set_seed(unsigned long seed) {
+    hash_seed = seed;
+}
+
+/**
+ *  unsigned long hash_random_seed()
+ * 
+ *  Returns random seed, read from /dev/urandom on POSIX systems, made of
+ *  current time otherwise.
+ */
+unsigned long hash_random_seed() {
+    unsigned long seed = (unsigned long) time(NULL) ^ ((unsigned long) clock() << 16);
+#ifdef HAVE_POSIX
+    unsigned long urandom;
+    FILE *fp = fopen("/dev/urandom", "rb");
+    
+    if(fp) {
+        if(fread(&urandom, sizeof(urandom), 1, fp) == 1)
+            seed ^= urandom;
+        
+        fclose(fp);
+    }
+#endif
+    
+    return seed;
+}
+
+/**
+ *  void hash_set_fallback(int on)
+ * 
+ *  Turns overflow trees of long chains on or off. Off only for benchmarks,
+ *  which show what colliding keys cost without them.
+ */
+void hash_set_fallback(int on) {
+    hash_fallback = on;
+}
+
+/**
+ *  const char *hash_func_name()
+ * 
+ *  Returns name of hash function of keys.
+ */
+const char *hash_func_name() {
+    return (hash_func == hash_jen) ? "jen" : "wy";
+}
+
 /** unsigned long hash_get_index(unsigned long hash, unsigned long table_size)
  * 
  *  Returns bucket index based on given hash and table size.
@@ -108,6 +377,16 @@ unsigned long hash_get_index(unsigned long hash, unsigned long table_size) {
     return ((hash) & (table_size - 1));
 }
 
+/** unsigned hash_partition(unsigned long hash, unsigned parts)
+ * 
+ *  Splits hashes into given number of partitions. Bits of spread hash are
+ *  used, not the ones of hash_get_index, so items of one partition are still
+ *  spread over all buckets of a table of any size.
+ */
+unsigned hash_partition(unsigned long hash, unsigned parts) {
+    return (unsigned) ((HASH_SPREAD(hash) >> 24) & 0xff) % parts;
+}
+
 /**
  *  void hash_create_table(word_t *head)
  * 
@@ -115,9 +394,31 @@ unsigned long hash_get_index(unsigned long hash, unsigned long table_size) {
  *  Stores tail reference for fast append to the list of items.
  *  Allocates memory for table itself and it's number of buckets,
  *  which is set by BUCKET_INIT_COUNT and sets all bytes of allocated
- *  space to zeros.
+ *  space to zeros. Previously recycled table is used instead if there's
+ *  any, keeping it's bucket count.
  */
 void hash_create_table(word_t *head) {
+#ifdef HAVE_POSIX
+    pthread_mutex_lock(&table_pool_lock);
+#endif
+    
+    (head)->hh.table = table_pool;
+    
+    if(table_pool) {
+        table_pool = table_pool->pool_next;
+    }
+    
+#ifdef HAVE_POSIX
+    pthread_mutex_unlock(&table_pool_lock);
+#endif
+    
+    if((head)->hh.table) {
+        (head)->hh.table->num = 0;
+        (head)->hh.table->tail = &((head)->hh);
+        
+        return;
+    }
+    
     (head)->hh.table = (hash_table_t *) malloc(sizeof(hash_table_t));
 
     if(!(head)->hh.table) {
@@ -126,8 +427,26 @@ void hash_create_table(word_t *head) {
     
     (head)->hh.table->count = BUCKET_INIT_COUNT;
     (head)->hh.table->num = 0;
+    (head)->hh.table->engine = hash_engine;
     (head)->hh.table->tail = &((head)->hh);
     (head)->hh.table->hhoffset = offsetof(word_t, hh); /* offset of hash_handle inside of inserted item */
+    (head)->hh.table->buckets = NULL;
+    (head)->hh.table->ctrl = NULL;
+    (head)->hh.table->slots = NULL;
+    (head)->hh.table->old_buckets = NULL;
+    (head)->hh.table->old_ctrl = NULL;
+    (head)->hh.table->old_slots = NULL;
+    (head)->hh.table->old_count = 0;
+    (head)->hh.table->migrated = 0;
+    (head)->hh.table->tree = NULL;
+    (head)->hh.table->tree_num = 0;
+    
+    if(hash_engine == HASH_OPEN) {
+        hash_open_alloc((head)->hh.table);
+        
+        return;
+    }
+    
     (head)->hh.table->buckets = (hash_bucket_t *) malloc(sizeof(hash_bucket_t) * BUCKET_INIT_COUNT);
     
     if(!(head)->hh.table->buckets) {
@@ -137,12 +456,142 @@ void hash_create_table(word_t *head) {
     memset((head)->hh.table->buckets, 0, sizeof(hash_bucket_t) * BUCKET_INIT_COUNT);    
 }
 
+/**
+ *  void hash_open_alloc(hash_table_t *table)
+ * 
+ *  Allocates empty arrays of fingerprints and slots of open table with count
+ *  slots.
+ */
+void hash_open_alloc(hash_table_t *table) {
+    /* large zeroed blocks come straight from the system, pages are cleared
+     * when they are touched, not all at once */
+    table->ctrl = (unsigned char *) calloc(table->count, 1);
+    table->slots = (hash_handle_t **) malloc(sizeof(hash_handle_t *) * table->count);
+    
+    if(!table->ctrl || !table->slots) {
+        raise_error("Out of memory.");
+    }
+}
+
+/**
+ *  void hash_open_place(hash_table_t *table, hash_handle_t *hh)
+ * 
+ *  Puts item into the first empty slot of open table from it's home index,
+ *  there has to be one. If it's more than HASH_PROBE_MAX slots away, item
+ *  goes into overflow tree instead.
+ */
+void hash_open_place(hash_table_t *table, hash_handle_t *hh) {
+    unsigned long mask = table->count - 1;
+    unsigned long i = hash_get_index(hh->hash, table->count);
+    unsigned long probes = 0;
+    
+    while(table->ctrl[i]) {
+        i = (i + 1) & mask;
+        
+        if(++probes >= HASH_PROBE_MAX && hash_fallback) {
+            hash_tree_add(table, hh);
+            return;
+        }
+    }
+    
+    table->ctrl[i] = HASH_FINGERPRINT(hh->hash);
+    table->slots[i] = hh;
+}
+
+/**
+ *  void hash_open_grow(hash_table_t *table)
+ * 
+ *  Doubles number of slots of open table and places all items again, their
+ *  hashes are stored, so keys aren't hashed again. In incremental mode old
+ *  arrays are only kept for hash_migrate.
+ */
+void hash_open_grow(hash_table_t *table) {
+    unsigned char *ctrl = table->ctrl;
+    hash_handle_t **slots = table->slots;
+    unsigned long count = table->count;
+    unsigned long i;
+    
+    if(table->count >= HASH_COUNT_MAX) {
+        raise_error("Too many items in hash table.");
+    }
+    
+    table->count *= 2;
+    hash_open_alloc(table);
+    
+    if(hash_rehash == HASH_REHASH_INCREMENTAL) {
+        table->old_ctrl = ctrl;
+        table->old_slots = slots;
+        table->old_count = count;
+        table->migrated = 0;
+        
+        return;
+    }
+    
+    for(i = 0; i < count; i++) {
+        if(ctrl[i]) {
+            hash_open_place(table, slots[i]);
+        }
+    }
+    
+    free(ctrl);
+    free(slots);
+}
+
+/**
+ *  void hash_open_probe(hash_table_t *table, unsigned char *ctrl, hash_handle_t **slots, unsigned long count, char *key, unsigned keylen, unsigned long hash, word_t **out)
+ * 
+ *  Finds key in given arrays of open table with count slots, probes slots
+ *  from it's home index up to the first empty one. Items are compared only
+ *  if their fingerprint matches.
+ */
+void hash_open_probe(hash_table_t *table, unsigned char *ctrl, hash_handle_t **slots, unsigned long count, char *key, unsigned keylen, unsigned long hash, word_t **out) {
+    unsigned long mask = count - 1;
+    unsigned long i = hash_get_index(hash, count);
+    unsigned char fp = HASH_FINGERPRINT(hash);
+    hash_handle_t *hh;
+    
+    while(ctrl[i]) {
+        if(ctrl[i] == fp) {
+            hh = slots[i];
+            
+            if(hh->hash == hash && hh->keylen == keylen) {
+                (*out) = hash_elmt_from_hh(table, hh);
+                TOUCH(keylen);
+                
+                if(memcmp(WORD_KEY(*out), key, keylen) == 0) {
+                    return;
+                }
+            }
+        }
+        
+        i = (i + 1) & mask;
+    }
+    
+    (*out) = NULL;
+}
+
+/**
+ *  void hash_open_find(hash_table_t *table, char *key, unsigned keylen, unsigned long hash, word_t **out)
+ * 
+ *  Finds key in open table. During incremental resize items which weren't
+ *  moved yet are found in old arrays. Moved items stay in old slots too, but
+ *  they are found in new ones first.
+ */
+void hash_open_find(hash_table_t *table, char *key, unsigned keylen, unsigned long hash, word_t **out) {
+    hash_open_probe(table, table->ctrl, table->slots, table->count, key, keylen, hash, out);
+    
+    if(!(*out) && table->old_count) {
+        hash_open_probe(table, table->old_ctrl, table->old_slots, table->old_count, key, keylen, hash, out);
+    }
+}
+
 /**
  *  void hash_expand_buckets(hash_table_t *table)
  * 
- *  Called when one of the buckets exceeds BUCKET_NUM_TRESH and it's noexpand flag
- *  is not set. Doubles the previous size of buckets, recalculates new bucket indexes
- *  for each item in old table and frees the old bucket space.
+ *  Called when chained table is overloaded. Doubles the previous size of
+ *  buckets, recalculates new bucket indexes
+ *  for each item in old table and frees the old bucket space. In incremental
+ *  mode old buckets are only kept for hash_migrate.
  */
 void hash_expand_buckets(hash_table_t *table) {
     /* bucket index in original buckets */
@@ -153,31 +602,30 @@ void hash_expand_buckets(hash_table_t *table) {
     hash_handle_t *nhh;
     /* pointer to the newly allocated space for buckets */
     hash_bucket_t *new_buckets;
-    /* new bucket in buckets_new */
-    hash_bucket_t *new_bucket;
     /* new bucket size */
     unsigned long new_bucket_count;
     
-    new_bucket_count = 2 * table->count;
-    
-    if(new_bucket_count > BUCKET_NUM_MAX)
-        new_bucket_count = BUCKET_NUM_MAX;
-    
-    /* if current table size is >= than max. number of buckets
-     * set FLAG_EXPAND to zero and return
-     */
-    if((table->count >= BUCKET_NUM_MAX)) {
-        FLAG_EXPAND = 0;
-        return;
+    if(table->count >= HASH_COUNT_MAX) {
+        raise_error("Too many items in hash table.");
     }
-
-    new_buckets = (hash_bucket_t *) malloc((sizeof(hash_bucket_t) * new_bucket_count));
+    
+    new_bucket_count = 2 * table->count;
+    new_buckets = (hash_bucket_t *) calloc(new_bucket_count, sizeof(hash_bucket_t));
     
     if(!new_buckets) {
         raise_error("Out of memory.");
     }
     
-    memset(new_buckets, 0, (sizeof(hash_bucket_t) * new_bucket_count));
+    if(hash_rehash == HASH_REHASH_INCREMENTAL) {
+        table->old_buckets = table->buckets;
+        table->old_count = table->count;
+        table->migrated = 0;
+        
+        table->count = new_bucket_count;
+        table->buckets = new_buckets;
+        
+        return;
+    }
     
     /* go through all buckets and reindex each item in bucket to the newly allocated space */
     for(bkt_i = 0; bkt_i < table->count; bkt_i++) {
@@ -185,27 +633,62 @@ void hash_expand_buckets(hash_table_t *table) {
         
         while(chh) {
             nhh = chh->next;
-            new_bucket = &(new_buckets[hash_get_index(chh->hash, table->count * 2)]);
-            
-            new_bucket->num++;
-            
-            if(new_bucket->num >= BUCKET_NUM_TRESH) {
-                new_bucket->noexpand = 1;                
-            }
-            
-            chh->next = new_bucket->head;
-            new_bucket->head = chh;
-            
+            hash_add_to_bkt(&(new_buckets[hash_get_index(chh->hash, new_bucket_count)]), chh);
             chh = nhh;
         }
     }
     
     free(table->buckets);
     
-    table->count *= 2;
+    table->count = new_bucket_count;
     table->buckets = new_buckets;
 }
 
+/**
+ *  void hash_migrate(hash_table_t *table, unsigned long steps)
+ * 
+ *  Moves items of next steps old buckets or slots into current arrays during
+ *  incremental resize. Old arrays are freed after the last one is moved.
+ */
+void hash_migrate(hash_table_t *table, unsigned long steps) {
+    hash_handle_t *chh;
+    hash_handle_t *nhh;
+    unsigned long end = table->migrated + steps;
+    
+    if(end > table->old_count)
+        end = table->old_count;
+    
+    for(; table->migrated < end; table->migrated++) {
+        if(table->engine == HASH_OPEN) {
+            if(table->old_ctrl[table->migrated]) {
+                hash_open_place(table, table->old_slots[table->migrated]);
+            }
+            
+            continue;
+        }
+        
+        chh = table->old_buckets[table->migrated].head;
+        
+        while(chh) {
+            nhh = chh->next;
+            hash_add_to_bkt(&(table->buckets[hash_get_index(chh->hash, table->count)]), chh);
+            chh = nhh;
+        }
+    }
+    
+    if(table->migrated < table->old_count)
+        return;
+    
+    free(table->old_buckets);
+    free(table->old_ctrl);
+    free(table->old_slots);
+    
+    table->old_buckets = NULL;
+    table->old_ctrl = NULL;
+    table->old_slots = NULL;
+    table->old_count = 0;
+}
+
 /** 
  *  void hash_add_to_bkt(hash_bucket_t *bkt, hash_handle_t *hh)
  * 
@@ -213,14 +696,192 @@ void hash_expand_buckets(hash_table_t *table) {
  *  first item inserted into bucket becomes last item in the linked list.
  */
 void hash_add_to_bkt(hash_bucket_t *bkt, hash_handle_t *hh) {
-    bkt->num++;
-    
     hh->next = bkt->head;
     bkt->head = hh;
+}
+
+/**
+ *  int hash_chain_long(hash_bucket_t *bkt)
+ * 
+ *  Returns 1 if there's HASH_CHAIN_MAX items in bucket already, walks at
+ *  most that many of them.
+ */
+int hash_chain_long(hash_bucket_t *bkt) {
+    hash_handle_t *hh = bkt->head;
+    int n = 0;
+    
+    while(hh && n < HASH_CHAIN_MAX) {
+        hh = hh->next;
+        n++;
+    }
+    
+    return n >= HASH_CHAIN_MAX;
+}
+
+/**
+ *  int hash_tree_cmp(hash_table_t *table, hash_handle_t *hh, const char *key, unsigned keylen, unsigned long hash)
+ * 
+ *  Compares key with item of tree, by hash, then by length and bytes of
+ *  keys, so even keys with the same hash are ordered.
+ */
+int hash_tree_cmp(hash_table_t *table, hash_handle_t *hh, const char *key, unsigned keylen, unsigned long hash) {
+    if(hash != hh->hash)
+        return (hash < hh->hash) ? -1 : 1;
+    
+    if(keylen != hh->keylen)
+        return (keylen < hh->keylen) ? -1 : 1;
+    
+    TOUCH(keylen);
     
-    if(bkt->num >= BUCKET_NUM_TRESH && bkt->noexpand == 0 && FLAG_EXPAND) {
-        hash_expand_buckets(hh->table);
+    return memcmp(key, WORD_KEY(hash_elmt_from_hh(table, hh)), keylen);
+}
+
+/* Height of AVL subtree, 0 if it's empty */
+#define HASH_TREE_H(node) ((node) ? (node)->height : 0)
+
+/**
+ *  hash_tree_t *hash_tree_rotate(hash_tree_t *node, int right)
+ * 
+ *  Rotates subtree right or left, returns it's new root.
+ */
+hash_tree_t *hash_tree_rotate(hash_tree_t *node, int right) {
+    hash_tree_t *top = (right) ? node->left : node->right;
+    
+    if(right) {
+        node->left = top->right;
+        top->right = node;
+    }
+    else {
+        node->right = top->left;
+        top->left = node;
     }
+    
+    node->height = 1 + ((HASH_TREE_H(node->left) > HASH_TREE_H(node->right)) ? HASH_TREE_H(node->left) : HASH_TREE_H(node->right));
+    top->height = 1 + ((HASH_TREE_H(top->left) > HASH_TREE_H(top->right)) ? HASH_TREE_H(top->left) : HASH_TREE_H(top->right));
+    
+    return top;
+}
+
+/**
+ *  hash_tree_t *hash_tree_balance(hash_tree_t *node)
+ * 
+ *  Restores AVL balance of subtree after insert into one of it's children,
+ *  returns it's new root.
+ */
+hash_tree_t *hash_tree_balance(hash_tree_t *node) {
+    int diff = HASH_TREE_H(node->left) - HASH_TREE_H(node->right);
+    
+    if(diff > 1) {
+        if(HASH_TREE_H(node->left->left) < HASH_TREE_H(node->left->right))
+            node->left = hash_tree_rotate(node->left, 0);
+        
+        return hash_tree_rotate(node, 1);
+    }
+    
+    if(diff < -1) {
+        if(HASH_TREE_H(node->right->right) < HASH_TREE_H(node->right->left))
+            node->right = hash_tree_rotate(node->right, 1);
+        
+        return hash_tree_rotate(node, 0);
+    }
+    
+    node->height = 1 + ((diff > 0) ? HASH_TREE_H(node->left) : HASH_TREE_H(node->right));
+    
+    return node;
+}
+
+/**
+ *  hash_tree_t *hash_tree_insert(hash_table_t *table, hash_tree_t *node, hash_tree_t *item)
+ * 
+ *  Inserts item into subtree, returns it's new root. Depth of recursion is
+ *  the height of AVL tree, logarithm of it's size.
+ */
+hash_tree_t *hash_tree_insert(hash_table_t *table, hash_tree_t *node, hash_tree_t *item) {
+    if(!node)
+        return item;
+    
+    if(hash_tree_cmp(table, node->hh, WORD_KEY(hash_elmt_from_hh(table, item->hh)), item->hh->keylen, item->hh->hash) < 0) {
+        node->left = hash_tree_insert(table, node->left, item);
+    }
+    else {
+        node->right = hash_tree_insert(table, node->right, item);
+    }
+    
+    return hash_tree_balance(node);
+}
+
+/**
+ *  void hash_tree_add(hash_table_t *table, hash_handle_t *hh)
+ * 
+ *  Puts item into overflow tree of table instead of it's chain or probe run,
+ *  which reached the limit. Cost of insert and lookup is then logarithmic
+ *  even if all keys have the same hash.
+ */
+void hash_tree_add(hash_table_t *table, hash_handle_t *hh) {
+    hash_tree_t *item;
+    
+    if((item = (hash_tree_t *) malloc(sizeof(hash_tree_t))) == NULL) {
+        raise_error("Out of memory.");
+    }
+    
+    item->hh = hh;
+    item->left = item->right = NULL;
+    item->height = 1;
+    
+    table->tree = hash_tree_insert(table, table->tree, item);
+    table->tree_num++;
+}
+
+/**
+ *  void hash_tree_find(hash_table_t *table, const char *key, unsigned keylen, unsigned long hash, word_t **out)
+ * 
+ *  Finds key in overflow tree of table, out is NULL if it isn't there.
+ */
+void hash_tree_find(hash_table_t *table, const char *key, unsigned keylen, unsigned long hash, word_t **out) {
+    hash_tree_t *node = table->tree;
+    int cmp;
+    
+    while(node) {
+        cmp = hash_tree_cmp(table, node->hh, key, keylen, hash);
+        
+        if(cmp == 0) {
+            (*out) = hash_elmt_from_hh(table, node->hh);
+            return;
+        }
+        
+        node = (cmp < 0) ? node->left : node->right;
+    }
+    
+    (*out) = NULL;
+}
+
+/**
+ *  void hash_tree_free(hash_tree_t *node)
+ * 
+ *  Frees nodes of subtree, not items.
+ */
+void hash_tree_free(hash_tree_t *node) {
+    if(!node)
+        return;
+    
+    hash_tree_free(node->left);
+    hash_tree_free(node->right);
+    free(node);
+}
+
+/**
+ *  int hash_overloaded(hash_table_t *table)
+ * 
+ *  Returns 1 if table has to grow before next insert, open table when it's
+ *  more than 7/8 full, chained one when there's more than BUCKET_LOAD_MAX
+ *  items per bucket. Written so that it can't overflow for any size.
+ */
+int hash_overloaded(hash_table_t *table) {
+    if(table->engine == HASH_OPEN) {
+        return table->num > table->count - table->count / 8;
+    }
+    
+    return table->num / BUCKET_LOAD_MAX > table->count;
 }
 
 /**
@@ -231,12 +892,22 @@ void hash_add_to_bkt(hash_bucket_t *bkt, hash_handle_t *hh) {
  *  item. 
  */
 void hash_add_str(word_t **head, char *key, word_t *item, unsigned keylen) {
-    unsigned long hash;
-    
     if(keylen > KEY_MAX_LEN) {
         return;
     }
     
+    hash_add_hashed(head, item, keylen, hash_func(key, keylen));
+}
+
+/**
+ *  void hash_add_hashed(word_t **head, word_t *item, unsigned keylen, unsigned long hash)
+ * 
+ *  Same as hash_add_str, but with already calculated hash of item's key. Used
+ *  to move items between tables without hashing their keys again.
+ */
+void hash_add_hashed(word_t **head, word_t *item, unsigned keylen, unsigned long hash) {
+    hash_bucket_t *bkt;
+    
     if(!(*head)) {
         (*head) = item;
         hash_create_table((*head));
@@ -246,22 +917,45 @@ void hash_add_str(word_t **head, char *key, word_t *item, unsigned keylen) {
         (*head)->hh.table->tail = &((item)->hh);
     }
     
-    hash = hash_jen(key, keylen);
-    
     (*head)->hh.table->num++;
     item->hh.table = (*head)->hh.table;
     item->hh.keylen = keylen;
     item->hh.hash = hash;
     item->hh.next_w = NULL;
     
+    if((*head)->hh.table->old_count) {
+        hash_migrate((*head)->hh.table, HASH_MIGRATE_STEP);
+    }
+    
+    if(hash_overloaded((*head)->hh.table)) {
+        /* previous resize has to be finished before the next one */
+        if((*head)->hh.table->old_count) {
+            hash_migrate((*head)->hh.table, (*head)->hh.table->old_count);
+        }
+        
+        if((*head)->hh.table->engine == HASH_OPEN) {
+            hash_open_grow((*head)->hh.table);
+        }
+        else {
+            hash_expand_buckets((*head)->hh.table);
+        }
+    }
+    
+    if((*head)->hh.table->engine == HASH_OPEN) {
+        hash_open_place((*head)->hh.table, &(item->hh));
+        
+        return;
+    }
+    
     /* inserts item hash_handle into a bucket, index calculated using hash_get_index */
-    hash_add_to_bkt(
-            &((*head)->hh.table->buckets[hash_get_index(
-                hash,
-                (*head)->hh.table->count
-            )]),
-            &(item->hh)
-    );
+    bkt = &((*head)->hh.table->buckets[hash_get_index(hash, (*head)->hh.table->count)]);
+    
+    if(hash_fallback && hash_chain_long(bkt)) {
+        hash_tree_add((*head)->hh.table, &(item->hh));
+    }
+    else {
+        hash_add_to_bkt(bkt, &(item->hh));
+    }
 }
 
 /**
@@ -293,7 +987,9 @@ void hash_find_in_bkt(hash_table_t *table, hash_bucket_t *bkt, char *key, unsign
     
     while((*out)) {
         if((*out)->hh.keylen == keylen) {
-            if(strncmp((*out)->key, key, keylen) == 0) {
+            TOUCH(keylen);
+            
+            if(strncmp(WORD_KEY(*out), key, keylen) == 0) {
                 return;
             }
         }
@@ -314,15 +1010,37 @@ void hash_find_in_bkt(hash_table_t *table, hash_bucket_t *bkt, char *key, unsign
  *  variable out. Returns NULL if key wasn't found.
  */
 void hash_find_str(word_t *head, char *key, word_t **out) {
-    unsigned long hash;
     unsigned keylen;
     
     (*out) = NULL;
     
     if(head) {
         keylen = strlen(key);
-        hash = hash_jen(key, keylen);
+        TOUCH(keylen + 1);
         
+        hash_find_hashed(head, key, keylen, hash_func(key, keylen), out);
+    }
+}
+
+/**
+ *  void hash_find_hashed(word_t *head, char *key, unsigned keylen, unsigned long hash, word_t **out)
+ * 
+ *  Same as hash_find_str, but with already known key length and hash. During
+ *  incremental resize each lookup moves part of old buckets too.
+ */
+void hash_find_hashed(word_t *head, char *key, unsigned keylen, unsigned long hash, word_t **out) {
+    unsigned long old_i;
+    
+    (*out) = NULL;
+    
+    if(head && (head)->hh.table->old_count) {
+        hash_migrate((head)->hh.table, HASH_MIGRATE_STEP);
+    }
+    
+    if(head && (head)->hh.table->engine == HASH_OPEN) {
+        hash_open_find((head)->hh.table, key, keylen, hash, out);
+    }
+    else if(head) {
         hash_find_in_bkt(
                 (head)->hh.table,
                 &((head)->hh.table->buckets[hash_get_index(
@@ -333,6 +1051,19 @@ void hash_find_str(word_t *head, char *key, word_t **out) {
                 keylen,
                 out
         );
+        
+        /* buckets before migrated were already emptied */
+        if(!(*out) && (head)->hh.table->old_count) {
+            old_i = hash_get_index(hash, (head)->hh.table->old_count);
+            
+            if(old_i >= (head)->hh.table->migrated) {
+                hash_find_in_bkt((head)->hh.table, &((head)->hh.table->old_buckets[old_i]), key, keylen, out);
+            }
+        }
+    }
+    
+    if(!(*out) && head && (head)->hh.table->tree) {
+        hash_tree_find((head)->hh.table, key, keylen, hash, out);
     }
 }
 
@@ -358,33 +1089,98 @@ void hash_get_next(word_t *head, word_t **out) {
 /**
  *  void hash_free_table(word_t **head)
  * 
- *  Frees all memory allocated by inserted items and table itself, afterwards
- *  sets head to NULL.
+ *  Frees table itself, afterwards sets head to NULL. Inserted items belong
+ *  to the arena they were allocated from and are freed with it.
  */
 void hash_free_table(word_t **head) {    
-    word_t *current;
-    word_t *next;
+    if(!(*head)) 
+        return;
+    
+    hash_drop_table((*head)->hh.table);
+    
+    (*head) = NULL;
+}
+
+/**
+ *  void hash_recycle_table(word_t **head)
+ * 
+ *  Keeps the emptied table with all it's buckets for the next
+ *  hash_create_table, afterwards sets head to NULL. Tables which are filled
+ *  repeatedly don't have to be allocated and expanded every time. Inserted
+ *  items are freed with their arena.
+ */
+void hash_recycle_table(word_t **head) {
     hash_table_t *table;
     
     if(!(*head)) 
         return;
     
     table = (*head)->hh.table;
-    current = (*head);
     
-    while(current) {
-        next = hash_elmt_from_hh(table, (current->hh.next_w));
+    /* items are gone, resize in progress doesn't have to be finished */
+    table->migrated = table->old_count;
+    hash_migrate(table, 0);
+    
+    hash_tree_free(table->tree);
+    table->tree = NULL;
+    table->tree_num = 0;
+    
+    if(table->engine == HASH_OPEN) {
+        memset(table->ctrl, 0, table->count);
+    }
+    else {
+        memset(table->buckets, 0, sizeof(hash_bucket_t) * table->count);
+    }
+    
+#ifdef HAVE_POSIX
+    pthread_mutex_lock(&table_pool_lock);
+#endif
+    
+    table->pool_next = table_pool;
+    table_pool = table;
+    
+#ifdef HAVE_POSIX
+    pthread_mutex_unlock(&table_pool_lock);
+#endif
+    
+    (*head) = NULL;
+}
+
+/**
+ *  void hash_free_pool()
+ * 
+ *  Frees all tables kept by hash_recycle_table.
+ */
+void hash_free_pool() {
+    hash_table_t *next;
+    
+    while(table_pool) {
+        next = table_pool->pool_next;
         
-        free(current->key);
-        free(current);
+        hash_drop_table(table_pool);
         
-        current = next;
+        table_pool = next;
     }
+}
 
+/**
+ *  void hash_drop_table(hash_table_t *table)
+ * 
+ *  Frees table itself, but not inserted items. Items can be inserted into
+ *  another table afterwards, their hash_handle is overwritten.
+ */
+void hash_drop_table(hash_table_t *table) {
+    if(!table) 
+        return;
+    
     free(table->buckets);
+    free(table->ctrl);
+    free(table->slots);
+    free(table->old_buckets);
+    free(table->old_ctrl);
+    free(table->old_slots);
+    hash_tree_free(table->tree);
     free(table);
-    
-    (*head) = NULL;
 }
 
 /**
@@ -400,6 +1196,31 @@ unsigned long hash_count(word_t *head) {
     return 0;
 }
 
+/**
+ *  unsigned long hash_memory(word_t *head)
+ * 
+ *  Returns bytes taken by arrays and overflow tree of table, without items.
+ */
+unsigned long hash_memory(word_t *head) {
+    hash_table_t *table;
+    unsigned long bytes;
+    
+    if(!head)
+        return 0;
+    
+    table = head->hh.table;
+    bytes = sizeof(hash_table_t) + table->tree_num * sizeof(hash_tree_t);
+    
+    if(table->engine == HASH_OPEN) {
+        bytes += (table->count + table->old_count) * (sizeof(hash_handle_t *) + 1);
+    }
+    else {
+        bytes += (table->count + table->old_count) * sizeof(hash_bucket_t);
+    }
+    
+    return bytes;
+}
+
 /**
  *  void hash_sort(word_t **head)
  * 
@@ -487,23 +1308,47 @@ void hash_sort(word_t **head) {
  *  Prints table debug info.
  */
 void hash_print_debug(word_t *head) {
-    unsigned bkt_i;
+    unsigned long bkt_i;
+    unsigned long num;
     hash_handle_t *chh;
     word_t *word;
     
     printf("##############################################\n");
     
+    if(head->hh.table->old_count) {
+        hash_migrate(head->hh.table, head->hh.table->old_count);
+    }
+    
     printf("TABLE SIZE: %lu\n", head->hh.table->count);    
+    printf("OVERFLOW TREE: %lu items\n", head->hh.table->tree_num);
+    
+    if(head->hh.table->engine == HASH_OPEN) {
+        for(bkt_i = 0; bkt_i < head->hh.table->count; bkt_i++) {
+            if(!head->hh.table->ctrl[bkt_i]) continue;
+            
+            word = hash_elmt_from_hh(head->hh.table, head->hh.table->slots[bkt_i]);
+            printf("slot %lu, home %lu -- data: %s, count: %u\n", bkt_i, 
+                    hash_get_index(word->hh.hash, head->hh.table->count), WORD_KEY(word), word->count);
+        }
+        
+        return;
+    }
         
     for(bkt_i = 0; bkt_i < head->hh.table->count; bkt_i++) {
         chh = head->hh.table->buckets[bkt_i].head;
         if(!chh) continue;
+        
+        for(num = 0; chh; chh = chh->next) {
+            num++;
+        }
+        
+        chh = head->hh.table->buckets[bkt_i].head;
         printf("-------------------------------------\n");
-        printf("ENTERING BUCKET ID: %u, NUM: %lu\n", bkt_i, head->hh.table->buckets[bkt_i].num);
+        printf("ENTERING BUCKET ID: %lu, NUM: %lu\n", bkt_i, num);
         
         while(chh) {
             word = hash_elmt_from_hh(head->hh.table, chh);
-            printf("word -- data: %s, count: %u\n", word->key, word->count);
+            printf("word -- data: %s, count: %u\n", WORD_KEY(word), word->count);
             
             chh = chh->next;            
         }
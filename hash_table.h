@@ -11,27 +11,82 @@
 
 #include <stddef.h>
 
-/* Maximum number of buckets a table can have */
-#define BUCKET_NUM_MAX 2097152
-/* Maximum number of items in one bucket before expand */
-#define BUCKET_NUM_TRESH 10
+/* Largest number of buckets or slots of a table, highest power of two of
+ * unsigned long whose array of pointers still fits into size_t. Sizes are
+ * unsigned long, which has only 32 bits on 64-bit Windows (LLP64), while
+ * on 32-bit systems the arrays are limited by size_t. */
+#define HASH_LONG_MAX (((unsigned long) -1) / 2 + 1)
+#define HASH_SIZE_MAX ((((size_t) -1) / 2 + 1) / sizeof(void *))
+#define HASH_COUNT_MAX (((size_t) HASH_LONG_MAX < HASH_SIZE_MAX) ? HASH_LONG_MAX : (unsigned long) HASH_SIZE_MAX)
+/* Average number of items in one bucket before chained table expands, one
+ * was the fastest of 1, 2, 4 and 8 from 100K to 10M keys (bench scaling) */
+#ifndef BUCKET_LOAD_MAX
+#define BUCKET_LOAD_MAX 1
+#endif
+/* Items of longer chains or probe runs go into overflow tree of the table,
+ * only colliding keys make them this long */
+#define HASH_CHAIN_MAX 64
+#define HASH_PROBE_MAX 1024
+
+/* Table engines, separate chaining or open addressing */
+#define HASH_CHAINED 0
+#define HASH_OPEN 1
+
+/* Resize modes, all items are moved at once or a few on each operation */
+#define HASH_REHASH_FULL 0
+#define HASH_REHASH_INCREMENTAL 1
+/* Number of old buckets or slots moved by each insert or lookup during
+ * incremental resize */
+#define HASH_MIGRATE_STEP 16
+
+/* Multiplier spreading low bits of hash into higher ones, items of one probe
+ * run or partition then still differ in bits taken from HASH_SPREAD */
+#define HASH_SPREAD(hash) ((hash) * 2654435761UL)
+
+/* Fingerprint of hash kept for each slot of open table, never zero (empty
+ * slot), differs for neighbouring items of tables of any size */
+#define HASH_FINGERPRINT(hash) ((unsigned char) (0x80 | ((HASH_SPREAD(hash) >> 25) & 0x7f)))
+
+/* Key of word, terminated string following it's structure (see new_word) */
+#define WORD_KEY(w) ((char *) ((w) + 1))
+/* Longest key stored in the same cache line as it's word */
+#define WORD_INLINE (CACHE_LINE - sizeof(word_t) - 1)
 
 /* Maximum size for table item's key */
 #define KEY_MAX_LEN 512
 
+/* One step of hash_jen for character c of a key, CP1250 letters above 0x7f
+ * are added as unsigned, char is signed on most compilers */
+#define HASH_JEN_STEP(hash, c) \
+    do { \
+        (hash) += (unsigned char) (c); \
+        (hash) += ((hash) << 10); \
+        (hash) ^= ((hash) >> 6); \
+    } while(0)
+
+/* Final mixing of hash_jen after all characters */
+#define HASH_JEN_END(hash) \
+    do { \
+        (hash) += ((hash) << 3); \
+        (hash) ^= ((hash) >> 11); \
+        (hash) += ((hash) << 15); \
+    } while(0)
+
 /* Prototypes */
 
 typedef struct word word_t;
 typedef struct hash_bucket hash_bucket_t;
 typedef struct hash_handle hash_handle_t;
 typedef struct hash_table hash_table_t;
+typedef struct hash_tree hash_tree_t;
 
 /* Structures */
 
+/* hash function of keys, see hash_jen */
+typedef unsigned long (*hash_func_t)(const char *key, unsigned len);
+
 struct hash_bucket {
     hash_handle_t *head;
-    unsigned long num;
-    int noexpand;
 };
 
 struct hash_handle {
@@ -43,6 +98,14 @@ struct hash_handle {
     unsigned keylen;
 };
 
+/* node of AVL tree of items which didn't fit into their chain or probe run */
+struct hash_tree {
+    hash_handle_t *hh;
+    hash_tree_t *left;
+    hash_tree_t *right;
+    int height;
+};
+
 struct hash_table {
     hash_bucket_t *buckets;
     ptrdiff_t hhoffset;
@@ -51,29 +114,87 @@ struct hash_table {
     
     unsigned long count;
     unsigned long num;
+    
+    /* HASH_CHAINED uses buckets, HASH_OPEN uses ctrl and slots */
+    int engine;
+    /* fingerprint of item in each slot, 0 if empty */
+    unsigned char *ctrl;
+    hash_handle_t **slots;
+    
+    /* arrays before incremental resize, old_count is 0 when there's none in
+     * progress, items from index migrated up are still there */
+    hash_bucket_t *old_buckets;
+    unsigned char *old_ctrl;
+    hash_handle_t **old_slots;
+    unsigned long old_count;
+    unsigned long migrated;
+    
+    /* items ordered by hash and key, searched after arrays if not empty */
+    hash_tree_t *tree;
+    unsigned long tree_num;
+    
+    /* next emptied table kept for reuse */
+    hash_table_t *pool_next;
 };
 
+/* key of word is stored right after the structure, so it's read without
+ * following a pointer, close to hash and length compared before it */
 struct word {
-    char *key;
-    unsigned count;
     hash_handle_t hh;
+    unsigned count;
+    /* first chunk of input with the word, see parallel_parse_shared */
+    unsigned first;
 };
 
+/* hash function used by all tables and it's seed */
+extern hash_func_t hash_func;
+extern unsigned long hash_seed;
+
 /* Function prototypes */
 
 void hash_set_count(long count);
 void hash_guess_count(long count);
-unsigned long hash_jen(char *key, unsigned len);
+void hash_set_engine(int engine);
+void hash_set_rehash(int mode);
+int hash_set_func(const char *name);
+void hash_set_seed(unsigned long seed);
+unsigned long hash_random_seed();
+void hash_set_fallback(int on);
+const char *hash_func_name();
+unsigned long hash_jen(const char *key, unsigned len);
+unsigned long hash_wy(const char *key, unsigned len);
 unsigned long hash_get_index(unsigned long hash, unsigned long table_size);
+unsigned hash_partition(unsigned long hash, unsigned parts);
 void hash_create_table(word_t *head);
+void hash_open_alloc(hash_table_t *table);
+void hash_open_place(hash_table_t *table, hash_handle_t *hh);
+void hash_open_grow(hash_table_t *table);
+void hash_open_probe(hash_table_t *table, unsigned char *ctrl, hash_handle_t **slots, unsigned long count, char *key, unsigned keylen, unsigned long hash, word_t **out);
+void hash_open_find(hash_table_t *table, char *key, unsigned keylen, unsigned long hash, word_t **out);
 void hash_expand_buckets(hash_table_t *table);
+int hash_chain_long(hash_bucket_t *bkt);
+int hash_tree_cmp(hash_table_t *table, hash_handle_t *hh, const char *key, unsigned keylen, unsigned long hash);
+hash_tree_t *hash_tree_balance(hash_tree_t *node);
+hash_tree_t *hash_tree_insert(hash_table_t *table, hash_tree_t *node, hash_tree_t *item);
+void hash_tree_add(hash_table_t *table, hash_handle_t *hh);
+void hash_tree_find(hash_table_t *table, const char *key, unsigned keylen, unsigned long hash, word_t **out);
+void hash_tree_free(hash_tree_t *node);
+int hash_overloaded(hash_table_t *table);
+void hash_migrate(hash_table_t *table, unsigned long steps);
 void hash_add_to_bkt(hash_bucket_t *bkt, hash_handle_t *hh);
 void hash_add_str(word_t **head, char *key, word_t *item, unsigned keylen);
+void hash_add_hashed(word_t **head, word_t *item, unsigned keylen, unsigned long hash);
 void hash_find_in_bkt(hash_table_t *table, hash_bucket_t *bkt, char *key, unsigned keylen, word_t **out);
+word_t* hash_elmt_from_hh(hash_table_t *table, hash_handle_t *hh);
 void hash_find_str(word_t *head, char *key, word_t **out);
+void hash_find_hashed(word_t *head, char *key, unsigned keylen, unsigned long hash, word_t **out);
 void hash_get_next(word_t *head, word_t **out);
 void hash_free_table(word_t **head);
+void hash_recycle_table(word_t **head);
+void hash_free_pool();
+void hash_drop_table(hash_table_t *table);
 unsigned long hash_count(word_t *head);
+unsigned long hash_memory(word_t *head);
 void hash_sort(word_t **head);
 void hash_print_debug(word_t *head);
 
@@ -0,0 +1,237 @@
+/*
+ *  Text analysis program
+ * 
+ *  File: hll.c
+ *  Estimation of number of distinct words by HyperLogLog, without keeping
+ *  the words. Low bits of hash of a word choose one register of sketch,
+ *  position of the lowest set bit of the rest is the rank kept in it if
+ *  it's higher. Harmonic mean of 2^rank of all registers estimates the
+ *  number of distinct hashes. Words of each length have their own smaller
+ *  sketch for the #len lines, letters are counted exactly by the parser.
+ * 
+ *  Author: Martin Kucera, 2012
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "hll.h"
+#include "stat.h"
+#include "file.h"
+#include "err.h"
+#include "global.h"
+
+/**
+ *  void hll_init(hll_t *h, unsigned bits)
+ * 
+ *  Allocates empty sketch of 2^bits registers.
+ */
+void hll_init(hll_t *h, unsigned bits) {
+    h->bits = bits;
+    
+    if((h->registers = (unsigned char *) calloc(1UL << bits, 1)) == NULL) {
+        raise_error("Out of memory.");
+    }
+}
+
+/**
+ *  unsigned long hll_mix(unsigned long hash)
+ * 
+ *  Mixes all bits of hash into each other, upper bits of hash_jen are
+ *  mostly zero and sketch needs all of them.
+ */
+unsigned long hll_mix(unsigned long hash) {
+#ifdef HAVE_HASH_WY
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdUL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53UL;
+    hash ^= hash >> 33;
+#else
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bUL;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35UL;
+    hash ^= hash >> 16;
+#endif
+    
+    return hash;
+}
+
+/**
+ *  void hll_add(hll_t *h, unsigned long hash)
+ * 
+ *  Adds mixed hash of a word into sketch.
+ */
+void hll_add(hll_t *h, unsigned long hash) {
+    unsigned long rest = hash >> h->bits;
+    unsigned char rank = 1;
+    
+    /* rest has HLL_HASH_BITS - bits bits, rank of zero rest is one more */
+    while((rest & 1) == 0 && rank <= HLL_HASH_BITS - h->bits) {
+        rest >>= 1;
+        rank++;
+    }
+    
+    if(rank > h->registers[hash & ((1UL << h->bits) - 1)])
+        h->registers[hash & ((1UL << h->bits) - 1)] = rank;
+}
+
+/**
+ *  double hll_estimate(hll_t *h)
+ * 
+ *  Returns estimated number of distinct hashes added into sketch. Small
+ *  numbers are counted from empty registers (linear counting), large ones
+ *  are corrected for collisions of 32-bit hashes.
+ */
+double hll_estimate(hll_t *h) {
+    unsigned long m = 1UL << h->bits;
+    unsigned long i, zeros = 0;
+    double sum = 0;
+    double estimate;
+    
+    for(i = 0; i < m; i++) {
+        sum += ldexp(1.0, -(int) h->registers[i]);
+        
+        if(h->registers[i] == 0)
+            zeros++;
+    }
+    
+    estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+    
+    if(estimate <= 2.5 * m && zeros > 0) {
+        estimate = m * log((double) m / zeros);
+    }
+    else if(HLL_HASH_BITS == 32 && estimate > 4294967296.0 / 30) {
+        estimate = -4294967296.0 * log(1 - estimate / 4294967296.0);
+    }
+    
+    return estimate;
+}
+
+/**
+ *  double hll_error(hll_t *h)
+ * 
+ *  Returns relative standard error of estimates of sketch.
+ */
+double hll_error(hll_t *h) {
+    return 1.04 / sqrt((double) (1UL << h->bits));
+}
+
+/**
+ *  void hll_free(hll_t *h)
+ * 
+ *  Frees registers of sketch.
+ */
+void hll_free(hll_t *h) {
+    free(h->registers);
+    h->registers = NULL;
+}
+
+/**
+ *  distinct_t *distinct_create()
+ * 
+ *  Allocates sketch of all words, sketches of lengths are added as longer
+ *  words come.
+ */
+distinct_t *distinct_create() {
+    distinct_t *d;
+    
+    if((d = (distinct_t *) malloc(sizeof(distinct_t))) == NULL) {
+        raise_error("Out of memory.");
+    }
+    
+    hll_init(&d->words, HLL_BITS);
+    d->lengths = NULL;
+    d->lengths_size = 0;
+    
+    return d;
+}
+
+/**
+ *  void distinct_add_word(stats_t *st, unsigned length, unsigned long hash)
+ * 
+ *  Adds word with hash into sketches of st, called by add_word_hashed.
+ */
+void distinct_add_word(stats_t *st, unsigned length, unsigned long hash) {
+    distinct_t *d = st->distinct;
+    unsigned i;
+    
+    if(length > d->lengths_size) {
+        d->lengths = (hll_t *) realloc(d->lengths, sizeof(hll_t) * length);
+        
+        if(d->lengths == NULL) {
+            raise_error("Out of memory.");
+        }
+        
+        for(i = d->lengths_size; i < length; i++) {
+            hll_init(&d->lengths[i], HLL_LEN_BITS);
+        }
+        
+        d->lengths_size = length;
+    }
+    
+    if(length > st->w_length_max)
+        st->w_length_max = length;
+    
+    hash = hll_mix(hash);
+    hll_add(&d->words, hash);
+    hll_add(&d->lengths[length - 1], hash);
+}
+
+/**
+ *  void distinct_write_stats(stats_t *st, FILE *output_file)
+ * 
+ *  Writes estimated stats to output_file, called by write_stats. #words and
+ *  #len lines are rounded estimates, followed by number of registers and
+ *  standard error in percent of them. Section of words is empty.
+ */
+void distinct_write_stats(stats_t *st, FILE *output_file) {
+    distinct_t *d = st->distinct;
+    char buff[OBUFFSIZE];
+    unsigned i;
+    
+    if(st->w_length_max == 0) {
+        write_line(output_file, "There were no words in input file.");
+        return;
+    }
+    
+    sprintf(buff, "#words %.0f", hll_estimate(&d->words));
+    write_line(output_file, buff);
+    
+    sprintf(buff, "#maxlen %u", st->w_length_max);
+    write_line(output_file, buff);
+    
+    for(i = 0; i < st->w_length_max; i++) {
+        sprintf(buff, "#len(%u) %.0f", (i + 1), hll_estimate(&d->lengths[i]));
+        write_line(output_file, buff);
+    }
+    
+    sprintf(buff, "#hll %lu %.2f %lu %.2f", 1UL << d->words.bits, hll_error(&d->words) * 100,
+            1UL << HLL_LEN_BITS, hll_error(&d->lengths[0]) * 100);
+    write_line(output_file, buff);
+    
+    write_line(output_file, "%%%");
+    write_line(output_file, "%%%");
+    
+    write_letters(st, output_file);
+}
+
+/**
+ *  void distinct_free(distinct_t *d)
+ * 
+ *  Frees all sketches.
+ */
+void distinct_free(distinct_t *d) {
+    unsigned i;
+    
+    for(i = 0; i < d->lengths_size; i++) {
+        hll_free(&d->lengths[i]);
+    }
+    
+    hll_free(&d->words);
+    free(d->lengths);
+    free(d);
+}
@@ -0,0 +1,53 @@
+/*
+ *  Text analysis program
+ * 
+ *  File: hll.h
+ * 
+ *  Author: Martin Kucera, 2012
+ */
+
+#ifndef HLL_H
+#define	HLL_H
+
+#include <stdio.h>
+#include "stat.h"
+
+/* Bits of hash choosing register of sketch of all words, 2^12 registers
+ * take 4 KB and give standard error of 1.6 % */
+#define HLL_BITS 12
+/* Bits of sketches of words of one length, 1024 registers, 3.3 % */
+#define HLL_LEN_BITS 10
+/* Number of bits of hashes */
+#define HLL_HASH_BITS (sizeof(unsigned long) * 8)
+
+/* Structures */
+
+typedef struct {
+    /* highest rank seen in each register */
+    unsigned char *registers;
+    unsigned bits;
+} hll_t;
+
+struct distinct {
+    /* all words */
+    hll_t words;
+    
+    /* words of each length, index is length - 1 */
+    hll_t *lengths;
+    unsigned lengths_size;
+};
+
+/* Function prototypes */
+
+void hll_init(hll_t *h, unsigned bits);
+unsigned long hll_mix(unsigned long hash);
+void hll_add(hll_t *h, unsigned long hash);
+double hll_estimate(hll_t *h);
+double hll_error(hll_t *h);
+void hll_free(hll_t *h);
+distinct_t *distinct_create();
+void distinct_add_word(stats_t *st, unsigned length, unsigned long hash);
+void distinct_write_stats(stats_t *st, FILE *output_file);
+void distinct_free(distinct_t *d);
+
+#endif	/* HLL_H */
@@ -12,6 +12,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
 
 #include "stat.h"
 #include "file.h"
@@ -19,10 +20,61 @@
 #include "parser.h"
 #include "global.h"
 #include "hash_table.h"
+#include "parallel.h"
+#include "sort.h"
+#include "pipeline.h"
+#include "batch.h"
+#include "approx.h"
+#include "hll.h"
+#include "spill.h"
+#include "binstat.h"
+#include "follow.h"
+#include "scan.h"
+#include "fold.h"
 
 FILE *input_file;
 FILE *output_file;
 
+/* input is read from a pipe or standard input */
+int input_stream = 0;
+
+/* number of threads used to parse input */
+long threads = 1;
+
+/* threads fill one shared table instead of merging their own */
+int shared = 0;
+
+/* read and parse input at the same time */
+int pipeline = 0;
+
+/* analyze list or directory of files */
+int batch = 0;
+/* total stats of batch */
+char *batch_total = NULL;
+
+/* memory for approximate counting of words, 0 counts them exactly */
+unsigned long approx_budget = 0;
+/* approximate counts are bounded by Count-Min sketch too */
+int countmin = 0;
+
+/* only estimate number of distinct words */
+int distinct = 0;
+
+/* memory for words before they are spilled to disk, 0 keeps all of them */
+unsigned long max_memory = 0;
+
+/* stats are written in binary format for query */
+int binary = 0;
+
+/* binary stats loaded before parsing input and written updated */
+char *update = NULL;
+
+/* seconds between stats of followed input, 0 reads it once */
+long follow = 0;
+
+/* print memory used by words */
+int memory = 0;
+
 /**
  *  long get_str_number(char *string)
  * 
@@ -40,19 +92,84 @@ long get_str_number(char *string) {
     }
 }
 
+/**
+ *  unsigned long get_str_size(char *string)
+ * 
+ *  Converts string to number of bytes, it can end with K, M or G. Returns 0
+ *  if string isn't a positive number or the size doesn't fit into unsigned
+ *  long, strtoul would negate numbers with minus sign and saturate large ones.
+ */
+unsigned long get_str_size(char *string) {
+    char *p;
+    unsigned long i;
+    unsigned long unit = 1;
+    
+    if(!isdigit((unsigned char) *string)) 
+        return 0;
+    
+    errno = 0;
+    i = strtoul(string, &p, 10);
+    
+    if(errno == ERANGE)
+        return 0;
+    
+    switch(toupper((unsigned char) *p)) {
+        case 'G':
+            unit *= 1024;
+        case 'M':
+            unit *= 1024;
+        case 'K':
+            unit *= 1024;
+            p++;
+    }
+    
+    if(*p != '\0' || i > ((unsigned long) -1) / unit)
+        return 0;
+    
+    return i * unit;
+}
+
 /**
  *  void process_input()
  * 
  *  Reads and parses input file. If there were no data present, raises error.
+ *  Input file is parsed directly from memory when it can be mapped, otherwise
+ *  it's read line by line.
  */
 void process_input() {
     char buff[LBUFFSIZE];
+    char *data;
+    unsigned long size;
     unsigned read_lines = 0;
     
     printf("Parsing input ...\n");
     
+    if(map_file(input_file, &data, &size)) {
+        if(threads > 1) {
+            printf("Using %ld threads ...\n", threads);
+            
+            if(shared) {
+                parallel_parse_shared(&stats, data, size, threads);
+            }
+            else {
+                parallel_parse(&stats, data, size, threads);
+            }
+        }
+        else {
+            parse_buffer(&stats, data, size);
+        }
+        
+        unmap_file(data, size);
+        
+        return;
+    }
+    
+    if(threads > 1) {
+        printf("Input can't be mapped, using one thread ...\n");
+    }
+    
     while(read_line(input_file, buff)) {
-	parse_line(buff);
+	parse_buffer(&stats, buff, strlen(buff));
         read_lines++;
     }
     
@@ -60,6 +177,56 @@ void process_input() {
         raise_error("Input file is empty.");
 }
 
+/**
+ *  void process_stream()
+ * 
+ *  Reads and parses input in chunks of CBUFFSIZE bytes, used for standard
+ *  input and pipes which can't be mapped or seeked. Word split at the end of
+ *  a chunk is moved to the beginning of the buffer and completed by the next
+ *  chunk. Buffer is enlarged only when a single word doesn't fit into it.
+ */
+void process_stream() {
+    char *buff;
+    unsigned long size = CBUFFSIZE;
+    /* bytes in buffer, including carried over word */
+    unsigned long len = 0;
+    unsigned long read;
+    unsigned long total = 0;
+    unsigned long cut;
+    
+    printf("Parsing input stream ...\n");
+    
+    if((buff = (char *) malloc(size)) == NULL) {
+        raise_error("Out of memory.");
+    }
+    
+    while((read = read_chunk(input_file, buff, len, size)) > 0) {
+        total += read;
+        len += read;
+        
+        cut = parse_boundary(buff, len);
+        parse_buffer(&stats, buff, cut);
+        
+        /* carry the split word over to the next chunk */
+        len -= cut;
+        memmove(buff, buff + cut, len);
+        
+        if(len == size) {
+            size *= 2;
+            
+            if((buff = (char *) realloc(buff, size)) == NULL) {
+                raise_error("Out of memory.");
+            }
+        }
+    }
+    
+    parse_buffer(&stats, buff, len);
+    free(buff);
+    
+    if(total == 0)
+        raise_error("Input file is empty.");
+}
+
 /**
  *  void help()
  * 
@@ -71,22 +238,175 @@ void help() {
     
     printf("--------------------------------------------------\n");
     printf("USAGE:\n");
-    printf("\t\t csstat.exe {inpf} {outf} [init bucket size]\n");
+    printf("\t\t csstat.exe [options] {inpf} {outf} [init bucket size]\n");
+    printf("\t\t csstat.exe query {binf} [word ...]\n");
+    printf("\t\t csstat.exe --update {binf} {inpf} [outf]\n");
     
     printf("--------------------------------------------------\n");
     printf("EXAMPLE:\n");
     printf("\t\t csstat.exe input.txt out.stat\n");
     printf("\t\t csstat.exe input.txt out.stat guess\n");
     printf("\t\t csstat.exe input.txt out.stat 1024\n");
+    printf("\t\t gzip -dc input.txt.gz | csstat.exe - out.stat\n");
+    printf("\t\t csstat.exe --threads 8 input.txt out.stat\n");
+    printf("\t\t csstat.exe --pipeline input.txt out.stat\n");
+    printf("\t\t csstat.exe --top 500 input.txt out.stat\n");
+    printf("\t\t csstat.exe --approx 64M --top 1000 huge.log out.stat\n");
+    printf("\t\t csstat.exe --distinct huge.log out.stat\n");
+    printf("\t\t csstat.exe --max-memory 2G corpus.txt out.stat\n");
+    printf("\t\t csstat.exe --binary input.txt out.bstat\n");
+    printf("\t\t csstat.exe query out.bstat hello world\n");
+    printf("\t\t csstat.exe --update out.bstat new.txt\n");
+    printf("\t\t csstat.exe --follow 60 app.log out.stat\n");
+    printf("\t\t csstat.exe --batch --threads 8 --total all.stat docs/ stats/\n");
     
     printf("--------------------------------------------------\n");
     printf("ARGUMENT DESC:\n");
-    printf("\t\t inpf - Input filename.\n");
+    printf("\t\t inpf - Input filename, '-' reads standard input.\n");
     printf("\t\t outf - Output filename.\n");
+    printf("\t\t binf - Stats written with --binary, counts of given words "
+            "are printed, without words #words and #len are.\n");
     printf("\t\t init bucket size - Starting bucket size for hash table. "
             "Can be a number (power of two) or string 'guess' - program "
             "will try to guess based on file size and average word density.\n");
     
+    printf("--------------------------------------------------\n");
+    printf("OPTIONS:\n");
+    printf("\t\t --threads N - Parse input in N threads, output stays the same.\n");
+    printf("\t\t --shared - With --threads, all threads add words into one "
+            "table with locked segments instead of merging their own tables.\n");
+    printf("\t\t --pipeline - Read input in separate thread while parsing, "
+            "prints time each side spent waiting for the other.\n");
+    printf("\t\t --batch - inpf is a directory or a list of files (one per line), "
+            "outf is a directory for stats of each file.\n");
+    printf("\t\t --total file - With --batch, saves total stats of all files.\n");
+    printf("\t\t --table open|chained - Hash table with open addressing "
+            "or separate chaining (default).\n");
+    printf("\t\t --hash jen|wy - Hash function of words, byte at a time Jenkins "
+            "(default) or word at a time wyhash (64-bit systems only).\n");
+    printf("\t\t --seed N|random - Seed of hash function, random one protects "
+            "against inputs made of colliding words.\n");
+    printf("\t\t --rehash full|incremental - Resize hash table at once (default) "
+            "or move few items on each insert and lookup.\n");
+    printf("\t\t --sort radix|merge - Sort words by count in an array, radix "
+            "sort in --threads (default), or merge sort their list.\n");
+    printf("\t\t --top K - Writes only K most frequent words, selected without "
+            "sorting all of them, #words and #len still count all words.\n");
+    printf("\t\t --approx size - Counts only the most frequent words approximately "
+            "in size bytes (K, M or G), each count is followed by how much it can be over, "
+            "#tokens replaces #words and #len. Uses one thread, not with --batch.\n");
+    printf("\t\t --countmin - With --approx, half of memory is Count-Min sketch "
+            "bounding counts too.\n");
+    printf("\t\t --distinct - Only estimates #words and #len by HyperLogLog "
+            "in few KB, words aren't written. Uses one thread, not with --batch "
+            "or --approx.\n");
+    printf("\t\t --max-memory size - Words taking more than size bytes (K, M "
+            "or G) are spilled to temporary files and merged at the end, output "
+            "stays the same. Uses one thread, not with --batch.\n");
+    printf("\t\t --binary - Writes stats in binary format with index of words, "
+            "read by query without parsing them. Not with --batch, --approx, "
+            "--distinct or --max-memory.\n");
+    printf("\t\t --update binf - Loads stats written with --binary and adds "
+            "words of inpf to them, result is the same as of analysis of both "
+            "inputs. Updated stats are written to binf in binary format, or to "
+            "outf if it's given. Uses one thread, not with --top.\n");
+    printf("\t\t --follow N - Keeps reading bytes appended to inpf until "
+            "interrupted, stats are saved every N seconds with checkpoint outf.ckpt "
+            "the next run resumes from. Rotated input is finished and the new "
+            "file is read from it's beginning. Uses one thread, not with --batch, "
+            "--approx, --distinct, --max-memory, --binary, --update or --pipeline.\n");
+    printf("\t\t --memory - Prints number of allocations and bytes used by words.\n");
+}
+
+/**
+ *  int read_options(int argc, char **argv)
+ * 
+ *  Reads options starting with -- and removes them from argv. Returns number
+ *  of remaining arguments. Shows help on unknown or invalid option.
+ */
+int read_options(int argc, char **argv) {
+    int i;
+    int n = 1;
+    
+    for(i = 1; i < argc; i++) {
+        if(strncmp(argv[i], "--", 2) != 0) {
+            argv[n++] = argv[i];
+        }
+        else if(strcmp(argv[i], "--threads") == 0 && (i + 1) < argc 
+                && (threads = get_str_number(argv[i + 1])) > 0) {
+            sort_set_threads((unsigned) threads);
+            i++;
+        }
+        else if(strcmp(argv[i], "--shared") == 0) {
+            shared = 1;
+        }
+        else if(strcmp(argv[i], "--pipeline") == 0) {
+            pipeline = 1;
+        }
+        else if(strcmp(argv[i], "--batch") == 0) {
+            batch = 1;
+        }
+        else if(strcmp(argv[i], "--total") == 0 && (i + 1) < argc) {
+            batch_total = argv[++i];
+        }
+        else if(strcmp(argv[i], "--table") == 0 && (i + 1) < argc 
+                && (strcmp(argv[i + 1], "open") == 0 || strcmp(argv[i + 1], "chained") == 0)) {
+            hash_set_engine((strcmp(argv[++i], "open") == 0) ? HASH_OPEN : HASH_CHAINED);
+        }
+        else if(strcmp(argv[i], "--hash") == 0 && (i + 1) < argc && hash_set_func(argv[i + 1])) {
+            i++;
+        }
+        else if(strcmp(argv[i], "--seed") == 0 && (i + 1) < argc 
+                && (strcmp(argv[i + 1], "random") == 0 || isdigit((unsigned char) argv[i + 1][0]))) {
+            i++;
+            hash_set_seed((strcmp(argv[i], "random") == 0) ? hash_random_seed() : strtoul(argv[i], NULL, 10));
+        }
+        else if(strcmp(argv[i], "--rehash") == 0 && (i + 1) < argc 
+                && (strcmp(argv[i + 1], "full") == 0 || strcmp(argv[i + 1], "incremental") == 0)) {
+            hash_set_rehash((strcmp(argv[++i], "full") == 0) ? HASH_REHASH_FULL : HASH_REHASH_INCREMENTAL);
+        }
+        else if(strcmp(argv[i], "--sort") == 0 && (i + 1) < argc
+                && (strcmp(argv[i + 1], "radix") == 0 || strcmp(argv[i + 1], "merge") == 0)) {
+            sort_set_mode((strcmp(argv[++i], "merge") == 0) ? SORT_MERGE : SORT_RADIX);
+        }
+        else if(strcmp(argv[i], "--top") == 0 && (i + 1) < argc 
+                && get_str_number(argv[i + 1]) > 0) {
+            sort_set_top((unsigned long) get_str_number(argv[++i]));
+        }
+        else if(strcmp(argv[i], "--approx") == 0 && (i + 1) < argc 
+                && (approx_budget = get_str_size(argv[i + 1])) > 0) {
+            i++;
+        }
+        else if(strcmp(argv[i], "--countmin") == 0) {
+            countmin = 1;
+        }
+        else if(strcmp(argv[i], "--distinct") == 0) {
+            distinct = 1;
+        }
+        else if(strcmp(argv[i], "--max-memory") == 0 && (i + 1) < argc 
+                && (max_memory = get_str_size(argv[i + 1])) > 0) {
+            i++;
+        }
+        else if(strcmp(argv[i], "--binary") == 0) {
+            binary = 1;
+        }
+        else if(strcmp(argv[i], "--update") == 0 && (i + 1) < argc) {
+            update = argv[++i];
+        }
+        else if(strcmp(argv[i], "--follow") == 0 && (i + 1) < argc 
+                && (follow = get_str_number(argv[i + 1])) > 0) {
+            i++;
+        }
+        else if(strcmp(argv[i], "--memory") == 0) {
+            memory = 1;
+        }
+        else {
+            help();
+            exit(1);
+        }
+    }
+    
+    return n;
 }
 
 /**
@@ -96,18 +416,100 @@ void help() {
  *  initiates process_input and write_stats afterwards.
  */
 void run(int argc, char **argv) {
+    char *tmp_output = NULL;
+    
+    argc = read_options(argc, argv);
+    
+    if(argc >= 3 && strcmp(argv[1], "query") == 0) {
+        binstat_query(argv[2], argv + 3, argc - 3);
+        
+        exit(EXIT_SUCCESS);
+    }
+    
+    /* without outf updated stats replace loaded ones, argv had the option */
+    if(update && argc == 2) {
+        argv[argc++] = update;
+    }
+    
     if(argc < 3 || argc > 4) {
         help();
         exit(1);
     }
     
-    open_file(&input_file, argv[1], "rb");
-    open_file(&output_file, argv[2], "wb");
+    if(batch && approx_budget) {
+        raise_error("--approx can't be used with --batch.");
+    }
+    
+    if(distinct && (batch || approx_budget)) {
+        raise_error("--distinct can't be used with --batch or --approx.");
+    }
+    
+    if(max_memory && (batch || approx_budget || distinct)) {
+        raise_error("--max-memory can't be used with --batch, --approx or --distinct.");
+    }
+    
+    if(update && (batch || approx_budget || distinct || max_memory || sort_top_count)) {
+        raise_error("--update can't be used with --batch, --approx, --distinct, --max-memory or --top.");
+    }
+    
+    if(binary && (batch || approx_budget || distinct || max_memory)) {
+        raise_error("--binary can't be used with --batch, --approx, --distinct or --max-memory.");
+    }
+    
+    if(follow && (batch || approx_budget || distinct || max_memory || binary || update || pipeline)) {
+        raise_error("--follow can't be used with --batch, --approx, --distinct, "
+                "--max-memory, --binary, --update or --pipeline.");
+    }
+    
+    if(follow && strcmp(argv[1], "-") == 0) {
+        raise_error("--follow needs input file, not standard input.");
+    }
+    
+    if(batch) {
+        batch_run(argv[1], argv[2], batch_total, threads);
+        
+        exit(EXIT_SUCCESS);
+    }
+    
+    if(follow) {
+        follow_run(&stats, argv[1], argv[2], (unsigned) follow);
+        stat_free(&stats);
+        
+        exit(EXIT_SUCCESS);
+    }
+    
+    if(strcmp(argv[1], "-") == 0) {
+        input_file = stdin;
+    }
+    else {
+        open_file(&input_file, argv[1], "rb");
+    }
+    
+    input_stream = !is_seekable(input_file);
+    
+    /* output can be the same file, it's written into temporary file and
+     * renamed, so loaded stats aren't lost if the update fails */
+    if(update) {
+        printf("Loading stats from: %s ...\n", update);
+        binstat_load(&stats, update);
+        binary = 1;
+        tmp_output = follow_name(argv[2], ".tmp");
+        
+        /* threads parse into empty tables */
+        threads = 1;
+    }
+    
+    open_file(&output_file, (tmp_output != NULL) ? tmp_output : argv[2], "wb");
     
     if(argc == 4) {
         if((strlen(argv[3]) == 5) && (strcmp(argv[3], "guess") == 0)) {
-            printf("Guessing optimal hash table size...\n");
-            hash_guess_count(get_file_size(input_file));
+            if(input_stream) {
+                printf("Can't guess hash table size of streamed input ...\n");
+            }
+            else {
+                printf("Guessing optimal hash table size...\n");
+                hash_guess_count(get_file_size(input_file));
+            }
         }
         else if(get_str_number(argv[3]) > 0) {
             printf("Setting hash table size to %ld ...\n", get_str_number(argv[3]));
@@ -115,12 +517,57 @@ void run(int argc, char **argv) {
         }
     }
     
+    if(approx_budget) {
+        stats.approx = approx_create(approx_budget, countmin);
+        printf("Counting words approximately in %lu counters ...\n", stats.approx->capacity);
+        
+        /* counters aren't shared or merged between threads */
+        threads = 1;
+    }
+    
+    if(distinct) {
+        stats.distinct = distinct_create();
+        printf("Estimating distinct words ...\n");
+        threads = 1;
+    }
+    
+    if(max_memory) {
+        stats.spill = spill_create(max_memory);
+        printf("Spilling words over %lu bytes to disk ...\n", max_memory);
+        threads = 1;
+    }
+    
     printf("Reading input file ...\n");
     
-    process_input();
-        
+    if(pipeline) {
+        printf("Parsing input in pipeline ...\n");
+        pipeline_parse(&stats, input_file);
+    }
+    else if(input_stream) {
+        process_stream();
+    }
+    else {
+        process_input();
+    }
+    
     printf("Saving stats to: %s ...\n", argv[2]);
-    write_stats(output_file);
+    if(binary) {
+        binstat_write_stats(&stats, output_file);
+    }
+    else {
+        write_stats(&stats, output_file);
+    }
+    
+    if(tmp_output != NULL) {
+        close_file(&output_file);
+        output_file = NULL;
+        follow_replace(tmp_output, argv[2]);
+        free(tmp_output);
+    }
+    
+    if(memory) {
+        arena_print(&stats.arena);
+    }
     
     printf("Exiting ...\n");
 }
@@ -131,10 +578,13 @@ void run(int argc, char **argv) {
  *  Frees hash table and closes input and output file.
  */
 void close() {
-    stat_free();
+    stat_free(&stats);
     
     fclose(input_file);
-    fclose(output_file);
+    
+    if(output_file != NULL) {
+        fclose(output_file);
+    }
 }
 
 /**
@@ -143,6 +593,8 @@ void close() {
  *  Initiates and closes program.
  */
 int main(int argc, char** argv) {
+    scan_init();
+    fold_init();
     run(argc, argv);
     close();
     
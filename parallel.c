@@ -0,0 +1,506 @@
+/*
+ *  Text analysis program
+ * 
+ *  File: parallel.c
+ *  Parses memory mapped input in multiple threads. Input is split into parts
+ *  at delimiters, each part is parsed by one thread into it's own stats.
+ *  Partial word tables are then merged in parallel, each thread merges words
+ *  of one hash partition. Merged words keep the order of their first
+ *  occurrence in input, so the output is the same as from a single thread.
+ *  Threads can also fill one shared table split into locked segments instead.
+ * 
+ *  Author: Martin Kucera, 2012
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "global.h"
+#include "err.h"
+#include "hash_table.h"
+#include "stat.h"
+#include "parser.h"
+#include "parallel.h"
+
+#ifdef HAVE_POSIX
+#include <pthread.h>
+#endif
+
+/* Structures */
+
+typedef struct {
+    /* part of input parsed by this thread */
+    const char *data;
+    unsigned long len;
+    
+    /* partial stats of the part */
+    stats_t st;
+    
+    /* words of partial table in insertion order and their hash partitions */
+    word_t **words;
+    unsigned char *parts;
+    unsigned long num;
+    
+    /* number of hash partitions */
+    unsigned nparts;
+} chunk_t;
+
+typedef struct {
+    chunk_t *chunks;
+    unsigned nchunks;
+    
+    /* hash partition merged by this thread */
+    unsigned part;
+    word_t *table;
+} merge_t;
+
+/* One segment of shared table, a table of it's own guarded by a lock. Each
+ * segment is kept on separate cache lines, see parallel_shared_segment */
+typedef struct {
+#ifdef HAVE_POSIX
+    pthread_mutex_t lock;
+#endif
+    word_t *table;
+} segment_t;
+
+struct shared_chunk {
+    /* part of input parsed by this thread and it's number in input order */
+    const char *data;
+    unsigned long len;
+    unsigned chunk;
+    
+    /* partial stats of the part, only letters and arena of words are used */
+    stats_t st;
+    
+    /* segments of shared table */
+    char *segments;
+    
+    /* words whose first chunk was set to this one, in order of insertion */
+    word_t **firsts;
+    unsigned long num;
+    unsigned long size;
+};
+
+/* bytes taken by one segment_t, rounded up to whole cache lines */
+#define SEGMENT_SIZE ((sizeof(segment_t) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE)
+
+/**
+ *  void *parallel_parse_chunk(void *arg)
+ * 
+ *  Thread function, parses one chunk_t into it's stats. Afterwards lists words
+ *  of the partial table in insertion order and frees the table itself, items
+ *  are kept for parallel_merge_part.
+ */
+void *parallel_parse_chunk(void *arg) {
+    chunk_t *c = (chunk_t *) arg;
+    word_t *w = NULL;
+    unsigned long i = 0;
+    
+    stat_init(&c->st);
+    parse_buffer(&c->st, c->data, c->len);
+    
+    c->num = hash_count(c->st.word_table);
+    c->words = (word_t **) malloc(sizeof(word_t *) * (c->num + 1));
+    c->parts = (unsigned char *) malloc(c->num + 1);
+    
+    if(!c->words || !c->parts) {
+        raise_error("Out of memory.");
+    }
+    
+    hash_get_next(c->st.word_table, &w);
+    while(w != NULL) {
+        c->words[i] = w;
+        c->parts[i] = hash_partition(w->hh.hash, c->nparts);
+        i++;
+        
+        hash_get_next(c->st.word_table, &w);
+    }
+    
+    if(c->st.word_table) {
+        hash_drop_table(c->st.word_table->hh.table);
+    }
+    
+    /* table pointer marks first occurrences during the merge */
+    for(i = 0; i < c->num; i++) {
+        c->words[i]->hh.table = NULL;
+    }
+    
+    c->st.word_table = NULL;
+    
+    return NULL;
+}
+
+/**
+ *  void *parallel_merge_part(void *arg)
+ * 
+ *  Thread function, merges words of one hash partition from all chunks. Goes
+ *  through chunks in input order, first occurrence of each word is moved into
+ *  partition's table, counts of other occurrences are added to it.
+ */
+void *parallel_merge_part(void *arg) {
+    merge_t *m = (merge_t *) arg;
+    chunk_t *c;
+    word_t *w;
+    word_t *found;
+    unsigned t;
+    unsigned long i;
+    
+    for(t = 0; t < m->nchunks; t++) {
+        c = &(m->chunks[t]);
+    
+        for(i = 0; i < c->num; i++) {
+            if(c->parts[i] != m->part)
+                continue;
+    
+            w = c->words[i];
+            hash_find_hashed(m->table, WORD_KEY(w), w->hh.keylen, w->hh.hash, &found);
+    
+            if(found) {
+                found->count += w->count;
+            }
+            else {
+                hash_add_hashed(&m->table, w, w->hh.keylen, w->hh.hash);
+            }
+        }
+    }
+    
+    return NULL;
+}
+
+/**
+ *  unsigned long parallel_chunk_end(const char *data, unsigned long size, unsigned long start, unsigned t, unsigned threads)
+ * 
+ *  Returns end of part t when size bytes of data are split into threads
+ *  parts, previous part ended at start. End is moved forward to the nearest
+ *  delimiter, so no word is divided between two threads.
+ */
+unsigned long parallel_chunk_end(const char *data, unsigned long size, unsigned long start, unsigned t, unsigned threads) {
+    unsigned long end;
+    
+    end = (t == threads - 1) ? size : (size / threads) * (t + 1);
+    
+    if(end < start)
+        end = start;
+    
+    while(end < size && !is_delimiter((unsigned char) data[end])) {
+        end++;
+    }
+    
+    return end;
+}
+
+#ifdef HAVE_POSIX
+
+/**
+ *  void parallel_run(void *(*func)(void *), void *args, size_t size, unsigned num)
+ * 
+ *  Runs func in num threads, each one gets pointer to it's item of args array
+ *  with items of given size. Waits for all threads to finish.
+ */
+void parallel_run(void *(*func)(void *), void *args, size_t size, unsigned num) {
+    pthread_t *threads;
+    unsigned i;
+    
+    if((threads = (pthread_t *) malloc(sizeof(pthread_t) * num)) == NULL) {
+        raise_error("Out of memory.");
+    }
+    
+    for(i = 0; i < num; i++) {
+        if(pthread_create(&threads[i], NULL, func, ((char *) args) + i * size) != 0) {
+            raise_error("Couldn't create thread.");
+        }
+    }
+    
+    for(i = 0; i < num; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    
+    free(threads);
+}
+
+#else
+
+void parallel_run(void *(*func)(void *), void *args, size_t size, unsigned num) {
+    unsigned i;
+    
+    for(i = 0; i < num; i++) {
+        func(((char *) args) + i * size);
+    }
+}
+
+#endif
+
+/**
+ *  double parallel_time()
+ * 
+ *  Returns current time in seconds, used to measure how long threads run or
+ *  wait for each other. Only differences of two values make sense.
+ */
+double parallel_time() {
+#ifdef HAVE_POSIX
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#else
+    return (double) clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+/**
+ *  void parallel_parse(stats_t *st, const char *data, unsigned long size, unsigned threads)
+ * 
+ *  Parses size bytes of data using given number of threads and saves merged
+ *  results into st, which has to be empty. Data is split at delimiters, so no
+ *  word is divided between two threads.
+ */
+void parallel_parse(stats_t *st, const char *data, unsigned long size, unsigned threads) {
+    chunk_t *chunks;
+    merge_t *merges;
+    word_t *w;
+    word_t *copy;
+    hash_table_t **tables;
+    unsigned long start = 0;
+    unsigned long end;
+    unsigned long i;
+    unsigned nparts;
+    unsigned t;
+    
+    nparts = (threads > 256) ? 256 : threads;
+    
+    chunks = (chunk_t *) malloc(sizeof(chunk_t) * threads);
+    merges = (merge_t *) malloc(sizeof(merge_t) * nparts);
+    tables = (hash_table_t **) malloc(sizeof(hash_table_t *) * nparts);
+    
+    if(!chunks || !merges || !tables) {
+        raise_error("Out of memory.");
+    }
+    
+    for(t = 0; t < threads; t++) {
+        end = parallel_chunk_end(data, size, start, t, threads);
+        
+        chunks[t].data = data + start;
+        chunks[t].len = end - start;
+        chunks[t].nparts = nparts;
+        
+        start = end;
+    }
+    
+    parallel_run(parallel_parse_chunk, chunks, sizeof(chunk_t), threads);
+    
+    for(t = 0; t < nparts; t++) {
+        merges[t].chunks = chunks;
+        merges[t].nchunks = threads;
+        merges[t].part = t;
+        merges[t].table = NULL;
+    }
+    
+    parallel_run(parallel_merge_part, merges, sizeof(merge_t), nparts);
+    
+    for(t = 0; t < nparts; t++) {
+        tables[t] = (merges[t].table) ? merges[t].table->hh.table : NULL;
+    }
+    
+    /* first occurrences were moved into partition tables, copies of them are
+     * inserted into st in input order, so the arena of each chunk with all
+     * it's duplicates is freed with it's stats right after */
+    for(t = 0; t < threads; t++) {
+        for(i = 0; i < chunks[t].num; i++) {
+            w = chunks[t].words[i];
+    
+            if(w->hh.table != NULL && w->hh.table == tables[chunks[t].parts[i]]) {
+                if(w->hh.keylen > st->w_length_max)
+                    st->w_length_max = w->hh.keylen;
+    
+                add_word_length(st, w->hh.keylen);
+                
+                copy = new_word(st, WORD_KEY(w), w->hh.keylen);
+                copy->count = w->count;
+                hash_add_hashed(&st->word_table, copy, w->hh.keylen, w->hh.hash);
+            }
+        }
+    
+        add_letters(st, &chunks[t].st);
+        stat_free(&chunks[t].st);
+    
+        free(chunks[t].words);
+        free(chunks[t].parts);
+    }
+    
+    for(t = 0; t < nparts; t++) {
+        hash_drop_table(tables[t]);
+    }
+    
+    free(tables);
+    free(merges);
+    free(chunks);
+}
+
+/**
+ *  segment_t *parallel_shared_segment(char *segments, unsigned long hash)
+ * 
+ *  Returns segment of shared table where word with given hash belongs.
+ */
+segment_t *parallel_shared_segment(char *segments, unsigned long hash) {
+    return (segment_t *) (segments + hash_partition(hash, PARALLEL_SEGMENTS) * SEGMENT_SIZE);
+}
+
+/**
+ *  void shared_add_word(stats_t *st, char *key, unsigned length, unsigned long hash)
+ * 
+ *  Adds word into shared table st is parsed into, called by add_word_hashed.
+ *  Only the word's segment is locked, other threads keep working with the
+ *  rest of the table, segments grow independently. New word is allocated
+ *  from arena of st.
+ * 
+ *  Each word keeps the first chunk of input it was found in. When a thread
+ *  lowers it to it's own chunk, the word is appended to it's firsts, which
+ *  then hold words in order of their first occurrence within the chunk.
+ */
+void shared_add_word(stats_t *st, char *key, unsigned length, unsigned long hash) {
+    shared_chunk_t *c = st->shared;
+    segment_t *seg = parallel_shared_segment(c->segments, hash);
+    word_t *w;
+    
+#ifdef HAVE_POSIX
+    pthread_mutex_lock(&seg->lock);
+#endif
+    
+    hash_find_hashed(seg->table, key, length, hash, &w);
+    
+    if(w == NULL) {
+        /* new word is listed below like one found by a later chunk */
+        w = new_word(st, key, length);
+        w->first = c->chunk + 1;
+        
+        hash_add_hashed(&seg->table, w, length, hash);
+    }
+    else {
+        w->count++;
+    }
+    
+    if(w->first > c->chunk) {
+        w->first = c->chunk;
+        
+        if(c->num == c->size) {
+            c->size = (c->size) ? c->size * 2 : 1024;
+            c->firsts = (word_t **) realloc(c->firsts, sizeof(word_t *) * c->size);
+            
+            if(c->firsts == NULL) {
+                raise_error("Out of memory.");
+            }
+        }
+        
+        c->firsts[c->num++] = w;
+    }
+    
+#ifdef HAVE_POSIX
+    pthread_mutex_unlock(&seg->lock);
+#endif
+}
+
+/**
+ *  void *parallel_parse_shared_chunk(void *arg)
+ * 
+ *  Thread function, parses one shared_chunk_t into the shared table.
+ */
+void *parallel_parse_shared_chunk(void *arg) {
+    shared_chunk_t *c = (shared_chunk_t *) arg;
+    
+    stat_init(&c->st);
+    c->st.shared = c;
+    
+    parse_buffer(&c->st, c->data, c->len);
+    
+    return NULL;
+}
+
+/**
+ *  void parallel_parse_shared(stats_t *st, const char *data, unsigned long size, unsigned threads)
+ * 
+ *  Same as parallel_parse, but all threads add words into one table split
+ *  into PARALLEL_SEGMENTS locked segments, there are no partial tables to
+ *  merge. Words are then inserted into st in order of their first
+ *  occurrence, so the output is still the same as from a single thread.
+ */
+void parallel_parse_shared(stats_t *st, const char *data, unsigned long size, unsigned threads) {
+    shared_chunk_t *chunks;
+    char *memory;
+    char *segments;
+    segment_t *seg;
+    word_t *w;
+    unsigned long start = 0;
+    unsigned long i;
+    unsigned t;
+    
+    chunks = (shared_chunk_t *) malloc(sizeof(shared_chunk_t) * threads);
+    memory = (char *) malloc(SEGMENT_SIZE * PARALLEL_SEGMENTS + CACHE_LINE);
+    
+    if(!chunks || !memory) {
+        raise_error("Out of memory.");
+    }
+    
+    /* first segment starts at cache line boundary */
+    segments = memory + (CACHE_LINE - (unsigned long) memory % CACHE_LINE) % CACHE_LINE;
+    
+    for(t = 0; t < PARALLEL_SEGMENTS; t++) {
+        seg = (segment_t *) (segments + t * SEGMENT_SIZE);
+        seg->table = NULL;
+#ifdef HAVE_POSIX
+        pthread_mutex_init(&seg->lock, NULL);
+#endif
+    }
+    
+    for(t = 0; t < threads; t++) {
+        chunks[t].data = data + start;
+        chunks[t].len = parallel_chunk_end(data, size, start, t, threads) - start;
+        chunks[t].chunk = t;
+        chunks[t].segments = segments;
+        chunks[t].firsts = NULL;
+        chunks[t].num = chunks[t].size = 0;
+        
+        start += chunks[t].len;
+    }
+    
+    parallel_run(parallel_parse_shared_chunk, chunks, sizeof(shared_chunk_t), threads);
+    
+    for(t = 0; t < PARALLEL_SEGMENTS; t++) {
+        seg = (segment_t *) (segments + t * SEGMENT_SIZE);
+        
+        if(seg->table) {
+            hash_drop_table(seg->table->hh.table);
+        }
+#ifdef HAVE_POSIX
+        pthread_mutex_destroy(&seg->lock);
+#endif
+    }
+    
+    /* word is inserted by the chunk it ended up first in, earlier chunk
+     * might have found it after a later one already listed it */
+    for(t = 0; t < threads; t++) {
+        for(i = 0; i < chunks[t].num; i++) {
+            w = chunks[t].firsts[i];
+            
+            if(w->first == t) {
+                if(w->hh.keylen > st->w_length_max)
+                    st->w_length_max = w->hh.keylen;
+                
+                add_word_length(st, w->hh.keylen);
+                hash_add_hashed(&st->word_table, w, w->hh.keylen, w->hh.hash);
+            }
+        }
+        
+        /* shared table holds each word once, it's arena is kept as it is */
+        arena_move(&st->arena, &chunks[t].st.arena);
+        add_letters(st, &chunks[t].st);
+        stat_free(&chunks[t].st);
+        
+        free(chunks[t].firsts);
+    }
+    
+    free(memory);
+    free(chunks);
+}
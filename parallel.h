@@ -0,0 +1,26 @@
+/*
+ *  Text analysis program
+ * 
+ *  File: parallel.h
+ * 
+ *  Author: Martin Kucera, 2012
+ */
+
+#ifndef PARALLEL_H
+#define	PARALLEL_H
+
+#include <stddef.h>
+#include "stat.h"
+
+/* number of locked segments of shared table, at most 256 (hash_partition) */
+#define PARALLEL_SEGMENTS 256
+
+/* Function prototypes */
+
+void parallel_run(void *(*func)(void *), void *args, size_t size, unsigned num);
+double parallel_time();
+void parallel_parse(stats_t *st, const char *data, unsigned long size, unsigned threads);
+void shared_add_word(stats_t *st, char *key, unsigned length, unsigned long hash);
+void parallel_parse_shared(stats_t *st, const char *data, unsigned long size, unsigned threads);
+
+#endif	/* PARALLEL_H */
@@ -10,63 +10,31 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "cp1250_ctype.h"
+#include "err.h"
+#include "global.h"
+#include "hash_table.h"
 #include "stat.h"
+#include "scan.h"
+#include "fold.h"
 #include "parser.h"
 
-/* All delimiters */
-unsigned char delimiters[] = {
-    9,		/* HT */
-    10,		/* LF */
-    11,		/* VT */
-    13,		/* CR */
-    32,		/* SP */
-    33,		/* ! */
-    34,		/* " */
-    36,		/* $ */
-    37,		/* % */
-    40,		/* ( */
-    41,		/* ) */
-    44,		/* , */
-    45,         /* - */
-    46,		/* . */
-    48,         /* 0 */
-    49,         /* 1 */
-    50,         /* 2 */
-    51,         /* 3 */
-    52,         /* 4 */
-    53,         /* 5 */
-    54,         /* 6 */
-    55,         /* 7 */
-    56,         /* 8 */
-    57,         /* 9 */
-    58,		/* : */
-    59,		/* ; */
-    63,		/* ? */
-    64,		/* @ */
-    91,		/* [ */
-    93,		/* ] */
-    123,	/* { */
-    125,	/* } */
-    126,	/* ~ */
-    130,	/* ‚ */
-    132,	/* „ */
-    133,	/* … */
-    137,	/* ‰ */
-    145,	/* ‘ */
-    146,        /* ’ */
-    147,	/* “ */
-    148, 	/* ” */
-    '\0'
-};
-
-/* Outer delimiters */
-unsigned char delimiters_outer[] = {
-    39,          /* ' */
-    '\0'
-};
+#ifdef COUNT_TOUCHES
+unsigned long touched_bytes = 0;
+#endif
+
+/**
+ *  int is_delimiter(unsigned char c)
+ * 
+ *  Checks if c is one of the delimiters or zero byte, which is considered
+ *  a delimiter as well, same as the end of string for strtok.
+ */
+int is_delimiter(unsigned char c) {
+    return cp1250_class[c] & _TDELIM;
+}
 
 /**
  *  int is_delimiter_outer(char c)
@@ -88,24 +56,277 @@ int is_delimiter_outer(char c) {
 }
 
 /**
- *  void parse_line(char *ibuff)
+ *  void parse_line(stats_t *st, char *ibuff)
  * 
- *  Splits ibuff using strtok and passes each word to parse_word
+ *  Splits ibuff using strtok and passes each word to parse_word. Original
+ *  tokenizer, kept as a reference for parse_buffer, which gives the same
+ *  results. Benchmark compares the two.
  */
-void parse_line(char *ibuff) {
+void parse_line(stats_t *st, char *ibuff) {
     char *pc;
 
     pc = strtok(ibuff, (char *)delimiters);
     while(pc != NULL) {
-	if(parse_word(&pc)) {
-	    add_word(pc);
+        TOUCH(strlen(pc) + 1);
+	if(parse_word(st, &pc)) {
+	    add_word(st, pc);
 	}
 	pc = strtok(NULL, (char *)delimiters);
     }
 }
 
 /**
- *  int parse_word(char **word)
+ *  void parse_buffer(stats_t *st, const char *buff, unsigned long len)
+ * 
+ *  Splits len bytes of buff by defined delimiters and passes each word to
+ *  parse_token. Buffer doesn't have to be terminated and is never modified,
+ *  so it can point directly into a memory mapped file. Buffer is converted
+ *  to lowercase by fold_buffer into a window of FBUFFSIZE bytes at a time,
+ *  windows end at delimiters. Word longer than the window is converted into
+ *  a temporary allocated buffer.
+ */
+void parse_buffer(stats_t *st, const char *buff, unsigned long len) {
+    char window[FBUFFSIZE + 1];
+    char *word;
+    unsigned long start = 0;
+    unsigned long n;
+    
+    while(start < len) {
+        n = (len - start > FBUFFSIZE) ? FBUFFSIZE : len - start;
+        
+        if(start + n < len) {
+            n = parse_boundary(buff + start, n);
+        }
+        
+        if(n > 0) {
+            fold_buffer(window, buff + start, n);
+            TOUCH(n);
+            parse_window(st, window, buff + start, n);
+        }
+        else {
+            n = FBUFFSIZE;
+            while(start + n < len && !is_delimiter((unsigned char) buff[start + n])) {
+                n++;
+            }
+            
+            if((word = (char *) malloc(n + 1)) == NULL) {
+                raise_error("Out of memory.");
+            }
+            
+            fold_buffer(word, buff + start, n);
+            TOUCH(n);
+            parse_window(st, word, buff + start, n);
+            
+            free(word);
+        }
+        
+        start += n;
+    }
+}
+
+/**
+ *  void parse_window(stats_t *st, char *window, const char *raw, unsigned long len)
+ * 
+ *  Passes each word of len bytes of window to parse_token. Window has to be
+ *  converted to lowercase already and have one more byte after it's end,
+ *  words are terminated in place. Raw are the same bytes before conversion.
+ *  Word boundaries are found in batches by scan_words.
+ */
+void parse_window(stats_t *st, char *window, const char *raw, unsigned long len) {
+    unsigned long bounds[2 * SCAN_BATCH];
+    unsigned long pos = 0;
+    unsigned long n, i;
+    
+    TOUCH(len);
+    
+    while((n = scan_words(window, len, &pos, bounds, SCAN_BATCH)) > 0) {
+        for(i = 0; i < n; i++) {
+            parse_token(st, window + bounds[2 * i], raw + bounds[2 * i], 
+                    bounds[2 * i + 1] - bounds[2 * i]);
+        }
+    }
+}
+
+/**
+ *  unsigned long parse_boundary(const char *buff, unsigned long len)
+ * 
+ *  Returns number of bytes of buff up to and including it's last delimiter.
+ *  Everything after that might be a word that continues in the next chunk of
+ *  input. Returns 0 if there's no delimiter in buff.
+ */
+unsigned long parse_boundary(const char *buff, unsigned long len) {
+    while(len > 0 && !is_delimiter((unsigned char) buff[len - 1])) {
+        len--;
+    }
+    
+    return len;
+}
+
+/**
+ *  void parse_chunk(stats_t *st, carry_t *carry, const char *chunk, unsigned long len)
+ * 
+ *  Parses one chunk of input which isn't kept in memory after the call. Word
+ *  at the end of chunk might continue in the next one, so it's copied into
+ *  carry and completed with the beginning of the next chunk. Chunk is never
+ *  modified.
+ */
+void parse_chunk(stats_t *st, carry_t *carry, const char *chunk, unsigned long len) {
+    unsigned long first = 0;
+    unsigned long cut;
+    
+    if(carry->len > 0) {
+        while(first < len && !is_delimiter((unsigned char) chunk[first])) {
+            first++;
+        }
+        
+        parse_carry(carry, chunk, first);
+        
+        if(first == len) {
+            return;
+        }
+        
+        parse_buffer(st, carry->buff, carry->len);
+        carry->len = 0;
+    }
+    
+    cut = first + parse_boundary(chunk + first, len - first);
+    
+    parse_buffer(st, chunk + first, cut - first);
+    parse_carry(carry, chunk + cut, len - cut);
+}
+
+/**
+ *  void parse_chunk_end(stats_t *st, carry_t *carry)
+ * 
+ *  Parses word left in carry after the last chunk and frees carry buffer.
+ */
+void parse_chunk_end(stats_t *st, carry_t *carry) {
+    parse_buffer(st, carry->buff, carry->len);
+    
+    free(carry->buff);
+    
+    carry->buff = NULL;
+    carry->len = carry->size = 0;
+}
+
+/**
+ *  void parse_carry(carry_t *carry, const char *data, unsigned long len)
+ * 
+ *  Appends len bytes of data to carry buffer, enlarges it if needed.
+ */
+void parse_carry(carry_t *carry, const char *data, unsigned long len) {
+    if(len == 0)
+        return;
+    
+    if(carry->len + len > carry->size) {
+        carry->size = (carry->size * 2 > carry->len + len) ? carry->size * 2 : carry->len + len;
+        
+        if((carry->buff = (char *) realloc(carry->buff, carry->size)) == NULL) {
+            raise_error("Out of memory.");
+        }
+    }
+    
+    memcpy(carry->buff + carry->len, data, len);
+    carry->len += len;
+}
+
+/**
+ *  void parse_token(stats_t *st, char *token, const char *raw, unsigned long len)
+ * 
+ *  Validates token the same way as parse_word does, but in a single pass
+ *  using cp1250_class lookup table. Letters are counted in the same pass,
+ *  with hash_jen as hash function the hash of the word is computed there
+ *  too. Other hash functions hash the final word at once, reading whole
+ *  words of memory. Token has to be converted to lowercase already, it's
+ *  terminated in place (byte after it is a delimiter or the spare byte of
+ *  window) and passed to add_word_hashed if it's a valid word. Raw are the
+ *  bytes of token before conversion, ch is one letter only if h was
+ *  lowercase, as in parse_word.
+ */
+void parse_token(stats_t *st, char *token, const char *raw, unsigned long len) {
+    unsigned char *pc;
+    letter_t *l_frequency;
+    unsigned long i, od_index, od_count, count;
+    unsigned long hash, od_hash;
+    unsigned char class;
+    int fused = (hash_func == hash_jen);
+    
+    /* strip leading outer delimiters, the last character is kept */
+    while(len > 1 && (cp1250_class[(unsigned char) *token] & _TOUTER)) {
+        token++;
+        raw++;
+        len--;
+    }
+    
+    TOUCH(len);
+    
+    l_frequency = stat_letters(st);
+    pc = (unsigned char *) token;
+    count = od_index = od_count = 0;
+    hash = od_hash = hash_seed;
+    
+    for(i = 0; i < len; i++) {
+        class = cp1250_class[pc[i]];
+        
+        if(class & _TALPHA) {
+            if(pc[i] == 'c' && (i + 1) < len && raw[i + 1] == 'h') {
+                if(fused) {
+                    HASH_JEN_STEP(hash, 'c');
+                    HASH_JEN_STEP(hash, 'h');
+                }
+                
+                l_frequency[0].count++;
+                i++;
+            }
+            else {
+                if(fused) {
+                    HASH_JEN_STEP(hash, pc[i]);
+                }
+                
+                l_frequency[pc[i]].count++;
+            }
+            
+            count++;
+        }
+        else {
+            /* hash of the word without the trailing part is kept */
+            if(class & _TOUTER) {
+                od_count = count;
+                od_index = i;
+                od_hash = hash;
+            }
+            
+            if(fused) {
+                HASH_JEN_STEP(hash, pc[i]);
+            }
+        }
+    }
+    
+    if(count == 0)
+        return;
+    
+    st->l_total += count;
+    
+    /* strip trailing part after the last outer delimiter */
+    if(od_count == count) {
+        len = od_index;
+        hash = od_hash;
+    }
+    
+    token[len] = '\0';
+    
+    if(fused) {
+        HASH_JEN_END(hash);
+    }
+    else {
+        hash = hash_func(token, len);
+    }
+    
+    add_word_hashed(st, token, len, hash);
+}
+
+/**
+ *  int parse_word(stats_t *st, char **word)
  * 
  *  Parses individual strings, converts all alphabetical letters to it's
  *  lowercase equivalent. Word is allowed to have any delimiters_outer inside, 
@@ -115,24 +336,25 @@ void parse_line(char *ibuff) {
  *  to add_letter.
  *  Characters c and h together - ch are considered as one in Czech language.
  */
-int parse_word(char **word) {
-    int i, count, length, od_index, od_count, shifts;
+int parse_word(stats_t *st, char **word) {
+    int i, count, length, od_index, od_count;
     char d[3];
     unsigned index;
     
-    count = od_index = od_count = shifts = 0;
+    count = od_index = od_count = 0;
     length = strlen((*word));
+    TOUCH(2 * length + 1);
+    
+    /* strip leading outer delimiters, the last character is kept */
+    while(length > 1 && is_delimiter_outer((*word)[0])) {
+        (*word)++;
+        length--;
+    }
     
     for(i = 0; i < length; i++) {
         if(is_delimiter_outer((*word)[i])) {
-            if(count == 0 && ((i + shifts + 1) < length)) {
-                shifts++;
-                (*word)++;
-            }
-            else {
-                od_count = count;
-                od_index = i;
-            }
+            od_count = count;
+            od_index = i;
             
             continue;
         }
@@ -151,7 +373,7 @@ int parse_word(char **word) {
                 index = (unsigned char) (*word)[i];
             }
 
-            add_letter(d, index);
+            add_letter(st, d, index);
             count++;
         }
     }
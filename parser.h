@@ -9,11 +9,30 @@
 #ifndef PARSER_H
 #define	PARSER_H
 
+#include "stat.h"
+
+/* Structures */
+
+/* word split between two chunks of input */
+typedef struct {
+    char *buff;
+    unsigned long len;
+    unsigned long size;
+} carry_t;
+
 /* Function prototypes */
 
+int is_delimiter(unsigned char c);
 int is_delimiter_outer(char c);
-void parse_line(char *ibuff);
-int parse_word(char **word);
+void parse_line(stats_t *st, char *ibuff);
+void parse_buffer(stats_t *st, const char *buff, unsigned long len);
+void parse_window(stats_t *st, char *window, const char *raw, unsigned long len);
+void parse_token(stats_t *st, char *token, const char *raw, unsigned long len);
+unsigned long parse_boundary(const char *buff, unsigned long len);
+void parse_chunk(stats_t *st, carry_t *carry, const char *chunk, unsigned long len);
+void parse_chunk_end(stats_t *st, carry_t *carry);
+void parse_carry(carry_t *carry, const char *data, unsigned long len);
+int parse_word(stats_t *st, char **word);
 
 
 #endif	/* PARSER_H */
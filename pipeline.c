@@ -0,0 +1,246 @@
+/*
+ *  Text analysis program
+ * 
+ *  File: pipeline.c
+ *  Reads and parses input at the same time. Reader thread fills a ring of
+ *  PBUFFNUM buffers of CBUFFSIZE bytes with pread (or fread for pipes), while
+ *  the parser consumes previously filled buffers. Time both sides spend
+ *  waiting for each other is measured, it shows whether reading or parsing
+ *  is the bottleneck.
+ * 
+ *  Author: Martin Kucera, 2012
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "global.h"
+#include "err.h"
+#include "file.h"
+#include "stat.h"
+#include "parser.h"
+#include "parallel.h"
+#include "pipeline.h"
+
+#ifdef HAVE_POSIX
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+/* Structures */
+
+typedef struct {
+    FILE *fp;
+    /* file is read using pread from offset */
+    int positional;
+    unsigned long offset;
+    
+    /* ring of buffers, filled ones are between head and tail */
+    char *buff[PBUFFNUM];
+    unsigned long len[PBUFFNUM];
+    unsigned head;
+    unsigned tail;
+    unsigned filled;
+    /* reader reached end of file */
+    int done;
+    
+#ifdef HAVE_POSIX
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+#endif
+    
+    /* seconds spent reading, parsing and waiting */
+    double read_time;
+    double read_stall;
+    double parse_time;
+    double parse_stall;
+} pipeline_t;
+
+/**
+ *  unsigned long pipeline_fill(pipeline_t *p, char *buff)
+ * 
+ *  Fills one buffer with next CBUFFSIZE bytes of input, returns number of
+ *  bytes read, 0 at the end of file.
+ */
+unsigned long pipeline_fill(pipeline_t *p, char *buff) {
+    unsigned long read = 0;
+    double start = parallel_time();
+    
+#ifdef HAVE_POSIX
+    ssize_t r;
+    
+    if(p->positional) {
+        while(read < CBUFFSIZE) {
+            r = pread(fileno(p->fp), buff + read, CBUFFSIZE - read, (off_t) (p->offset + read));
+            
+            if(r < 0) {
+                raise_error("Error reading input.");
+            }
+            
+            if(r == 0)
+                break;
+            
+            read += r;
+        }
+        
+        p->offset += read;
+    }
+    else {
+        read = read_chunk(p->fp, buff, 0, CBUFFSIZE);
+    }
+#else
+    read = read_chunk(p->fp, buff, 0, CBUFFSIZE);
+#endif
+    
+    p->read_time += parallel_time() - start;
+    
+    return read;
+}
+
+#ifdef HAVE_POSIX
+
+/**
+ *  void *pipeline_reader(void *arg)
+ * 
+ *  Reader thread, fills free buffers of the ring until the end of file.
+ */
+void *pipeline_reader(void *arg) {
+    pipeline_t *p = (pipeline_t *) arg;
+    unsigned long len;
+    double start;
+    
+    do {
+        pthread_mutex_lock(&p->lock);
+        
+        start = parallel_time();
+        while(p->filled == PBUFFNUM) {
+            pthread_cond_wait(&p->not_full, &p->lock);
+        }
+        p->read_stall += parallel_time() - start;
+        
+        pthread_mutex_unlock(&p->lock);
+        
+        /* buffer at tail isn't used by parser while the ring isn't full */
+        len = pipeline_fill(p, p->buff[p->tail]);
+        
+        pthread_mutex_lock(&p->lock);
+        
+        if(len > 0) {
+            p->len[p->tail] = len;
+            p->tail = (p->tail + 1) % PBUFFNUM;
+            p->filled++;
+        }
+        else {
+            p->done = 1;
+        }
+        
+        pthread_cond_signal(&p->not_empty);
+        pthread_mutex_unlock(&p->lock);
+    } while(len > 0);
+    
+    return NULL;
+}
+
+#endif
+
+/**
+ *  void pipeline_parse(stats_t *st, FILE *fp)
+ * 
+ *  Parses whole fp using reader thread and ring of buffers, prints time spent
+ *  in each stage afterwards. Raises error if there were no data.
+ */
+void pipeline_parse(stats_t *st, FILE *fp) {
+    pipeline_t p;
+    carry_t carry = {NULL, 0, 0};
+    unsigned long total = 0;
+    double start;
+    unsigned i;
+    
+    p.fp = fp;
+    p.positional = is_seekable(fp);
+    p.offset = (p.positional) ? (unsigned long) ftell(fp) : 0;
+    p.head = p.tail = p.filled = 0;
+    p.done = 0;
+    p.read_time = p.read_stall = p.parse_time = p.parse_stall = 0;
+    
+    for(i = 0; i < PBUFFNUM; i++) {
+        if((p.buff[i] = (char *) malloc(CBUFFSIZE)) == NULL) {
+            raise_error("Out of memory.");
+        }
+    }
+    
+#ifdef HAVE_POSIX
+    {
+        pthread_t reader;
+        
+        pthread_mutex_init(&p.lock, NULL);
+        pthread_cond_init(&p.not_empty, NULL);
+        pthread_cond_init(&p.not_full, NULL);
+        
+        if(pthread_create(&reader, NULL, pipeline_reader, &p) != 0) {
+            raise_error("Couldn't create thread.");
+        }
+        
+        for(;;) {
+            pthread_mutex_lock(&p.lock);
+            
+            start = parallel_time();
+            while(p.filled == 0 && !p.done) {
+                pthread_cond_wait(&p.not_empty, &p.lock);
+            }
+            p.parse_stall += parallel_time() - start;
+            
+            if(p.filled == 0) {
+                pthread_mutex_unlock(&p.lock);
+                break;
+            }
+            
+            pthread_mutex_unlock(&p.lock);
+            
+            start = parallel_time();
+            parse_chunk(st, &carry, p.buff[p.head], p.len[p.head]);
+            p.parse_time += parallel_time() - start;
+            
+            total += p.len[p.head];
+            
+            pthread_mutex_lock(&p.lock);
+            
+            p.head = (p.head + 1) % PBUFFNUM;
+            p.filled--;
+            
+            pthread_cond_signal(&p.not_full);
+            pthread_mutex_unlock(&p.lock);
+        }
+        
+        pthread_join(reader, NULL);
+        
+        pthread_mutex_destroy(&p.lock);
+        pthread_cond_destroy(&p.not_empty);
+        pthread_cond_destroy(&p.not_full);
+    }
+#else
+    /* no threads, stages just take turns */
+    while((p.len[0] = pipeline_fill(&p, p.buff[0])) > 0) {
+        start = parallel_time();
+        parse_chunk(st, &carry, p.buff[0], p.len[0]);
+        p.parse_time += parallel_time() - start;
+        
+        total += p.len[0];
+    }
+#endif
+    
+    parse_chunk_end(st, &carry);
+    
+    for(i = 0; i < PBUFFNUM; i++) {
+        free(p.buff[i]);
+    }
+    
+    printf("Reader: %.1f ms reading, %.1f ms stalled (ring full).\n",
+            p.read_time * 1000, p.read_stall * 1000);
+    printf("Parser: %.1f ms parsing, %.1f ms stalled (ring empty).\n",
+            p.parse_time * 1000, p.parse_stall * 1000);
+    
+    if(total == 0)
+        raise_error("Input file is empty.");
+}
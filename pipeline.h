@@ -0,0 +1,19 @@
+/*
+ *  Text analysis program
+ * 
+ *  File: pipeline.h
+ * 
+ *  Author: Martin Kucera, 2012
+ */
+
+#ifndef PIPELINE_H
+#define	PIPELINE_H
+
+#include <stdio.h>
+#include "stat.h"
+
+/* Function prototypes */
+
+void pipeline_parse(stats_t *st, FILE *fp);
+
+#endif	/* PIPELINE_H */
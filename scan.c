@@ -0,0 +1,310 @@
+/*
+ *  Text analysis program
+ * 
+ *  File: scan.c
+ *  Finds word boundaries in a buffer. Vector kernels classify 16 (SSSE3) or
+ *  32 (AVX2) bytes at once using nibble lookup tables of delimiters, each
+ *  byte is looked up by it's low and high nibble with a byte shuffle and it's
+ *  a delimiter if both results have a common bit. Changes between delimiters
+ *  and word characters are then read from a bit mask. Kernel is chosen at
+ *  runtime by CPU features, scalar kernel using cp1250_class is the fallback.
+ * 
+ *  Author: Martin Kucera, 2012
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "global.h"
+#include "cp1250_ctype.h"
+#include "scan.h"
+
+#ifdef HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/* Function prototypes */
+
+unsigned long scan_words_scalar(const char *buff, unsigned long len, unsigned long *pos, 
+        unsigned long *bounds, unsigned long max);
+
+/* kernel used by scan_words, the fastest one after scan_init */
+scan_func_t scan_kernel = scan_words_scalar;
+
+/**
+ *  unsigned long scan_words_scalar(const char *buff, unsigned long len, unsigned long *pos, unsigned long *bounds, unsigned long max)
+ * 
+ *  Scalar kernel, checks bytes one at a time using cp1250_class.
+ */
+unsigned long scan_words_scalar(const char *buff, unsigned long len, unsigned long *pos, 
+        unsigned long *bounds, unsigned long max) {
+    const unsigned char *data = (const unsigned char *) buff;
+    unsigned long i = *pos;
+    unsigned long start;
+    unsigned long n = 0;
+    
+    while(i < len && n < max) {
+        while(i < len && (cp1250_class[data[i]] & _TDELIM)) {
+            i++;
+        }
+        
+        start = i;
+        
+        while(i < len && !(cp1250_class[data[i]] & _TDELIM)) {
+            i++;
+        }
+        
+        if(i > start) {
+            bounds[2 * n] = start;
+            bounds[2 * n + 1] = i;
+            n++;
+        }
+    }
+    
+    *pos = i;
+    
+    return n;
+}
+
+#ifdef HAVE_X86_SIMD
+
+/**
+ *  unsigned long scan_mask(unsigned long mask, unsigned long base, int *in_word, unsigned long *start, unsigned long *bounds, unsigned long *n, unsigned long max)
+ * 
+ *  Reads word boundaries from 32 bit mask of word characters of a block at
+ *  position base. Bits where mask differs from the previous byte are starts
+ *  and ends of words. Returns position after the last emitted word if batch
+ *  got full, otherwise 0.
+ */
+unsigned long scan_mask(unsigned long mask, unsigned long base, int *in_word, 
+        unsigned long *start, unsigned long *bounds, unsigned long *n, unsigned long max) {
+    unsigned long changes;
+    unsigned long end;
+    
+    changes = (mask ^ ((mask << 1) | (unsigned long) *in_word)) & 0xffffffffUL;
+    
+    while(changes != 0) {
+        if(!*in_word) {
+            *start = base + __builtin_ctzl(changes);
+            *in_word = 1;
+        }
+        else {
+            end = base + __builtin_ctzl(changes);
+            *in_word = 0;
+            
+            bounds[2 * *n] = *start;
+            bounds[2 * *n + 1] = end;
+            
+            if(++(*n) == max)
+                return end;
+        }
+        
+        changes &= changes - 1;
+    }
+    
+    return 0;
+}
+
+/**
+ *  unsigned long scan_tail(const char *buff, unsigned long len, unsigned long i, int in_word, unsigned long start, unsigned long *pos, unsigned long *bounds, unsigned long n, unsigned long max)
+ * 
+ *  Finishes scanning of bytes after the last whole block with the scalar
+ *  kernel, word that started in vector blocks is completed first.
+ */
+unsigned long scan_tail(const char *buff, unsigned long len, unsigned long i, int in_word, 
+        unsigned long start, unsigned long *pos, unsigned long *bounds, unsigned long n, unsigned long max) {
+    const unsigned char *data = (const unsigned char *) buff;
+    
+    if(in_word) {
+        while(i < len && !(cp1250_class[data[i]] & _TDELIM)) {
+            i++;
+        }
+        
+        bounds[2 * n] = start;
+        bounds[2 * n + 1] = i;
+        n++;
+    }
+    
+    *pos = i;
+    
+    if(n < max)
+        n += scan_words_scalar(buff, len, pos, bounds + 2 * n, max - n);
+    
+    return n;
+}
+
+/**
+ *  unsigned long scan_words_ssse3(const char *buff, unsigned long len, unsigned long *pos, unsigned long *bounds, unsigned long max)
+ * 
+ *  SSSE3 kernel, classifies two blocks of 16 bytes at a time.
+ */
+__attribute__((target("ssse3")))
+unsigned long scan_words_ssse3(const char *buff, unsigned long len, unsigned long *pos, 
+        unsigned long *bounds, unsigned long max) {
+    __m128i lo_table = _mm_loadu_si128((const __m128i *) cp1250_nibble_lo);
+    __m128i hi_table = _mm_loadu_si128((const __m128i *) cp1250_nibble_hi);
+    __m128i nibble = _mm_set1_epi8(0x0f);
+    __m128i zero = _mm_setzero_si128();
+    __m128i v, c;
+    unsigned long i = *pos;
+    unsigned long start = 0;
+    unsigned long n = 0;
+    unsigned long mask;
+    unsigned long end;
+    int in_word = 0;
+    int k;
+    
+    while(i + 32 <= len) {
+        mask = 0;
+        
+        for(k = 0; k < 2; k++) {
+            v = _mm_loadu_si128((const __m128i *) (buff + i + 16 * k));
+            c = _mm_and_si128(_mm_shuffle_epi8(lo_table, _mm_and_si128(v, nibble)),
+                    _mm_shuffle_epi8(hi_table, _mm_and_si128(_mm_srli_epi16(v, 4), nibble)));
+            mask |= (unsigned long) _mm_movemask_epi8(_mm_cmpeq_epi8(c, zero)) << (16 * k);
+        }
+        
+        if((end = scan_mask(mask, i, &in_word, &start, bounds, &n, max)) != 0) {
+            *pos = end;
+            
+            return n;
+        }
+        
+        i += 32;
+    }
+    
+    return scan_tail(buff, len, i, in_word, start, pos, bounds, n, max);
+}
+
+/**
+ *  unsigned long scan_words_avx2(const char *buff, unsigned long len, unsigned long *pos, unsigned long *bounds, unsigned long max)
+ * 
+ *  AVX2 kernel, classifies blocks of 32 bytes.
+ */
+__attribute__((target("avx2")))
+unsigned long scan_words_avx2(const char *buff, unsigned long len, unsigned long *pos, 
+        unsigned long *bounds, unsigned long max) {
+    __m256i lo_table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) cp1250_nibble_lo));
+    __m256i hi_table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) cp1250_nibble_hi));
+    __m256i nibble = _mm256_set1_epi8(0x0f);
+    __m256i zero = _mm256_setzero_si256();
+    __m256i v, c;
+    unsigned long i = *pos;
+    unsigned long start = 0;
+    unsigned long n = 0;
+    unsigned long mask;
+    unsigned long end;
+    int in_word = 0;
+    
+    while(i + 32 <= len) {
+        v = _mm256_loadu_si256((const __m256i *) (buff + i));
+        c = _mm256_and_si256(_mm256_shuffle_epi8(lo_table, _mm256_and_si256(v, nibble)),
+                _mm256_shuffle_epi8(hi_table, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble)));
+        mask = (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(c, zero));
+        
+        if((end = scan_mask(mask, i, &in_word, &start, bounds, &n, max)) != 0) {
+            *pos = end;
+            
+            return n;
+        }
+        
+        i += 32;
+    }
+    
+    return scan_tail(buff, len, i, in_word, start, pos, bounds, n, max);
+}
+
+#endif
+
+/**
+ *  scan_func_t scan_best_kernel()
+ * 
+ *  Returns the fastest kernel supported by CPU.
+ */
+scan_func_t scan_best_kernel() {
+#ifdef HAVE_X86_SIMD
+    if(cp1250_nibble_ok) {
+        if(__builtin_cpu_supports("avx2"))
+            return scan_words_avx2;
+        
+        if(__builtin_cpu_supports("ssse3"))
+            return scan_words_ssse3;
+    }
+#endif
+    
+    return scan_words_scalar;
+}
+
+/**
+ *  void scan_init()
+ * 
+ *  Chooses the fastest kernel supported by CPU once, before any threads
+ *  start, so that scan_words doesn't check CPU features on each call.
+ */
+void scan_init() {
+    scan_kernel = scan_best_kernel();
+}
+
+/**
+ *  unsigned long scan_words(const char *buff, unsigned long len, unsigned long *pos, unsigned long *bounds, unsigned long max)
+ * 
+ *  Finds up to max words of buff starting at *pos. Start and end (position
+ *  after the last character) of n-th word are saved into bounds[2n] and
+ *  bounds[2n + 1]. *pos is moved after the last found word, which is never
+ *  in the middle of a word, scanning continues from there in the next call.
+ *  Returns number of found words, 0 when whole buffer was scanned.
+ */
+unsigned long scan_words(const char *buff, unsigned long len, unsigned long *pos, 
+        unsigned long *bounds, unsigned long max) {
+    return scan_kernel(buff, len, pos, bounds, max);
+}
+
+/**
+ *  int scan_set_kernel(const char *name)
+ * 
+ *  Sets kernel used by scan_words, name is auto, scalar, ssse3 or avx2.
+ *  Returns 0 if there's no such kernel or CPU doesn't support it. Not thread
+ *  safe, only benchmarks use it.
+ */
+int scan_set_kernel(const char *name) {
+    scan_func_t kernel = NULL;
+    
+    if(strcmp(name, "auto") == 0) {
+        kernel = scan_best_kernel();
+    }
+    else if(strcmp(name, "scalar") == 0) {
+        kernel = scan_words_scalar;
+    }
+#ifdef HAVE_X86_SIMD
+    else if(strcmp(name, "ssse3") == 0 && cp1250_nibble_ok && __builtin_cpu_supports("ssse3")) {
+        kernel = scan_words_ssse3;
+    }
+    else if(strcmp(name, "avx2") == 0 && cp1250_nibble_ok && __builtin_cpu_supports("avx2")) {
+        kernel = scan_words_avx2;
+    }
+#endif
+    
+    if(kernel == NULL)
+        return 0;
+    
+    scan_kernel = kernel;
+    
+    return 1;
+}
+
+/**
+ *  const char *scan_kernel_name()
+ * 
+ *  Returns name of the kernel used by scan_words.
+ */
+const char *scan_kernel_name() {
+#ifdef HAVE_X86_SIMD
+    if(scan_kernel == scan_words_avx2)
+        return "avx2";
+    
+    if(scan_kernel == scan_words_ssse3)
+        return "ssse3";
+#endif
+    
+    return "scalar";
+}
@@ -0,0 +1,30 @@
+/*
+ *  Text analysis program
+ * 
+ *  File: scan.h
+ * 
+ *  Author: Martin Kucera, 2012
+ */
+
+#ifndef SCAN_H
+#define	SCAN_H
+
+/* maximum number of words found by one call of scan_words */
+#define SCAN_BATCH 256
+
+/* Structures */
+
+/* scanning kernel, see scan_words */
+typedef unsigned long (*scan_func_t)(const char *buff, unsigned long len, 
+        unsigned long *pos, unsigned long *bounds, unsigned long max);
+
+/* Function prototypes */
+
+void scan_init();
+unsigned long scan_words(const char *buff, unsigned long len, unsigned long *pos, 
+        unsigned long *bounds, unsigned long max);
+int scan_set_kernel(const char *name);
+const char *scan_kernel_name();
+
+
+#endif	/* SCAN_H */
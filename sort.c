@@ -0,0 +1,363 @@
+/*
+ *  Text analysis program
+ * 
+ *  File: sort.c
+ *  Sorts words of a table by count before output. Radix sort gathers counts
+ *  and words of the insertion order list into an array and sorts it by
+ *  SORT_RADIX_BITS of count at a time, least significant first. Each pass is
+ *  stable, so words with the same count keep their insertion order just like
+ *  with hash_sort. Passes can be split between threads, each one counts and
+ *  moves words of it's own part of the array. With --top only the most
+ *  frequent words are selected by a bounded heap, the rest isn't sorted.
+ * 
+ *  Author: Martin Kucera, 2012
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "global.h"
+#include "err.h"
+#include "hash_table.h"
+#include "parallel.h"
+#include "sort.h"
+
+/* Structures */
+
+typedef struct {
+    /* inverted count, ascending keys are descending counts */
+    unsigned key;
+    word_t *w;
+} sort_item_t;
+
+typedef struct {
+    /* part of src array moved by this thread into dst */
+    sort_item_t *src;
+    sort_item_t *dst;
+    unsigned long from;
+    unsigned long to;
+    
+    /* digit sorted in this pass */
+    unsigned shift;
+    
+    /* number of items with each digit, then position of the first one in dst */
+    unsigned long hist[SORT_RADIX_SIZE];
+} sort_part_t;
+
+typedef struct {
+    unsigned count;
+    /* position in insertion order, earlier word wins ties */
+    unsigned long pos;
+    word_t *w;
+} sort_top_t;
+
+/* sorting used by sort_words */
+int sort_mode = SORT_RADIX;
+/* threads sort_words can use */
+unsigned sort_threads = 1;
+/* number of words written by write_stats, 0 writes all */
+unsigned long sort_top_count = 0;
+
+/**
+ *  void sort_set_mode(int mode)
+ * 
+ *  Sets sorting of sort_words, SORT_MERGE or SORT_RADIX.
+ */
+void sort_set_mode(int mode) {
+    sort_mode = mode;
+}
+
+/**
+ *  void sort_set_threads(unsigned threads)
+ * 
+ *  Sets number of threads sort_words can use for radix sort.
+ */
+void sort_set_threads(unsigned threads) {
+    sort_threads = (threads > 0) ? threads : 1;
+}
+
+/**
+ *  void sort_set_top(unsigned long k)
+ * 
+ *  Sets number of most frequent words written by write_stats, 0 writes all.
+ */
+void sort_set_top(unsigned long k) {
+    sort_top_count = k;
+}
+
+/**
+ *  void sort_words(word_t **head)
+ * 
+ *  Sorts words of table by count descending, words with the same count stay
+ *  in insertion order. Uses hash_sort or sort_radix, see sort_set_mode.
+ */
+void sort_words(word_t **head) {
+    if(sort_mode == SORT_MERGE) {
+        hash_sort(head);
+    }
+    else {
+        sort_radix(head, sort_threads);
+    }
+}
+
+/**
+ *  void *sort_count_part(void *arg)
+ * 
+ *  Thread function, counts digits of items in one part.
+ */
+void *sort_count_part(void *arg) {
+    sort_part_t *p = (sort_part_t *) arg;
+    unsigned long i;
+    
+    memset(p->hist, 0, sizeof(p->hist));
+    
+    for(i = p->from; i < p->to; i++) {
+        p->hist[(p->src[i].key >> p->shift) & (SORT_RADIX_SIZE - 1)]++;
+    }
+    
+    return NULL;
+}
+
+/**
+ *  void *sort_move_part(void *arg)
+ * 
+ *  Thread function, moves items of one part to their positions in dst.
+ */
+void *sort_move_part(void *arg) {
+    sort_part_t *p = (sort_part_t *) arg;
+    unsigned long i;
+    
+    for(i = p->from; i < p->to; i++) {
+        p->dst[p->hist[(p->src[i].key >> p->shift) & (SORT_RADIX_SIZE - 1)]++] = p->src[i];
+    }
+    
+    return NULL;
+}
+
+/**
+ *  void sort_run(void *(*func)(void *), sort_part_t *parts, unsigned num)
+ * 
+ *  Runs func on all parts, in threads if there's more than one.
+ */
+void sort_run(void *(*func)(void *), sort_part_t *parts, unsigned num) {
+    if(num == 1) {
+        func(parts);
+    }
+    else {
+        parallel_run(func, parts, sizeof(sort_part_t), num);
+    }
+}
+
+/**
+ *  void sort_radix(word_t **head, unsigned threads)
+ * 
+ *  Sorts words of table by count descending using LSD radix sort, words with
+ *  the same count stay in insertion order. Uses up to given number of
+ *  threads, each one sorts at least SORT_THREAD_MIN words. Passes over
+ *  digits which are the same in all counts are skipped, so small counts
+ *  usually take one or two passes.
+ */
+void sort_radix(word_t **head, unsigned threads) {
+    hash_table_t *table;
+    sort_item_t *src, *dst, *tmp;
+    sort_part_t *parts;
+    word_t **words;
+    word_t *w = NULL;
+    unsigned long num, i, pos;
+    unsigned shift, d, t;
+    unsigned diff = 0;
+    
+    if(!(*head))
+        return;
+    
+    table = (*head)->hh.table;
+    num = table->num;
+    
+    if(threads > num / SORT_THREAD_MIN)
+        threads = (num / SORT_THREAD_MIN > 0) ? (unsigned) (num / SORT_THREAD_MIN) : 1;
+    
+    src = (sort_item_t *) malloc(sizeof(sort_item_t) * num);
+    dst = (sort_item_t *) malloc(sizeof(sort_item_t) * num);
+    parts = (sort_part_t *) malloc(sizeof(sort_part_t) * threads);
+    words = (word_t **) malloc(sizeof(word_t *) * num);
+    
+    if(!src || !dst || !parts || !words) {
+        raise_error("Out of memory.");
+    }
+    
+    /* list is walked only once, passes read the array */
+    for(i = 0; i < num; i++) {
+        hash_get_next(*head, &w);
+        
+        src[i].key = ~(w->count);
+        src[i].w = w;
+        diff |= src[i].key ^ src[0].key;
+    }
+    
+    for(t = 0; t < threads; t++) {
+        parts[t].from = num / threads * t;
+        parts[t].to = (t == threads - 1) ? num : num / threads * (t + 1);
+    }
+    
+    for(shift = 0; shift < sizeof(unsigned) * 8; shift += SORT_RADIX_BITS) {
+        if(((diff >> shift) & (SORT_RADIX_SIZE - 1)) == 0)
+            continue;
+        
+        for(t = 0; t < threads; t++) {
+            parts[t].src = src;
+            parts[t].dst = dst;
+            parts[t].shift = shift;
+        }
+        
+        sort_run(sort_count_part, parts, threads);
+        
+        /* items of lower digit go first, of the same digit in order of parts */
+        pos = 0;
+        for(d = 0; d < SORT_RADIX_SIZE; d++) {
+            for(t = 0; t < threads; t++) {
+                i = parts[t].hist[d];
+                parts[t].hist[d] = pos;
+                pos += i;
+            }
+        }
+        
+        sort_run(sort_move_part, parts, threads);
+        
+        tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+    
+    for(i = 0; i < num; i++) {
+        words[i] = src[i].w;
+    }
+    
+    sort_relink(head, words, num);
+    
+    free(words);
+    free(src);
+    free(dst);
+    free(parts);
+}
+
+/**
+ *  void sort_relink(word_t **head, word_t **words, unsigned long num)
+ * 
+ *  Links all num words of table in order of words array, head is set to
+ *  the first one. Used to put words back into insertion order after they
+ *  were sorted and written, when more words are added to the table.
+ */
+void sort_relink(word_t **head, word_t **words, unsigned long num) {
+    unsigned long i;
+    
+    if(num == 0)
+        return;
+    
+    for(i = 0; i + 1 < num; i++) {
+        words[i]->hh.next_w = &(words[i + 1]->hh);
+    }
+    
+    words[num - 1]->hh.next_w = NULL;
+    words[0]->hh.table->tail = &(words[num - 1]->hh);
+    (*head) = words[0];
+}
+
+/**
+ *  int sort_top_less(sort_top_t *a, sort_top_t *b)
+ * 
+ *  Returns nonzero if a goes after b in output, it has lower count or the
+ *  same count and was added later.
+ */
+int sort_top_less(sort_top_t *a, sort_top_t *b) {
+    return (a->count < b->count || (a->count == b->count && a->pos > b->pos));
+}
+
+/**
+ *  void sort_top_sift(sort_top_t *heap, unsigned long num, unsigned long i)
+ * 
+ *  Moves item i of min-heap down until both of it's children go before it.
+ */
+void sort_top_sift(sort_top_t *heap, unsigned long num, unsigned long i) {
+    sort_top_t item = heap[i];
+    unsigned long child;
+    
+    while((child = 2 * i + 1) < num) {
+        if(child + 1 < num && sort_top_less(&heap[child + 1], &heap[child]))
+            child++;
+        
+        if(!sort_top_less(&heap[child], &item))
+            break;
+        
+        heap[i] = heap[child];
+        i = child;
+    }
+    
+    heap[i] = item;
+}
+
+/**
+ *  word_t **sort_top(word_t *head, unsigned long k, unsigned long *num)
+ * 
+ *  Returns array of k most frequent words of table in the same order as
+ *  sort_words would give them, num is set to it's length, which is less than
+ *  k if the table is smaller. Words are kept in a min-heap of k items, so the
+ *  whole table takes O(n log k) and the list isn't reordered. Array is freed
+ *  by caller.
+ */
+word_t **sort_top(word_t *head, unsigned long k, unsigned long *num) {
+    sort_top_t *heap;
+    sort_top_t tmp;
+    word_t **out;
+    word_t *w = NULL;
+    unsigned long pos = 0;
+    unsigned long n = 0;
+    unsigned long i;
+    
+    if(k > hash_count(head))
+        k = hash_count(head);
+    
+    heap = (sort_top_t *) malloc(sizeof(sort_top_t) * (k + 1));
+    out = (word_t **) malloc(sizeof(word_t *) * (k + 1));
+    
+    if(!heap || !out) {
+        raise_error("Out of memory.");
+    }
+    
+    hash_get_next(head, &w);
+    while(w != NULL && k > 0) {
+        tmp.count = w->count;
+        tmp.pos = pos++;
+        tmp.w = w;
+        
+        if(n < k) {
+            /* heap is built once it's full */
+            heap[n++] = tmp;
+            
+            if(n == k) {
+                for(i = k / 2; i-- > 0; ) {
+                    sort_top_sift(heap, n, i);
+                }
+            }
+        }
+        else if(tmp.count > heap[0].count) {
+            /* later word with the same count never goes before the root */
+            heap[0] = tmp;
+            sort_top_sift(heap, n, 0);
+        }
+        
+        hash_get_next(head, &w);
+    }
+    
+    /* least frequent word is taken from the root and put at the end */
+    *num = n;
+    while(n > 0) {
+        out[--n] = heap[0].w;
+        heap[0] = heap[n];
+        sort_top_sift(heap, n, 0);
+    }
+    
+    free(heap);
+    
+    return out;
+}
@@ -0,0 +1,38 @@
+/*
+ *  Text analysis program
+ * 
+ *  File: sort.h
+ * 
+ *  Author: Martin Kucera, 2012
+ */
+
+#ifndef SORT_H
+#define	SORT_H
+
+#include "hash_table.h"
+
+/* sorting of words by count, see sort_words */
+#define SORT_MERGE 0
+#define SORT_RADIX 1
+
+/* bits of count sorted in one radix pass */
+#define SORT_RADIX_BITS 8
+#define SORT_RADIX_SIZE (1 << SORT_RADIX_BITS)
+
+/* least number of words sorted by each thread */
+#define SORT_THREAD_MIN 65536
+
+/* number of words written by write_stats, 0 writes all */
+extern unsigned long sort_top_count;
+
+/* Function prototypes */
+
+void sort_words(word_t **head);
+void sort_radix(word_t **head, unsigned threads);
+void sort_relink(word_t **head, word_t **words, unsigned long num);
+void sort_set_mode(int mode);
+void sort_set_threads(unsigned threads);
+void sort_set_top(unsigned long k);
+word_t **sort_top(word_t *head, unsigned long k, unsigned long *num);
+
+#endif	/* SORT_H */
@@ -0,0 +1,721 @@
+/*
+ *  Text analysis program
+ * 
+ *  File: spill.c
+ *  Counting of words which don't fit into memory. When words and table take
+ *  more than the budget, the table is spilled into a temporary file as a
+ *  run and emptied. Words of a run are split into SPILL_PARTS partitions by
+ *  hash and sorted by hash and key in each one, each word keeps it's
+ *  position in insertion order of the whole input.
+ * 
+ *  Stats are written after partitions of all runs are merged one at a time:
+ *  counts of the same word are added up and it's first position is kept,
+ *  merged words of the partition are sorted by count and position into
+ *  another temporary file. Sorted partitions are merged into the output, so
+ *  it's the same as write_stats would give with the whole table in memory.
+ *  All runs are kept in one file, each merged segment is read through it's
+ *  own buffer.
+ * 
+ *  Merge stays within the budget too. Half of it is left for read buffers,
+ *  which gives the number of segments merged at once (fanin) and the size
+ *  of buffers. More runs than fanin are first merged in groups into fewer
+ *  runs, words of a partition which don't fit into the other half are
+ *  sorted in several segments and more sorted segments than fanin are
+ *  merged in groups as well.
+ * 
+ *  Author: Martin Kucera, 2012
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spill.h"
+#include "stat.h"
+#include "sort.h"
+#include "hash_table.h"
+#include "arena.h"
+#include "file.h"
+#include "err.h"
+#include "global.h"
+
+/**
+ *  FILE *spill_tmpfile()
+ * 
+ *  Returns new temporary file, removed when it's closed.
+ */
+FILE *spill_tmpfile() {
+    FILE *fp;
+    
+    if((fp = tmpfile()) == NULL) {
+        raise_error("Can't create temporary file.");
+    }
+    
+    return fp;
+}
+
+/**
+ *  void spill_tell(FILE *fp, fpos_t *pos)
+ * 
+ *  Saves current position of temporary file fp being written into pos.
+ */
+void spill_tell(FILE *fp, fpos_t *pos) {
+    if(fgetpos(fp, pos) != 0) {
+        raise_error("Can't write temporary file.");
+    }
+}
+
+/**
+ *  spill_t *spill_create(unsigned long budget)
+ * 
+ *  Allocates spill state of stats limited to budget bytes, with no runs.
+ */
+spill_t *spill_create(unsigned long budget) {
+    spill_t *s;
+    
+    if((s = (spill_t *) malloc(sizeof(spill_t))) == NULL) {
+        raise_error("Out of memory.");
+    }
+    
+    s->budget = budget;
+    s->fanin = budget / 2 / (sizeof(spill_reader_t) + SPILL_BUFF_MIN);
+    
+    if(s->fanin < 2)
+        s->fanin = 2;
+    
+    if(s->fanin > SPILL_MERGE_MAX)
+        s->fanin = SPILL_MERGE_MAX;
+    
+    /* sorted partitions are then merged in one pass */
+    s->parts = (s->fanin < SPILL_PARTS) ? s->fanin : SPILL_PARTS;
+    s->runs = NULL;
+    s->offsets = NULL;
+    s->sizes = NULL;
+    s->num = 0;
+    s->spilled = 0;
+    s->seq = 0;
+    
+    return s;
+}
+
+/**
+ *  int spill_full(stats_t *st)
+ * 
+ *  Returns nonzero if words, their table and array needed to spill them
+ *  take more than budget of st. Free part of the current slab of arena
+ *  isn't counted, it's kept after each spill. Runs have at least
+ *  SPILL_MIN_WORDS words.
+ */
+int spill_full(stats_t *st) {
+    return hash_count(st->word_table) >= SPILL_MIN_WORDS && (st->arena.bytes + hash_memory(st->word_table)
+            + hash_count(st->word_table) * sizeof(spill_item_t) > st->spill->budget);
+}
+
+/**
+ *  int cmp_spill_key(const void *a, const void *b)
+ * 
+ *  Compares two items by partition, hash and key, order of words in a run.
+ */
+int cmp_spill_key(const void *a, const void *b) {
+    spill_item_t *ia = (spill_item_t *) a;
+    spill_item_t *ib = (spill_item_t *) b;
+    
+    if(ia->part != ib->part)
+        return (ia->part < ib->part) ? -1 : 1;
+    
+    if(ia->rec.hash != ib->rec.hash)
+        return (ia->rec.hash < ib->rec.hash) ? -1 : 1;
+    
+    return strcmp(ia->key, ib->key);
+}
+
+/**
+ *  int cmp_spill_count(const void *a, const void *b)
+ * 
+ *  Compares two items by count descending and position in input, order of
+ *  words in output.
+ */
+int cmp_spill_count(const void *a, const void *b) {
+    spill_rec_t *ra = &((spill_item_t *) a)->rec;
+    spill_rec_t *rb = &((spill_item_t *) b)->rec;
+    
+    if(ra->count != rb->count)
+        return (ra->count > rb->count) ? -1 : 1;
+    
+    return (ra->seq < rb->seq) ? -1 : (ra->seq > rb->seq);
+}
+
+/**
+ *  unsigned long spill_put(FILE *fp, spill_item_t *item)
+ * 
+ *  Writes record of item followed by it's key at the end of fp, returns
+ *  number of bytes written.
+ */
+unsigned long spill_put(FILE *fp, spill_item_t *item) {
+    if(fwrite(&item->rec, sizeof(spill_rec_t), 1, fp) != 1
+            || fwrite(item->key, 1, item->rec.keylen, fp) != item->rec.keylen) {
+        raise_error("Can't write temporary file.");
+    }
+    
+    return sizeof(spill_rec_t) + item->rec.keylen;
+}
+
+/**
+ *  void spill_fill(spill_reader_t *r, unsigned long need)
+ * 
+ *  Makes sure there are at least need unused bytes in buffer of reader,
+ *  unused bytes are moved to the beginning and the rest is read from file.
+ */
+void spill_fill(spill_reader_t *r, unsigned long need) {
+    unsigned long len;
+    
+    if(r->end - r->start >= need)
+        return;
+    
+    memmove(r->buff, r->buff + r->start, r->end - r->start);
+    r->end -= r->start;
+    r->start = 0;
+    
+    len = (r->left < r->size - r->end) ? r->left : r->size - r->end;
+    
+    /* readers of one file take turns, each one seeks to it's position */
+    if(fsetpos(r->file, &r->pos) != 0
+            || fread(r->buff + r->end, 1, len, r->file) != len || r->end + len < need
+            || fgetpos(r->file, &r->pos) != 0) {
+        raise_error("Can't read temporary file.");
+    }
+    
+    r->end += len;
+    r->left -= len;
+}
+
+/**
+ *  void spill_next(spill_reader_t *r)
+ * 
+ *  Reads the next record of reader, valid is set to 0 at the end.
+ */
+void spill_next(spill_reader_t *r) {
+    if(r->left == 0 && r->start == r->end) {
+        r->valid = 0;
+        return;
+    }
+    
+    spill_fill(r, sizeof(spill_rec_t));
+    memcpy(&r->rec, r->buff + r->start, sizeof(spill_rec_t));
+    r->start += sizeof(spill_rec_t);
+    
+    if(r->rec.keylen > KEY_MAX_LEN) {
+        raise_error("Can't read temporary file.");
+    }
+    
+    spill_fill(r, r->rec.keylen);
+    memcpy(r->key, r->buff + r->start, r->rec.keylen);
+    r->key[r->rec.keylen] = '\0';
+    r->start += r->rec.keylen;
+    
+    r->valid = 1;
+}
+
+/**
+ *  void spill_open(spill_reader_t *r, FILE *fp, fpos_t *pos, unsigned long size)
+ * 
+ *  Sets reader to size bytes of fp from pos and reads the first record.
+ */
+void spill_open(spill_reader_t *r, FILE *fp, fpos_t *pos, unsigned long size) {
+    r->file = fp;
+    r->pos = (*pos);
+    r->left = size;
+    r->start = r->end = 0;
+    
+    spill_next(r);
+}
+
+/**
+ *  spill_reader_t *spill_readers(spill_t *s, unsigned long num, unsigned long *bytes)
+ * 
+ *  Allocates num readers with buffers, which take at most half of budget
+ *  together unless SPILL_BUFF_MIN is more. Bytes are set to their size,
+ *  readers are freed at once.
+ */
+spill_reader_t *spill_readers(spill_t *s, unsigned long num, unsigned long *bytes) {
+    spill_reader_t *readers;
+    unsigned long size;
+    unsigned long i;
+    
+    if(num == 0)
+        num = 1;
+    
+    size = s->budget / 2 / num;
+    size = (size > sizeof(spill_reader_t)) ? size - sizeof(spill_reader_t) : 0;
+    
+    if(size < SPILL_BUFF_MIN)
+        size = SPILL_BUFF_MIN;
+    
+    if(size > SBUFFSIZE)
+        size = SBUFFSIZE;
+    
+    if((readers = (spill_reader_t *) malloc((sizeof(spill_reader_t) + size) * num)) == NULL) {
+        raise_error("Out of memory.");
+    }
+    
+    for(i = 0; i < num; i++) {
+        readers[i].buff = (char *) (readers + num) + i * size;
+        readers[i].size = size;
+    }
+    
+    if(bytes != NULL)
+        (*bytes) = (sizeof(spill_reader_t) + size) * num;
+    
+    return readers;
+}
+
+/**
+ *  void spill_run(stats_t *st)
+ * 
+ *  Appends words of table of st as a new run and empties the table and
+ *  arena of words. Table is kept for reuse by the next run.
+ */
+void spill_run(stats_t *st) {
+    spill_t *s = st->spill;
+    spill_item_t *items;
+    word_t *w = NULL;
+    unsigned long num = hash_count(st->word_table);
+    fpos_t *offsets;
+    unsigned long *sizes;
+    unsigned long i;
+    unsigned p;
+    
+    if(num == 0)
+        return;
+    
+    if(s->runs == NULL) {
+        s->runs = spill_tmpfile();
+    }
+    
+    s->offsets = (fpos_t *) realloc(s->offsets, sizeof(fpos_t) * (s->num + 1) * s->parts);
+    s->sizes = (unsigned long *) realloc(s->sizes, sizeof(unsigned long) * (s->num + 1) * s->parts);
+    
+    if((items = (spill_item_t *) malloc(sizeof(spill_item_t) * num)) == NULL
+            || !s->offsets || !s->sizes) {
+        raise_error("Out of memory.");
+    }
+    
+    /* position in list is the position in insertion order */
+    for(i = 0; i < num; i++) {
+        hash_get_next(st->word_table, &w);
+        
+        items[i].rec.seq = s->seq + i;
+        items[i].rec.hash = w->hh.hash;
+        items[i].rec.count = w->count;
+        items[i].rec.keylen = w->hh.keylen;
+        items[i].key = WORD_KEY(w);
+        items[i].part = hash_partition(w->hh.hash, s->parts);
+    }
+    
+    qsort(items, num, sizeof(spill_item_t), cmp_spill_key);
+    
+    if(fseek(s->runs, 0L, SEEK_END) != 0) {
+        raise_error("Can't write temporary file.");
+    }
+    
+    offsets = s->offsets + s->num * s->parts;
+    sizes = s->sizes + s->num * s->parts;
+    
+    for(p = 0, i = 0; p < s->parts; p++) {
+        spill_tell(s->runs, &offsets[p]);
+        sizes[p] = 0;
+        
+        while(i < num && items[i].part == p) {
+            sizes[p] += spill_put(s->runs, &items[i++]);
+        }
+    }
+    
+    s->num++;
+    s->spilled++;
+    s->seq += num;
+    
+    free(items);
+    
+    hash_recycle_table(&st->word_table);
+    arena_reset(&st->arena);
+}
+
+/**
+ *  int spill_merge_key(spill_reader_t *readers, unsigned long num, spill_item_t *item)
+ * 
+ *  Reads the word with the lowest hash and key from readers sorted by them
+ *  into item, key of item needs KEY_MAX_LEN + 1 bytes. Counts of the same
+ *  word of all readers are added up and it's earliest position is kept.
+ *  Returns 0 when all readers were read.
+ */
+int spill_merge_key(spill_reader_t *readers, unsigned long num, spill_item_t *item) {
+    spill_reader_t *min = NULL;
+    unsigned long r;
+    
+    for(r = 0; r < num; r++) {
+        if(!readers[r].valid)
+            continue;
+        
+        if(min == NULL || readers[r].rec.hash < min->rec.hash
+                || (readers[r].rec.hash == min->rec.hash && strcmp(readers[r].key, min->key) < 0))
+            min = &readers[r];
+    }
+    
+    if(min == NULL)
+        return 0;
+    
+    item->rec = min->rec;
+    memcpy(item->key, min->key, min->rec.keylen + 1);
+    
+    /* the same word of all runs, the earliest position is kept */
+    for(r = 0; r < num; r++) {
+        if(&readers[r] == min || !readers[r].valid || readers[r].rec.hash != item->rec.hash)
+            continue;
+        
+        if(strcmp(readers[r].key, item->key) == 0) {
+            item->rec.count += readers[r].rec.count;
+            
+            if(readers[r].rec.seq < item->rec.seq)
+                item->rec.seq = readers[r].rec.seq;
+            
+            spill_next(&readers[r]);
+        }
+    }
+    
+    spill_next(min);
+    
+    return 1;
+}
+
+/**
+ *  spill_reader_t *spill_max_count(spill_reader_t *readers, unsigned long num)
+ * 
+ *  Returns reader of segment sorted by count with the highest count and the
+ *  earliest position, NULL when all readers were read.
+ */
+spill_reader_t *spill_max_count(spill_reader_t *readers, unsigned long num) {
+    spill_reader_t *max = NULL;
+    unsigned long r;
+    
+    for(r = 0; r < num; r++) {
+        if(readers[r].valid && (max == NULL
+                || readers[r].rec.count > max->rec.count
+                || (readers[r].rec.count == max->rec.count && readers[r].rec.seq < max->rec.seq)))
+            max = &readers[r];
+    }
+    
+    return max;
+}
+
+/**
+ *  void spill_merge_runs(spill_t *s)
+ * 
+ *  Merges runs in groups of fanin into new runs with the same partitions,
+ *  until there are at most fanin runs, so partitions of all of them can be
+ *  merged at once.
+ */
+void spill_merge_runs(spill_t *s) {
+    spill_reader_t *readers;
+    spill_item_t item;
+    char key[KEY_MAX_LEN + 1];
+    FILE *runs;
+    fpos_t *offsets;
+    unsigned long *sizes;
+    unsigned long i;
+    unsigned num, first, n, r, p;
+    
+    item.key = key;
+    
+    while(s->num > s->fanin) {
+        num = (s->num + s->fanin - 1) / s->fanin;
+        runs = spill_tmpfile();
+        offsets = (fpos_t *) malloc(sizeof(fpos_t) * num * s->parts);
+        sizes = (unsigned long *) malloc(sizeof(unsigned long) * num * s->parts);
+        readers = spill_readers(s, s->fanin, NULL);
+        
+        if(!offsets || !sizes) {
+            raise_error("Out of memory.");
+        }
+        
+        for(first = 0; first < s->num; first += s->fanin) {
+            n = (s->num - first < s->fanin) ? s->num - first : s->fanin;
+            
+            for(p = 0; p < s->parts; p++) {
+                for(r = 0; r < n; r++) {
+                    spill_open(&readers[r], s->runs, &s->offsets[(first + r) * s->parts + p], 
+                            s->sizes[(first + r) * s->parts + p]);
+                }
+                
+                i = first / s->fanin * s->parts + p;
+                spill_tell(runs, &offsets[i]);
+                sizes[i] = 0;
+                
+                while(spill_merge_key(readers, n, &item)) {
+                    sizes[i] += spill_put(runs, &item);
+                }
+            }
+        }
+        
+        free(readers);
+        fclose(s->runs);
+        free(s->offsets);
+        free(s->sizes);
+        
+        s->runs = runs;
+        s->offsets = offsets;
+        s->sizes = sizes;
+        s->num = num;
+    }
+}
+
+/**
+ *  void spill_add_seg(spill_segs_t *segs, fpos_t *pos, unsigned long size)
+ * 
+ *  Adds segment of size bytes written at pos of file of segs.
+ */
+void spill_add_seg(spill_segs_t *segs, fpos_t *pos, unsigned long size) {
+    if(segs->num == segs->alloc) {
+        segs->alloc = (segs->alloc) ? segs->alloc * 2 : SPILL_PARTS;
+        segs->offsets = (fpos_t *) realloc(segs->offsets, sizeof(fpos_t) * segs->alloc);
+        segs->sizes = (unsigned long *) realloc(segs->sizes, sizeof(unsigned long) * segs->alloc);
+        
+        if(!segs->offsets || !segs->sizes) {
+            raise_error("Out of memory.");
+        }
+    }
+    
+    segs->offsets[segs->num] = (*pos);
+    segs->sizes[segs->num] = size;
+    segs->num++;
+}
+
+/**
+ *  unsigned long spill_put_sorted(spill_item_t *items, unsigned long num, spill_segs_t *segs)
+ * 
+ *  Sorts items by count and appends them to segs as a new segment. Returns
+ *  num.
+ */
+unsigned long spill_put_sorted(spill_item_t *items, unsigned long num, spill_segs_t *segs) {
+    fpos_t pos;
+    unsigned long size = 0;
+    unsigned long i;
+    
+    if(num == 0)
+        return 0;
+    
+    qsort(items, num, sizeof(spill_item_t), cmp_spill_count);
+    spill_tell(segs->file, &pos);
+    
+    for(i = 0; i < num; i++) {
+        size += spill_put(segs->file, &items[i]);
+    }
+    
+    spill_add_seg(segs, &pos, size);
+    
+    return num;
+}
+
+/**
+ *  unsigned long spill_merge_part(stats_t *st, spill_reader_t *readers, unsigned p, spill_segs_t *segs, unsigned long limit)
+ * 
+ *  Merges partition p of all runs. Distinct words are added to word lengths
+ *  of st and appended to segs sorted by count. When they take more than
+ *  limit bytes, those read so far are sorted into one segment and the rest
+ *  into the next ones. Returns number of distinct words.
+ */
+unsigned long spill_merge_part(stats_t *st, spill_reader_t *readers, unsigned p, spill_segs_t *segs, unsigned long limit) {
+    spill_t *s = st->spill;
+    spill_item_t *items = NULL;
+    spill_item_t item;
+    char key[KEY_MAX_LEN + 1];
+    arena_t keys;
+    unsigned long num = 0, alloc = 0, words = 0;
+    unsigned r;
+    
+    arena_init(&keys);
+    item.key = key;
+    
+    for(r = 0; r < s->num; r++) {
+        spill_open(&readers[r], s->runs, &s->offsets[r * s->parts + p], s->sizes[r * s->parts + p]);
+    }
+    
+    while(spill_merge_key(readers, s->num, &item)) {
+        /* items array doubles when it's full */
+        if(num > 0 && keys.bytes + item.rec.keylen + 1 
+                + ((num == alloc) ? 2 * alloc : alloc) * sizeof(spill_item_t) > limit) {
+            words += spill_put_sorted(items, num, segs);
+            num = 0;
+            arena_reset(&keys);
+        }
+        
+        if(num == alloc) {
+            alloc = (alloc) ? alloc * 2 : 1024;
+            
+            if((items = (spill_item_t *) realloc(items, sizeof(spill_item_t) * alloc)) == NULL) {
+                raise_error("Out of memory.");
+            }
+        }
+        
+        items[num].rec = item.rec;
+        items[num].key = (char *) arena_alloc(&keys, item.rec.keylen + 1);
+        memcpy(items[num].key, item.key, item.rec.keylen + 1);
+        
+        add_word_length(st, item.rec.keylen);
+        num++;
+    }
+    
+    words += spill_put_sorted(items, num, segs);
+    
+    free(items);
+    arena_free(&keys);
+    
+    return words;
+}
+
+/**
+ *  void spill_merge_counts(spill_t *s, spill_segs_t *segs)
+ * 
+ *  Merges segments sorted by count in groups of fanin into new segments,
+ *  until there are at most fanin of them, so they can be merged at once.
+ */
+void spill_merge_counts(spill_t *s, spill_segs_t *segs) {
+    spill_segs_t merged;
+    spill_reader_t *readers;
+    spill_reader_t *max;
+    spill_item_t item;
+    fpos_t pos;
+    unsigned long first, n, r, size;
+    
+    while(segs->num > s->fanin) {
+        merged.file = spill_tmpfile();
+        merged.offsets = NULL;
+        merged.sizes = NULL;
+        merged.num = merged.alloc = 0;
+        
+        readers = spill_readers(s, s->fanin, NULL);
+        
+        for(first = 0; first < segs->num; first += s->fanin) {
+            n = (segs->num - first < s->fanin) ? segs->num - first : s->fanin;
+            
+            for(r = 0; r < n; r++) {
+                spill_open(&readers[r], segs->file, &segs->offsets[first + r], segs->sizes[first + r]);
+            }
+            
+            spill_tell(merged.file, &pos);
+            size = 0;
+            while((max = spill_max_count(readers, n)) != NULL) {
+                item.rec = max->rec;
+                item.key = max->key;
+                size += spill_put(merged.file, &item);
+                
+                spill_next(max);
+            }
+            
+            spill_add_seg(&merged, &pos, size);
+        }
+        
+        free(readers);
+        fclose(segs->file);
+        free(segs->offsets);
+        free(segs->sizes);
+        
+        (*segs) = merged;
+    }
+}
+
+/**
+ *  void spill_write_stats(stats_t *st, FILE *output_file)
+ * 
+ *  Spills the rest of table, merges all runs and writes stats to
+ *  output_file, called by write_stats when any run was spilled. Word lengths
+ *  are counted again from merged words.
+ */
+void spill_write_stats(stats_t *st, FILE *output_file) {
+    spill_t *s = st->spill;
+    spill_reader_t *readers;
+    spill_reader_t *max;
+    spill_segs_t segs;
+    char buff[OBUFFSIZE + KEY_MAX_LEN];
+    unsigned long words = 0, written = 0, bytes, r;
+    unsigned p;
+    
+    spill_run(st);
+    spill_merge_runs(s);
+    
+    /* words of each run were counted in w_lengths as new ones */
+    if(st->w_lengths != NULL) {
+        memset(st->w_lengths, 0, sizeof(unsigned) * st->w_lengths_size);
+    }
+    
+    segs.file = spill_tmpfile();
+    segs.offsets = NULL;
+    segs.sizes = NULL;
+    segs.num = segs.alloc = 0;
+    
+    /* merged words of a partition take the rest of budget */
+    readers = spill_readers(s, s->num, &bytes);
+    
+    for(p = 0; p < s->parts; p++) {
+        words += spill_merge_part(st, readers, p, &segs, (s->budget > bytes) ? s->budget - bytes : 0);
+    }
+    
+    free(readers);
+    
+    fflush(segs.file);
+    spill_merge_counts(s, &segs);
+    
+    sprintf(buff, "#words %lu", words);
+    write_line(output_file, buff);
+    
+    sprintf(buff, "#maxlen %u", st->w_length_max);
+    write_line(output_file, buff);
+    
+    for(r = 0; r < st->w_length_max; r++) {
+        sprintf(buff, "#len(%lu) %u", (r + 1), st->w_lengths[r]);
+        write_line(output_file, buff);
+    }
+    
+    write_line(output_file, "%%%");
+    
+    readers = spill_readers(s, segs.num, NULL);
+    
+    for(r = 0; r < segs.num; r++) {
+        spill_open(&readers[r], segs.file, &segs.offsets[r], segs.sizes[r]);
+    }
+    
+    /* sorted segments are merged, with sort_set_top only the first words */
+    while(sort_top_count == 0 || written < sort_top_count) {
+        if((max = spill_max_count(readers, segs.num)) == NULL)
+            break;
+        
+        sprintf(buff, "%s %lu", max->key, max->rec.count);
+        write_line(output_file, buff);
+        written++;
+        
+        spill_next(max);
+    }
+    
+    write_line(output_file, "%%%");
+    
+    write_letters(st, output_file);
+    
+    free(readers);
+    fclose(segs.file);
+    free(segs.offsets);
+    free(segs.sizes);
+}
+
+/**
+ *  void spill_free(spill_t *s)
+ * 
+ *  Closes and removes file of runs.
+ */
+void spill_free(spill_t *s) {
+    if(s->runs != NULL) {
+        fclose(s->runs);
+    }
+    
+    free(s->offsets);
+    free(s->sizes);
+    free(s);
+}
@@ -0,0 +1,123 @@
+/*
+ *  Text analysis program
+ * 
+ *  File: spill.h
+ * 
+ *  Author: Martin Kucera, 2012
+ */
+
+#ifndef SPILL_H
+#define	SPILL_H
+
+#include <stdio.h>
+#include "stat.h"
+#include "global.h"
+
+/* Most partitions of each run by hash, words of one partition of all runs
+ * are merged together. Fewer are used when budget allows fewer readers. */
+#define SPILL_PARTS 64
+/* Most segments merged at once, more of them are merged in several passes */
+#define SPILL_MERGE_MAX 64
+/* Least read buffer of a merged segment, a record with the longest key
+ * has to fit into it */
+#define SPILL_BUFF_MIN 4096
+
+/* Least number of words of a run, table alone can take more than budget */
+#define SPILL_MIN_WORDS 1024
+
+/* Structures */
+
+/* word in temporary file, key follows it */
+typedef struct {
+    /* position of word in insertion order of the whole input */
+    unsigned long seq;
+    unsigned long hash;
+    unsigned long count;
+    unsigned keylen;
+} spill_rec_t;
+
+/* word of table being spilled or of partition being merged, part is it's
+ * partition when it's spilled */
+typedef struct {
+    spill_rec_t rec;
+    char *key;
+    unsigned part;
+} spill_item_t;
+
+/* buffered reader of records of one segment of a file */
+typedef struct {
+    FILE *file;
+    /* position of bytes of segment not read into buffer and their number,
+     * fpos_t isn't limited to long offsets */
+    fpos_t pos;
+    unsigned long left;
+    
+    /* unused bytes of buffer are from start to end, buffer has size bytes
+     * between SPILL_BUFF_MIN and SBUFFSIZE */
+    char *buff;
+    unsigned long size;
+    unsigned long start;
+    unsigned long end;
+    
+    /* current record, valid is 0 when all were read */
+    spill_rec_t rec;
+    char key[KEY_MAX_LEN + 1];
+    int valid;
+} spill_reader_t;
+
+/* segments of a temporary file sorted by count, see spill_merge_part */
+typedef struct {
+    FILE *file;
+    fpos_t *offsets;
+    unsigned long *sizes;
+    unsigned long num;
+    unsigned long alloc;
+} spill_segs_t;
+
+struct spill {
+    /* memory for words and table before it's spilled, merge of runs
+     * takes at most this too */
+    unsigned long budget;
+    /* number of segments merged at once and partitions of each run, both
+     * derived from budget */
+    unsigned fanin;
+    unsigned parts;
+    
+    /* temporary file with all runs, partition p of run r is a segment of
+     * sizes[r * parts + p] bytes from offsets[r * parts + p] */
+    FILE *runs;
+    fpos_t *offsets;
+    unsigned long *sizes;
+    unsigned num;
+    /* number of runs spilled, before they were merged into fewer */
+    unsigned spilled;
+    
+    /* words in previous runs, insertion order continues from it */
+    unsigned long seq;
+};
+
+/* Function prototypes */
+
+FILE *spill_tmpfile();
+void spill_tell(FILE *fp, fpos_t *pos);
+spill_t *spill_create(unsigned long budget);
+int spill_full(stats_t *st);
+int cmp_spill_key(const void *a, const void *b);
+int cmp_spill_count(const void *a, const void *b);
+unsigned long spill_put(FILE *fp, spill_item_t *item);
+void spill_fill(spill_reader_t *r, unsigned long need);
+void spill_next(spill_reader_t *r);
+void spill_open(spill_reader_t *r, FILE *fp, fpos_t *pos, unsigned long size);
+spill_reader_t *spill_readers(spill_t *s, unsigned long num, unsigned long *bytes);
+void spill_run(stats_t *st);
+int spill_merge_key(spill_reader_t *readers, unsigned long num, spill_item_t *item);
+spill_reader_t *spill_max_count(spill_reader_t *readers, unsigned long num);
+void spill_merge_runs(spill_t *s);
+void spill_add_seg(spill_segs_t *segs, fpos_t *pos, unsigned long size);
+unsigned long spill_put_sorted(spill_item_t *items, unsigned long num, spill_segs_t *segs);
+unsigned long spill_merge_part(stats_t *st, spill_reader_t *readers, unsigned p, spill_segs_t *segs, unsigned long limit);
+void spill_merge_counts(spill_t *s, spill_segs_t *segs);
+void spill_write_stats(stats_t *st, FILE *output_file);
+void spill_free(spill_t *s);
+
+#endif	/* SPILL_H */
@@ -1,7 +1,7 @@
 /*
  *  Text analysis program
  * 
- *  File: file.c
+ *  File: stat.c
  *  Keeps statistic of all words, letters, calculates word length frequency and
  *  outputs final stats to a file.
  * 
@@ -16,68 +16,114 @@
 #include "hash_table.h"
 #include "global.h"
 #include "file.h"
+#include "err.h"
+#include "parallel.h"
+#include "sort.h"
+#include "approx.h"
+#include "hll.h"
+#include "spill.h"
 
-/* hash table head for all words */
-word_t *word_table = NULL;
+/* stats of the whole input */
+stats_t stats = {NULL, 0, 15, NULL, NULL, 0, {NULL, NULL, NULL, 0, 0, 0, 0}, NULL, NULL, NULL, NULL};
 
-/* maximum length of a word */
-unsigned w_length_max = 0;
-
-/* size of w_lengths array */
-unsigned w_lengths_size = 15;
-/* array with frequency of word lengths */
-unsigned *w_lengths = NULL;
-
-/* array of letters and their frequencies */
-letter_t *l_frequency;
-/* total number of letters */
-unsigned long l_total = 0;
+/**
+ *  void stat_init(stats_t *st)
+ * 
+ *  Initializes empty stats, word table and arrays are allocated on first use.
+ */
+void stat_init(stats_t *st) {
+    st->word_table = NULL;
+    st->w_length_max = 0;
+    st->w_lengths_size = 15;
+    st->w_lengths = NULL;
+    st->l_frequency = NULL;
+    st->l_total = 0;
+    
+    arena_init(&st->arena);
+    
+    st->shared = NULL;
+    st->approx = NULL;
+    st->distinct = NULL;
+    st->spill = NULL;
+}
 
 /**
- *  word_t *find_word(char *key)
+ *  word_t *find_word(stats_t *st, char *key)
  * 
  *  Attempts to find word_t with key from parameter in hash table.
  *  If found, returns it's pointer, else returns NULL.
  */
-word_t *find_word(char *key) {
+word_t *find_word(stats_t *st, char *key) {
     word_t *w;
     
-    hash_find_str(word_table, key, &w);
+    hash_find_str(st->word_table, key, &w);
     
     return w;
 }
 
 /** 
- *  void add_word(char *key)
+ *  void add_word(stats_t *st, char *key)
  * 
  *  Adds word into hash table. If word already exists, increases it's count. If 
  *  it does not, allocates memory for new word and it's key.
  * 
- *  Saves each new word's length and finds the maximum word length. 
+ *  Saves each new word's length and finds the maximum word length. Words
+ *  longer than KEY_MAX_LEN can't be stored in the table and are skipped.
  */
-void add_word(char *key) {
-    word_t *w;
-    char *d;
+void add_word(stats_t *st, char *key) {
     unsigned length;
 
     length = strlen(key);    
-    w = find_word(key);
+    TOUCH(length + 1);
+    
+    if(length > KEY_MAX_LEN)
+        return;
+    
+    add_word_hashed(st, key, length, hash_func(key, length));
+}
+
+/**
+ *  void add_word_hashed(stats_t *st, char *key, unsigned length, unsigned long hash)
+ * 
+ *  Same as add_word, but with already known length and hash_func of key, so
+ *  the key isn't walked again before it's looked up.
+ */
+void add_word_hashed(stats_t *st, char *key, unsigned length, unsigned long hash) {
+    word_t *w;
+    
+    if(length > KEY_MAX_LEN)
+        return;
+    
+    if(st->shared) {
+        shared_add_word(st, key, length, hash);
+        return;
+    }
+    
+    if(st->approx) {
+        approx_add_word(st, key, length, hash);
+        return;
+    }
+    
+    if(st->distinct) {
+        distinct_add_word(st, length, hash);
+        return;
+    }
+    
+    hash_find_hashed(st->word_table, key, length, hash, &w);
         
     if(w == NULL) {
-        if(length > w_length_max)
-            w_length_max = length;
+        if(length > st->w_length_max)
+            st->w_length_max = length;
         
-        add_word_length(length);
+        add_word_length(st, length);
         
-	w = (word_t *) malloc(sizeof(word_t));
-	d = (char *) malloc(length + 1);
+        w = new_word(st, key, length);
 	
-	strcpy(d, key);
-	
-	w->key = d;
-	w->count = 1;
-	
-        hash_add_str(&word_table, w->key, w, length);
+        hash_add_hashed(&st->word_table, w, length, hash);
+        
+        if(st->spill && spill_full(st)) {
+            spill_run(st);
+        }
     }
     else {
 	w->count++;
@@ -85,52 +131,128 @@ void add_word(char *key) {
 }
 
 /**
- *  void add_word_length(unsigned length)
+ *  word_t *new_word(stats_t *st, char *key, unsigned length)
+ * 
+ *  Allocates new word with count 1 and copy of it's key from arena of st,
+ *  key is stored right after the word. Words with keys up to WORD_INLINE
+ *  bytes take one cache line, so the key is read together with hash and
+ *  length compared before it. Word is freed with the arena.
+ */
+word_t *new_word(stats_t *st, char *key, unsigned length) {
+    word_t *w;
+    
+    if(length <= WORD_INLINE) {
+        w = (word_t *) arena_alloc_line(&st->arena, CACHE_LINE);
+    }
+    else {
+        w = (word_t *) arena_alloc(&st->arena, sizeof(word_t) + length + 1);
+    }
+    
+    memcpy(WORD_KEY(w), key, length);
+    WORD_KEY(w)[length] = '\0';
+    TOUCH(length);
+    w->count = 1;
+    
+    return w;
+}
+
+/**
+ *  void add_word_length(stats_t *st, unsigned length)
  * 
  *  Adds length to word length array. If length is larger than current
  *  w_length's size, then current size is doubled.
  */
-void add_word_length(unsigned length) {
+void add_word_length(stats_t *st, unsigned length) {
     unsigned old_size = 0;
     
-    if(w_lengths == NULL || length > w_lengths_size) {
-        if(w_lengths != NULL)
-            old_size = w_lengths_size;
+    if(st->w_lengths == NULL || length > st->w_lengths_size) {
+        if(st->w_lengths != NULL)
+            old_size = st->w_lengths_size;
         
-        if(length > w_lengths_size)
+        if(length > st->w_lengths_size)
             /* if new word length (index) is more than twice w_lengths_size, length is used */
-            w_lengths_size = ((w_lengths_size * 2) >= length) ? (w_lengths_size * 2) : length;
+            st->w_lengths_size = ((st->w_lengths_size * 2) >= length) ? (st->w_lengths_size * 2) : length;
         
-        w_lengths = (unsigned *) realloc(w_lengths, w_lengths_size * sizeof(unsigned));
+        st->w_lengths = (unsigned *) realloc(st->w_lengths, st->w_lengths_size * sizeof(unsigned));
         
-        memset((w_lengths + old_size), 0, (w_lengths_size - old_size) * sizeof(unsigned));
+        memset((st->w_lengths + old_size), 0, (st->w_lengths_size - old_size) * sizeof(unsigned));
     }
     
-    w_lengths[length - 1]++;
+    st->w_lengths[length - 1]++;
 }
 
 /**
- *  void add_letter(char *key, unsigned index)
+ *  letter_t *stat_letters(stats_t *st)
  * 
- *  Increments the counter for letter at index passed in arguments. If this letter
- *  hasn't been initialized yet, sets it's key.
+ *  Returns letter frequency array of st, allocates it on first use. Keys of
+ *  all letters are set right away, letter at index i is the character i.
  * 
  *  Czech letter ch is kept at unused index 0
  */
-void add_letter(char *key, unsigned index) {
-    l_total++;
+letter_t *stat_letters(stats_t *st) {
+    unsigned i;
     
-    if(l_frequency == NULL) {
-        l_frequency = (letter_t *) malloc(sizeof(letter_t) * L_FREQUENCY_SIZE);
-        memset(l_frequency, 0, sizeof(letter_t) * L_FREQUENCY_SIZE);
+    if(st->l_frequency == NULL) {
+        st->l_frequency = (letter_t *) malloc(sizeof(letter_t) * L_FREQUENCY_SIZE);
+        
+        if(st->l_frequency == NULL) {
+            raise_error("Out of memory.");
+        }
+        
+        memset(st->l_frequency, 0, sizeof(letter_t) * L_FREQUENCY_SIZE);
+        
+        strcpy(st->l_frequency[0].key, "ch");
+        for(i = 1; i < L_FREQUENCY_SIZE; i++) {
+            st->l_frequency[i].key[0] = (char) i;
+        }
     }
     
+    return st->l_frequency;
+}
+
+/**
+ *  void add_letter(stats_t *st, char *key, unsigned index)
+ * 
+ *  Increments the counter for letter at index passed in arguments. If this letter
+ *  hasn't been initialized yet, sets it's key.
+ */
+void add_letter(stats_t *st, char *key, unsigned index) {
+    letter_t *l_frequency = stat_letters(st);
+    
+    st->l_total++;
+    
     if(l_frequency[index].key[0] == 0)
         strcpy(l_frequency[index].key, key);
     
     l_frequency[index].count++;
 }
 
+/**
+ *  void add_letters(stats_t *st, stats_t *src)
+ * 
+ *  Adds letter frequencies counted in src to st.
+ */
+void add_letters(stats_t *st, stats_t *src) {
+    int i;
+    
+    if(src->l_frequency == NULL)
+        return;
+    
+    stat_letters(st);
+    
+    for(i = 0; i < L_FREQUENCY_SIZE; i++) {
+        if(src->l_frequency[i].count == 0)
+            continue;
+        
+        if(st->l_frequency[i].key[0] == 0)
+            strcpy(st->l_frequency[i].key, src->l_frequency[i].key);
+        
+        st->l_frequency[i].count += src->l_frequency[i].count;
+    }
+    
+    st->l_total += src->l_total;
+}
+
 /**
  *  int cmp_letter_frequency(const void *a, const void *b)
  * 
@@ -145,60 +267,104 @@ int cmp_letter_frequency(const void *a, const void *b) {
 }
 
 /**
- *  void write_stats(FILE *output_file)
+ *  void write_stats(stats_t *st, FILE *output_file)
  *  
- *  Writes final stats to output_file
+ *  Writes final stats to output_file, with sort_set_top only the given
+ *  number of most frequent words.
  */
-void write_stats(FILE *output_file) {
-    char buff[OBUFFSIZE];
+void write_stats(stats_t *st, FILE *output_file) {
+    char buff[OBUFFSIZE + KEY_MAX_LEN];
     int i;
     word_t *w = NULL;
-    double relative_frequency = 0;
+    word_t **top;
+    unsigned long top_num, n;
+    
+    if(st->approx) {
+        approx_write_stats(st, output_file);
+        return;
+    }
+    
+    if(st->distinct) {
+        distinct_write_stats(st, output_file);
+        return;
+    }
     
-    if(hash_count(word_table) == 0) {
+    if(st->spill && st->spill->num > 0) {
+        spill_write_stats(st, output_file);
+        return;
+    }
+    
+    if(hash_count(st->word_table) == 0) {
         write_line(output_file, "There were no words in input file.");
-        exit(EXIT_SUCCESS);
+        return;
     }
     
     /* total number of words */
-    sprintf(buff, "#words %lu", hash_count(word_table));    
+    sprintf(buff, "#words %lu", hash_count(st->word_table));    
     write_line(output_file, buff);
 
     /* maximum length of a word */
-    sprintf(buff, "#maxlen %u", w_length_max);    
+    sprintf(buff, "#maxlen %u", st->w_length_max);    
     write_line(output_file, buff);
     
     /* word lengths frequency */
-    for(i = 0; i < w_length_max; i++) {
-        sprintf(buff, "#len(%d) %u", (i + 1), w_lengths[i]);
+    for(i = 0; i < st->w_length_max; i++) {
+        sprintf(buff, "#len(%d) %u", (i + 1), st->w_lengths[i]);
         write_line(output_file, buff);
     }
     
     write_line(output_file, "%%%");
     
-    /* sort words by their frequencies */
-    hash_sort(&word_table);
-    
-    /* all words and their frequencies */
-    hash_get_next(word_table, &w);    
-    while(w != NULL) {
-        sprintf(buff, "%s %u", w->key, w->count);
-        write_line(output_file, buff);
+    if(sort_top_count > 0) {
+        /* only the most frequent words, headers above still count all */
+        top = sort_top(st->word_table, sort_top_count, &top_num);
+        
+        for(n = 0; n < top_num; n++) {
+            sprintf(buff, "%s %u", WORD_KEY(top[n]), top[n]->count);
+            write_line(output_file, buff);
+        }
+        
+        free(top);
+    }
+    else {
+        /* sort words by their frequencies */
+        sort_words(&st->word_table);
         
-        hash_get_next(word_table, &w);
+        /* all words and their frequencies */
+        hash_get_next(st->word_table, &w);    
+        while(w != NULL) {
+            sprintf(buff, "%s %u", WORD_KEY(w), w->count);
+            write_line(output_file, buff);
+            
+            hash_get_next(st->word_table, &w);
+        }
     }
     
     write_line(output_file, "%%%");
     
-    if(l_frequency != NULL) {
+    write_letters(st, output_file);
+}
+
+/**
+ *  void write_letters(stats_t *st, FILE *output_file)
+ *  
+ *  Writes letters sorted by their frequencies to output_file, the last
+ *  section of stats.
+ */
+void write_letters(stats_t *st, FILE *output_file) {
+    char buff[OBUFFSIZE];
+    int i;
+    double relative_frequency = 0;
+    
+    if(st->l_frequency != NULL) {
         /* sort letters by their frequencies DESC */
-        qsort(l_frequency, L_FREQUENCY_SIZE, sizeof(letter_t), cmp_letter_frequency);
+        qsort(st->l_frequency, L_FREQUENCY_SIZE, sizeof(letter_t), cmp_letter_frequency);
         
         /* all letters and their frequencies */
         for(i = 0; i < L_FREQUENCY_SIZE; i++) {
-            if(l_frequency[i].count > 0) {
-                relative_frequency = (double) l_frequency[i].count / l_total;
-                sprintf(buff, "%s %.8f", l_frequency[i].key, relative_frequency);
+            if(st->l_frequency[i].count > 0) {
+                relative_frequency = (double) st->l_frequency[i].count / st->l_total;
+                sprintf(buff, "%s %.8f", st->l_frequency[i].key, relative_frequency);
                 write_line(output_file, buff);
             }
         }
@@ -206,20 +372,61 @@ void write_stats(FILE *output_file) {
 }
 
 /**
- *  void stat_free()
+ *  void stat_reset(stats_t *st)
+ * 
+ *  Empties stats so they can be filled again, keeps word lengths array, hash
+ *  table and a slab of arena for reuse. Letter array is freed, write_stats
+ *  sorts it, so the letters aren't at their indexes anymore.
+ */
+void stat_reset(stats_t *st) {
+    if(st->l_frequency != NULL) {
+        free(st->l_frequency);
+        st->l_frequency = NULL;
+    }
+    
+    if(st->w_lengths != NULL) {
+        memset(st->w_lengths, 0, sizeof(unsigned) * st->w_lengths_size);
+    }
+    
+    st->w_length_max = 0;
+    st->l_total = 0;
+    
+    hash_recycle_table(&st->word_table);
+    arena_reset(&st->arena);
+}
+
+/**
+ *  void stat_free(stats_t *st)
  * 
- *  Frees frequency array, word lengths and hash table.
+ *  Frees frequency array, word lengths, hash table, approximate counters,
+ *  sketches and spilled runs.
  */
-void stat_free() {
-    if(l_frequency != NULL) {
-        free(l_frequency);
-        l_frequency = NULL;
+void stat_free(stats_t *st) {
+    if(st->l_frequency != NULL) {
+        free(st->l_frequency);
+        st->l_frequency = NULL;
+    }
+    
+    if(st->w_lengths != NULL) {
+        free(st->w_lengths);    
+        st->w_lengths = NULL;
+    }
+        
+    if(st->approx != NULL) {
+        approx_free(st->approx);
+        st->approx = NULL;
+    }
+    
+    if(st->distinct != NULL) {
+        distinct_free(st->distinct);
+        st->distinct = NULL;
     }
     
-    if(w_lengths != NULL) {
-        free(w_lengths);    
-        w_lengths = NULL;
+    if(st->spill != NULL) {
+        spill_free(st->spill);
+        st->spill = NULL;
     }
         
-    hash_free_table(&word_table);
+    hash_free_table(&st->word_table);
+    arena_free(&st->arena);
 }
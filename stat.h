@@ -12,27 +12,77 @@
 
 #include <stdio.h>
 #include "hash_table.h"
+#include "arena.h"
 
 /* size of letter frequency array */
 #define L_FREQUENCY_SIZE 256
 
-extern word_t *word_table;
-
 /* Structures */
 
+/* thread's view of shared word table, see parallel.c */
+typedef struct shared_chunk shared_chunk_t;
+/* approximate counters of the most frequent words, see approx.c */
+typedef struct approx approx_t;
+/* sketches of distinct words, see hll.c */
+typedef struct distinct distinct_t;
+/* runs of words spilled to disk, see spill.c */
+typedef struct spill spill_t;
+
 typedef struct {
     char key[3];
     unsigned count;
 } letter_t;
 
+typedef struct {
+    /* hash table head for all words */
+    word_t *word_table;
+    
+    /* maximum length of a word */
+    unsigned w_length_max;
+    /* size of w_lengths array */
+    unsigned w_lengths_size;
+    /* array with frequency of word lengths */
+    unsigned *w_lengths;
+    
+    /* array of letters and their frequencies */
+    letter_t *l_frequency;
+    /* total number of letters */
+    unsigned long l_total;
+    
+    /* memory of all words */
+    arena_t arena;
+    
+    /* words are added into shared table instead of word_table */
+    shared_chunk_t *shared;
+    
+    /* words are counted approximately instead of in word_table */
+    approx_t *approx;
+    
+    /* distinct words are only estimated, no word is kept */
+    distinct_t *distinct;
+    
+    /* table is spilled to disk when it takes more memory than allowed */
+    spill_t *spill;
+} stats_t;
+
+/* stats of the whole input */
+extern stats_t stats;
+
 /* Function prototypes */
 
-word_t *find_word(char *key);
-void add_word(char *key);
-void add_word_length(unsigned length);
-void add_letter(char *key, unsigned index);
+void stat_init(stats_t *st);
+word_t *find_word(stats_t *st, char *key);
+void add_word(stats_t *st, char *key);
+void add_word_hashed(stats_t *st, char *key, unsigned length, unsigned long hash);
+word_t *new_word(stats_t *st, char *key, unsigned length);
+void add_word_length(stats_t *st, unsigned length);
+letter_t *stat_letters(stats_t *st);
+void add_letter(stats_t *st, char *key, unsigned index);
+void add_letters(stats_t *st, stats_t *src);
 int cmp_letter_frequency(const void *a, const void *b);
-void write_stats(FILE *output_file);
-void stat_free();
+void write_letters(stats_t *st, FILE *output_file);
+void write_stats(stats_t *st, FILE *output_file);
+void stat_reset(stats_t *st);
+void stat_free(stats_t *st);
 
 #endif	/* STAT_H */